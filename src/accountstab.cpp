@@ -26,20 +26,21 @@ class OwnerSorter : public AndFilterProxy
     Q_DISABLE_COPY_MOVE(OwnerSorter)
 public:
     using AndFilterProxy::AndFilterProxy;
-    bool lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const override;
+
+protected:
+    SortKey sortKey(int source_row, qint32 column, const QModelIndex &source_parent) const override;
 };
 
-bool OwnerSorter::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+MultipleFilterProxy::SortKey OwnerSorter::sortKey(int source_row, qint32 column, const QModelIndex &source_parent) const
 {
-    if (source_left.column() == MainObject::acOwner && source_right.column() == MainObject::acOwner) {
-        const int l = source_left.data(sortRole()).toString().size();
-        const int r = source_right.data(sortRole()).toString().size();
-        if (l < r)
-            return true;
-        if (l > r)
-            return false;
+    SortKey key = AndFilterProxy::sortKey(source_row, column, source_parent);
+    if (column == MainObject::acOwner) {
+        // shorter owner lists first, ties broken alphabetically
+        key.kind = skText;
+        key.text = filterValue(source_row, column, sortRole(), source_parent).toString();
+        key.number = key.text.size();
     }
-    return AndFilterProxy::lessThan(source_left, source_right);
+    return key;
 }
 
 AccountsTab::AccountsTab(QWidget *parent)
@@ -99,8 +100,8 @@ void AccountsTab::setMainObject(MainObject *mainObj)
             ui->accountTypeFilterCombo->setModelColumn(MainObject::atcName);
             ui->ownerFilterCombo->setModelColumn(MainObject::fcName);
         };
-        connect(m_object->accountsModel(), &QAbstractItemModel::rowsInserted, this, setupView);
-        connect(m_object->accountsModel(), &QAbstractItemModel::modelReset, this, setupView);
+        connect(m_filterProxy, &QAbstractItemModel::rowsInserted, this, setupView);
+        connect(m_filterProxy, &QAbstractItemModel::modelReset, this, setupView);
         setupView();
     } else
         ui->removeAccountButton->setEnabled(false);
@@ -109,16 +110,30 @@ void AccountsTab::setMainObject(MainObject *mainObj)
     m_accountTypeDelagate->setRelationModel(m_object ? m_object->accountTypesModel() : nullptr, MainObject::atcId, MainObject::atcName);
 }
 
+void AccountsTab::setActive(bool active)
+{
+    if (!m_object)
+        return;
+    m_filterProxy->setSuspended(!active);
+}
+
 void AccountsTab::onAddAccount()
 {
     Q_ASSERT(m_object);
-    AddAccountDialog addAccountDialog(this);
-    addAccountDialog.setMainObject(m_object);
-    while (addAccountDialog.exec()) {
-        if (m_object->addAccount(addAccountDialog.name(), addAccountDialog.owner(), addAccountDialog.curr(), addAccountDialog.typ()))
-            break;
-        QMessageBox::critical(this, tr("Error"), tr("Failed to add a new account, try again or check your input"));
-    }
+    AddAccountDialog *addAccountDialog = new AddAccountDialog(this);
+    addAccountDialog->setMainObject(m_object);
+    connect(addAccountDialog, &QDialog::rejected, addAccountDialog, &QObject::deleteLater);
+    connect(addAccountDialog, &QDialog::accepted, this, [this, addAccountDialog]() {
+        // the dialog is reopened with the same input if the account could not be added
+        m_object->addAccount(addAccountDialog->name(), addAccountDialog->owner(), addAccountDialog->curr(), addAccountDialog->typ())
+                .then(this, [this, addAccountDialog](bool added) {
+                    if (added)
+                        return addAccountDialog->deleteLater();
+                    QMessageBox::critical(this, tr("Error"), tr("Failed to add a new account, try again or check your input"));
+                    addAccountDialog->open();
+                });
+    });
+    addAccountDialog->open();
 }
 
 void AccountsTab::onRemoveAccount()
@@ -135,8 +150,11 @@ void AccountsTab::onRemoveAccount()
         == QMessageBox::No)
         return;
     Q_ASSERT(m_object);
-    if (!m_object->removeAccounts(idsToRemove))
-        QMessageBox::critical(this, tr("Error"), tr("Failed to remove account(s), try again later", "", idsToRemove.size()));
+    const int removedCount = idsToRemove.size();
+    m_object->removeAccounts(idsToRemove).then(this, [this, removedCount](bool removed) {
+        if (!removed)
+            QMessageBox::critical(this, tr("Error"), tr("Failed to remove account(s), try again later", "", removedCount));
+    });
 }
 
 void AccountsTab::onNameFilterChanged(const QString &text)
@@ -150,32 +168,27 @@ void AccountsTab::onCurrencyFilterChanged(int newIndex)
 {
     if (newIndex == 0)
         return m_filterProxy->removeFilterFromColumn(MainObject::acCurrency);
-    m_filterProxy->setRegExpFilter(
-            MainObject::acCurrency,
-            QRegularExpression(QString::number(m_object->currenciesModel()->index(newIndex - 1, MainObject::ccId).data().toInt())));
+    m_filterProxy->setValueFilter(MainObject::acCurrency, m_object->currenciesModel()->index(newIndex - 1, MainObject::ccId).data().toInt());
 }
 
 void AccountsTab::onAccountTypeFilterChanged(int newIndex)
 {
     if (newIndex == 0)
         return m_filterProxy->removeFilterFromColumn(MainObject::acAccountType);
-    m_filterProxy->setRegExpFilter(
-            MainObject::acAccountType,
-            QRegularExpression(QString::number(m_object->accountTypesModel()->index(newIndex - 1, MainObject::atcId).data().toInt())));
+    m_filterProxy->setValueFilter(MainObject::acAccountType, m_object->accountTypesModel()->index(newIndex - 1, MainObject::atcId).data().toInt());
 }
 
 void AccountsTab::onOwnerFilterChanged(int newIndex)
 {
     if (newIndex == 0)
         return m_filterProxy->removeFilterFromColumn(MainObject::acOwner);
-    m_filterProxy->setRegExpFilter(
-            MainObject::acOwner, QRegularExpression(QString::number(m_object->familyModel()->index(newIndex - 1, MainObject::fcId).data().toInt())));
+    m_filterProxy->setValueFilter(MainObject::acOwner, m_object->familyModel()->index(newIndex - 1, MainObject::fcId).data().toInt());
 }
 
 void AccountsTab::onOpenFilterChanged()
 {
     if (ui->openAccountCheck->checkState() == Qt::Checked)
-        m_filterProxy->setRegExpFilter(MainObject::acAccountStatus, QRegularExpression(QStringLiteral("1")));
+        m_filterProxy->setValueFilter(MainObject::acAccountStatus, 1);
     else
         m_filterProxy->removeFilterFromColumn(MainObject::acAccountStatus);
 }
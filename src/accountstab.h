@@ -32,6 +32,7 @@ public:
     explicit AccountsTab(QWidget *parent = nullptr);
     ~AccountsTab();
     void setMainObject(MainObject *mainObj);
+    void setActive(bool active);
 
 private:
     void onAddAccount();
@@ -0,0 +1,127 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "budgetcheckpointer.h"
+#include "globals.h"
+#include <QFile>
+#include <QSaveFile>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTimer>
+#ifdef QT_DEBUG
+#    include <QSqlError>
+#endif
+#define CHECKPOINT_CONNECTION_NAME QStringLiteral("BudgetCheckpointDB")
+#define CHECKPOINT_INTERVAL 5000
+#define AUTOSAVE_INTERVAL 60000
+
+BudgetCheckpointer::BudgetCheckpointer(QObject *parent)
+    : QObject(parent)
+    , m_checkpointTimer(new QTimer(this))
+    , m_autosaveTimer(new QTimer(this))
+    , m_changed(0)
+{
+    m_checkpointTimer->setInterval(CHECKPOINT_INTERVAL);
+    m_autosaveTimer->setInterval(AUTOSAVE_INTERVAL);
+    connect(m_checkpointTimer, &QTimer::timeout, this, &BudgetCheckpointer::onCheckpointTimeout);
+    connect(m_autosaveTimer, &QTimer::timeout, this, &BudgetCheckpointer::onAutosaveTimeout);
+}
+
+void BudgetCheckpointer::markChanged()
+{
+    m_changed.storeRelaxed(1);
+}
+
+void BudgetCheckpointer::start(const QString &path)
+{
+    suspend();
+    m_path = path;
+    if (m_path.isEmpty()) {
+        // budgets in memory have nothing to checkpoint, their snapshots come from the owning thread
+        m_autosaveTimer->start();
+        return;
+    }
+    QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), CHECKPOINT_CONNECTION_NAME);
+    db.setDatabaseName(m_path);
+    if (!db.open()) {
+#ifdef QT_DEBUG
+        qDebug() << db.lastError().text();
+#endif
+        return;
+    }
+    m_checkpointTimer->start();
+    m_autosaveTimer->start();
+}
+
+void BudgetCheckpointer::suspend()
+{
+    m_checkpointTimer->stop();
+    m_autosaveTimer->stop();
+    m_changed.storeRelaxed(0);
+    closeDb(CHECKPOINT_CONNECTION_NAME);
+}
+
+void BudgetCheckpointer::writeAutosave(const QByteArray &image)
+{
+    if (!m_path.isEmpty() || !m_autosaveTimer->isActive())
+        return;
+    QSaveFile autosaveFile(autosaveDbFilePath());
+    if (!autosaveFile.open(QSaveFile::WriteOnly) || autosaveFile.write(image) != image.size() || !autosaveFile.commit())
+        m_changed.storeRelaxed(1);
+}
+
+void BudgetCheckpointer::onCheckpointTimeout()
+{
+    QSqlDatabase db = QSqlDatabase::database(CHECKPOINT_CONNECTION_NAME, false);
+    if (!db.isOpen())
+        return;
+    // PASSIVE never waits for the editing connection, frames still in use are copied on a later run
+    QSqlQuery checkpointQuery(db);
+    if (!checkpointQuery.exec(QStringLiteral("PRAGMA wal_checkpoint(PASSIVE)"))) {
+#ifdef QT_DEBUG
+        qDebug() << checkpointQuery.lastQuery() << checkpointQuery.lastError().text();
+#endif
+    }
+}
+
+void BudgetCheckpointer::onAutosaveTimeout()
+{
+    if (!m_changed.testAndSetRelaxed(1, 0))
+        return;
+    if (m_path.isEmpty()) {
+        Q_EMIT autosaveRequested();
+        return;
+    }
+    QSqlDatabase db = QSqlDatabase::database(CHECKPOINT_CONNECTION_NAME, false);
+    if (!db.isOpen())
+        return;
+    const QString snapshotPath = autosaveDbFilePath() + QLatin1String(".tmp");
+    if (QFile::exists(snapshotPath) && !QFile::remove(snapshotPath))
+        return;
+    QSqlQuery vacuumQuery(db);
+    vacuumQuery.prepare(QStringLiteral("VACUUM INTO ?"));
+    vacuumQuery.addBindValue(snapshotPath);
+    if (!vacuumQuery.exec()) {
+#ifdef QT_DEBUG
+        qDebug() << vacuumQuery.executedQuery() << vacuumQuery.lastError().text();
+#endif
+        m_changed.storeRelaxed(1);
+        return;
+    }
+    // the previous autosave stays in place until the new one is complete on disk and replaces it in one rename
+    QFile snapshotFile(snapshotPath);
+    if (!snapshotFile.open(QFile::ReadWrite) || !syncFile(snapshotFile) || !replaceFile(snapshotPath, autosaveDbFilePath())) {
+        snapshotFile.close();
+        CHECK_TRUE(QFile::remove(snapshotPath));
+        m_changed.storeRelaxed(1);
+    }
+}
@@ -0,0 +1,40 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef BUDGETCHECKPOINTER_H
+#define BUDGETCHECKPOINTER_H
+#include <QObject>
+#include <QAtomicInt>
+class QTimer;
+class BudgetCheckpointer : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY_MOVE(BudgetCheckpointer)
+public:
+    explicit BudgetCheckpointer(QObject *parent = nullptr);
+    void markChanged();
+    void start(const QString &path);
+    void suspend();
+    void writeAutosave(const QByteArray &image);
+signals:
+    void autosaveRequested();
+
+private:
+    void onCheckpointTimeout();
+    void onAutosaveTimeout();
+    QTimer *m_checkpointTimer;
+    QTimer *m_autosaveTimer;
+    QString m_path;
+    QAtomicInt m_changed;
+};
+
+#endif // BUDGETCHECKPOINTER_H
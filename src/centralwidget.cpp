@@ -13,15 +13,22 @@
 
 #include "centralwidget.h"
 #include "ui_centralwidget.h"
+#include "accountstab.h"
+#include "familytab.h"
+#include "transactionstab.h"
 #include <mainobject.h>
 
 CentralWidget::CentralWidget(QWidget *parent)
     : QWidget(parent)
     , m_object(nullptr)
+    , m_familyWidget(nullptr)
+    , m_accountsWidget(nullptr)
+    , m_transactionsWidget(nullptr)
     , ui(new Ui::CentralWidget)
 {
 
     ui->setupUi(this);
+    connect(ui->tabWidget, &QTabWidget::currentChanged, this, &CentralWidget::onCurrentTabChanged);
 }
 
 CentralWidget::~CentralWidget()
@@ -32,7 +39,37 @@ CentralWidget::~CentralWidget()
 void CentralWidget::setMainObject(MainObject *mainObj)
 {
     m_object = mainObj;
-    ui->accountsWidget->setMainObject(mainObj);
-    ui->transactionsWidget->setMainObject(mainObj);
-    ui->familyWidget->setMainObject(mainObj);
+    // tabs are rebuilt on demand against the new object
+    delete m_familyWidget;
+    delete m_accountsWidget;
+    delete m_transactionsWidget;
+    m_familyWidget = nullptr;
+    m_accountsWidget = nullptr;
+    m_transactionsWidget = nullptr;
+    onCurrentTabChanged(ui->tabWidget->currentIndex());
+}
+
+void CentralWidget::onCurrentTabChanged(int index)
+{
+    if (!m_object)
+        return;
+    // hidden tabs detach their proxies so edits elsewhere don't invalidate them, they resync once when shown
+    QWidget *page = ui->tabWidget->widget(index);
+    if (m_accountsWidget)
+        m_accountsWidget->setActive(page == ui->accountsTab);
+    if (m_transactionsWidget)
+        m_transactionsWidget->setActive(page == ui->transactionTab);
+    if (page == ui->familyTab && !m_familyWidget) {
+        m_familyWidget = new FamilyTab(page);
+        m_familyWidget->setMainObject(m_object);
+        page->layout()->addWidget(m_familyWidget);
+    } else if (page == ui->accountsTab && !m_accountsWidget) {
+        m_accountsWidget = new AccountsTab(page);
+        m_accountsWidget->setMainObject(m_object);
+        page->layout()->addWidget(m_accountsWidget);
+    } else if (page == ui->transactionTab && !m_transactionsWidget) {
+        m_transactionsWidget = new TransactionsTab(page);
+        m_transactionsWidget->setMainObject(m_object);
+        page->layout()->addWidget(m_transactionsWidget);
+    }
 }
@@ -16,7 +16,9 @@
 #include <QList>
 #include <QWidget>
 class MainObject;
-class RelationalDelegate;
+class AccountsTab;
+class FamilyTab;
+class TransactionsTab;
 namespace Ui {
 class CentralWidget;
 }
@@ -31,7 +33,11 @@ public:
     void setMainObject(MainObject *mainObj);
 
 private:
+    void onCurrentTabChanged(int index);
     MainObject *m_object;
+    FamilyTab *m_familyWidget;
+    AccountsTab *m_accountsWidget;
+    TransactionsTab *m_transactionsWidget;
     Ui::CentralWidget *ui;
 };
 #endif
@@ -0,0 +1,233 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "changejournal.h"
+#include "globals.h"
+#include <QDataStream>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlRecord>
+#include <QStringList>
+#ifdef QT_DEBUG
+#    include <QSqlError>
+#endif
+#define CHANGE_JOURNAL_VERSION quint32(1)
+
+namespace {
+QString quoteIdentifier(const QString &name)
+{
+    QString result = name;
+    result.replace(QLatin1Char('"'), QLatin1String("\"\""));
+    return QLatin1Char('"') + result + QLatin1Char('"');
+}
+
+QString quoteLiteral(const QString &value)
+{
+    QString result = value;
+    result.replace(QLatin1Char('\''), QLatin1String("''"));
+    return QLatin1Char('\'') + result + QLatin1Char('\'');
+}
+
+bool execQuery(QSqlQuery &query, const QString &statement)
+{
+    if (query.exec(statement))
+        return true;
+#ifdef QT_DEBUG
+    qDebug() << query.lastQuery() << query.lastError().text();
+#endif
+    return false;
+}
+
+bool execPrepared(QSqlQuery &query)
+{
+    if (query.exec())
+        return true;
+#ifdef QT_DEBUG
+    qDebug() << query.executedQuery() << query.lastError().text();
+#endif
+    return false;
+}
+
+// VACUUM only keeps rowids that alias an INTEGER PRIMARY KEY, other tables are journaled whole
+bool hasStableRowId(QSqlDatabase &db, const QString &table)
+{
+    QSqlQuery infoQuery(db);
+    if (!execQuery(infoQuery, QStringLiteral("PRAGMA main.table_info(") + quoteIdentifier(table) + QLatin1Char(')')))
+        return false;
+    int primaryKeyCount = 0;
+    bool integerKey = false;
+    while (infoQuery.next()) {
+        if (infoQuery.value(5).toInt() > 0) {
+            ++primaryKeyCount;
+            integerKey = infoQuery.value(2).toString().compare(QLatin1String("INTEGER"), Qt::CaseInsensitive) == 0;
+        }
+    }
+    return primaryKeyCount == 1 && integerKey;
+}
+}
+
+bool installChangeTracking(QSqlDatabase &db)
+{
+    QSqlQuery trackingQuery(db);
+    if (!execQuery(trackingQuery,
+                   QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS BudgetChanges (TableName TEXT NOT NULL, ChangedRowId INTEGER NOT NULL, PRIMARY "
+                                  "KEY (TableName, ChangedRowId)) WITHOUT ROWID")))
+        return false;
+    QStringList tables;
+    if (!execQuery(trackingQuery, QStringLiteral("SELECT name FROM main.sqlite_master WHERE type='table' AND name NOT LIKE 'sqlite_%'")))
+        return false;
+    while (trackingQuery.next())
+        tables.append(trackingQuery.value(0).toString());
+    for (const QString &table : std::as_const(tables)) {
+        const QString logRow =
+                QStringLiteral("INSERT OR IGNORE INTO temp.BudgetChanges VALUES (") + quoteLiteral(table) + QStringLiteral(", %1.rowid); ");
+        const auto createTrigger = [&trackingQuery, &table](const QString &event, const QString &body) -> bool {
+            return execQuery(trackingQuery,
+                             QStringLiteral("CREATE TEMP TRIGGER IF NOT EXISTS ") + quoteIdentifier(QStringLiteral("BudgetChanges_") + table + event)
+                                     + QStringLiteral(" AFTER ") + event + QStringLiteral(" ON main.") + quoteIdentifier(table)
+                                     + QStringLiteral(" BEGIN ") + body + QStringLiteral("END"));
+        };
+        if (!createTrigger(QStringLiteral("INSERT"), logRow.arg(QLatin1String("NEW")))
+            || !createTrigger(QStringLiteral("UPDATE"), logRow.arg(QLatin1String("OLD")) + logRow.arg(QLatin1String("NEW")))
+            || !createTrigger(QStringLiteral("DELETE"), logRow.arg(QLatin1String("OLD"))))
+            return false;
+    }
+    return true;
+}
+
+bool clearChangeJournal(QSqlDatabase &db)
+{
+    QSqlQuery clearQuery(db);
+    return execQuery(clearQuery, QStringLiteral("DELETE FROM temp.BudgetChanges"));
+}
+
+bool collectChangeJournal(QSqlDatabase &db, QByteArray *journal)
+{
+    Q_ASSERT(journal);
+    journal->clear();
+    if (!db.transaction())
+        return false;
+    QStringList tables;
+    {
+        QSqlQuery tablesQuery(db);
+        if (!execQuery(tablesQuery, QStringLiteral("SELECT DISTINCT TableName FROM temp.BudgetChanges"))) {
+            CHECK_TRUE(db.rollback());
+            return false;
+        }
+        while (tablesQuery.next())
+            tables.append(tablesQuery.value(0).toString());
+    }
+    if (tables.isEmpty())
+        return db.commit();
+    QDataStream stream(journal, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_6_0);
+    stream << CHANGE_JOURNAL_VERSION << quint32(tables.size());
+    for (const QString &table : std::as_const(tables)) {
+        const bool wholeTable = !hasStableRowId(db, table);
+        QSqlQuery rowsQuery(db);
+        if (wholeTable) {
+            rowsQuery.prepare(QStringLiteral("SELECT * FROM main.") + quoteIdentifier(table));
+        } else {
+            rowsQuery.prepare(QStringLiteral("SELECT * FROM main.") + quoteIdentifier(table)
+                              + QStringLiteral(" WHERE rowid IN (SELECT ChangedRowId FROM temp.BudgetChanges WHERE TableName=?)"));
+            rowsQuery.addBindValue(table);
+        }
+        rowsQuery.setForwardOnly(true);
+        if (!execPrepared(rowsQuery)) {
+            CHECK_TRUE(db.rollback());
+            return false;
+        }
+        const QSqlRecord rowRecord = rowsQuery.record();
+        QStringList columns;
+        for (int i = 0, maxI = rowRecord.count(); i < maxI; ++i)
+            columns.append(rowRecord.fieldName(i));
+        QList<QVariantList> rows;
+        while (rowsQuery.next()) {
+            QVariantList row;
+            row.reserve(columns.size());
+            for (int i = 0, maxI = columns.size(); i < maxI; ++i)
+                row.append(rowsQuery.value(i));
+            rows.append(row);
+        }
+        QList<qint64> deletedRowIds;
+        if (!wholeTable) {
+            QSqlQuery deletedQuery(db);
+            deletedQuery.prepare(QStringLiteral("SELECT ChangedRowId FROM temp.BudgetChanges WHERE TableName=? AND ChangedRowId NOT IN (SELECT "
+                                                "rowid FROM main.")
+                                 + quoteIdentifier(table) + QLatin1Char(')'));
+            deletedQuery.addBindValue(table);
+            if (!execPrepared(deletedQuery)) {
+                CHECK_TRUE(db.rollback());
+                return false;
+            }
+            while (deletedQuery.next())
+                deletedRowIds.append(deletedQuery.value(0).toLongLong());
+        }
+        stream << table << wholeTable << columns << rows << deletedRowIds;
+    }
+    if (!clearChangeJournal(db)) {
+        CHECK_TRUE(db.rollback());
+        return false;
+    }
+    return db.commit();
+}
+
+bool applyChangeJournal(QSqlDatabase &db, const QByteArray &journal)
+{
+    QDataStream stream(journal);
+    stream.setVersion(QDataStream::Qt_6_0);
+    quint32 journalVersion;
+    quint32 tableCount;
+    stream >> journalVersion >> tableCount;
+    if (stream.status() != QDataStream::Ok || journalVersion != CHANGE_JOURNAL_VERSION)
+        return false;
+    for (quint32 t = 0; t < tableCount; ++t) {
+        QString table;
+        bool wholeTable;
+        QStringList columns;
+        QList<QVariantList> rows;
+        QList<qint64> deletedRowIds;
+        stream >> table >> wholeTable >> columns >> rows >> deletedRowIds;
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        QSqlQuery deleteQuery(db);
+        if (wholeTable) {
+            if (!execQuery(deleteQuery, QStringLiteral("DELETE FROM main.") + quoteIdentifier(table)))
+                return false;
+        } else if (!deletedRowIds.isEmpty()) {
+            deleteQuery.prepare(QStringLiteral("DELETE FROM main.") + quoteIdentifier(table) + QStringLiteral(" WHERE rowid=?"));
+            for (qint64 rowId : std::as_const(deletedRowIds)) {
+                deleteQuery.bindValue(0, rowId);
+                if (!execPrepared(deleteQuery))
+                    return false;
+            }
+        }
+        if (rows.isEmpty())
+            continue;
+        QStringList quotedColumns;
+        for (const QString &column : std::as_const(columns))
+            quotedColumns.append(quoteIdentifier(column));
+        QSqlQuery insertQuery(db);
+        insertQuery.prepare(QStringLiteral("INSERT OR REPLACE INTO main.") + quoteIdentifier(table) + QStringLiteral(" (")
+                            + quotedColumns.join(QLatin1Char(',')) + QStringLiteral(") VALUES (")
+                            + QStringList(columns.size(), QStringLiteral("?")).join(QLatin1Char(',')) + QLatin1Char(')'));
+        for (const QVariantList &row : std::as_const(rows)) {
+            if (row.size() != columns.size())
+                return false;
+            for (int i = 0, maxI = row.size(); i < maxI; ++i)
+                insertQuery.bindValue(i, row.at(i));
+            if (!execPrepared(insertQuery))
+                return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,21 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+#include <QByteArray>
+class QSqlDatabase;
+bool installChangeTracking(QSqlDatabase &db);
+bool clearChangeJournal(QSqlDatabase &db);
+bool collectChangeJournal(QSqlDatabase &db, QByteArray *journal);
+bool applyChangeJournal(QSqlDatabase &db, const QByteArray &journal);
+#endif // CHANGEJOURNAL_H
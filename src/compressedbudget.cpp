@@ -0,0 +1,267 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "compressedbudget.h"
+#include "globals.h"
+#include <QDataStream>
+#include <QThread>
+#include <QtConcurrent>
+#include <numeric>
+#define COMPRESSED_BUDGET_MAGIC QByteArrayLiteral("BUDZ")
+#define COMPRESSED_JOURNAL_MAGIC QByteArrayLiteral("BUDJ")
+#define COMPRESSED_BUDGET_VERSION quint32(1)
+#define COMPRESSED_BLOCK_SIZE quint32(1 << 20)
+// magic, container version, block size and image size
+#define COMPRESSED_HEADER_SIZE 20
+// index offset, block count and magic. Journal trailers have the same size
+#define COMPRESSED_FOOTER_SIZE 16
+
+CompressedBudgetReader::CompressedBudgetReader()
+    : m_imageSize(0)
+    , m_blockSize(0)
+    , m_logicalSize(0)
+{ }
+
+bool CompressedBudgetReader::isCompressedBudget(const QString &path)
+{
+    QFile source(path);
+    if (!source.open(QFile::ReadOnly))
+        return false;
+    return source.read(COMPRESSED_BUDGET_MAGIC.size()) == COMPRESSED_BUDGET_MAGIC;
+}
+
+bool CompressedBudgetReader::open(const QString &path)
+{
+    m_blocks.clear();
+    m_journals.clear();
+    m_logicalSize = 0;
+    m_file.close();
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::ReadOnly))
+        return false;
+    if (m_file.size() < COMPRESSED_HEADER_SIZE + COMPRESSED_FOOTER_SIZE)
+        return false;
+    QDataStream stream(&m_file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    if (m_file.read(COMPRESSED_BUDGET_MAGIC.size()) != COMPRESSED_BUDGET_MAGIC)
+        return false;
+    quint32 containerVersion;
+    stream >> containerVersion >> m_blockSize >> m_imageSize;
+    if (containerVersion != COMPRESSED_BUDGET_VERSION || m_blockSize == 0)
+        return false;
+    if (readTrailers(m_file.size()))
+        return true;
+    // a journal append was interrupted, fall back to the last complete trailer
+    const qint64 chunkSize = 1 << 16;
+    for (qint64 chunkEnd = m_file.size(); chunkEnd > COMPRESSED_HEADER_SIZE; chunkEnd -= chunkSize - 3) {
+        const qint64 chunkStart = std::max<qint64>(COMPRESSED_HEADER_SIZE, chunkEnd - chunkSize);
+        if (!m_file.seek(chunkStart))
+            return false;
+        const QByteArray chunk = m_file.read(chunkEnd - chunkStart);
+        for (qsizetype magicPos = chunk.size() - 4; magicPos >= 0; --magicPos) {
+            const QByteArrayView candidate = QByteArrayView(chunk).sliced(magicPos, 4);
+            if (candidate != COMPRESSED_BUDGET_MAGIC && candidate != COMPRESSED_JOURNAL_MAGIC)
+                continue;
+            if (readTrailers(chunkStart + magicPos + 4))
+                return true;
+        }
+        if (chunkStart == COMPRESSED_HEADER_SIZE)
+            break;
+    }
+    return false;
+}
+
+bool CompressedBudgetReader::readTrailers(qint64 end)
+{
+    m_blocks.clear();
+    m_journals.clear();
+    QDataStream stream(&m_file);
+    stream.setVersion(QDataStream::Qt_6_0);
+    const qint64 logicalSize = end;
+    for (;;) {
+        if (end < COMPRESSED_HEADER_SIZE + COMPRESSED_FOOTER_SIZE || !m_file.seek(end - COMPRESSED_FOOTER_SIZE))
+            return false;
+        quint64 offset;
+        quint32 count;
+        stream >> offset >> count;
+        const QByteArray magic = m_file.read(COMPRESSED_BUDGET_MAGIC.size());
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        if (magic == COMPRESSED_JOURNAL_MAGIC) {
+            // journal trailers store where the record starts and its size
+            if (offset < COMPRESSED_HEADER_SIZE || offset + count + COMPRESSED_FOOTER_SIZE != quint64(end))
+                return false;
+            m_journals.prepend(BlockInfo{offset, count});
+            end = offset;
+            continue;
+        }
+        if (magic != COMPRESSED_BUDGET_MAGIC)
+            return false;
+        const quint64 indexOffset = offset;
+        const quint32 blockCount = count;
+        if (blockCount != (m_imageSize + m_blockSize - 1) / m_blockSize)
+            return false;
+        if (indexOffset + (quint64(blockCount) * 12) + COMPRESSED_FOOTER_SIZE != quint64(end) || !m_file.seek(indexOffset))
+            return false;
+        m_blocks.resize(blockCount);
+        for (BlockInfo &block : m_blocks) {
+            stream >> block.offset >> block.size;
+            if (block.offset + block.size > indexOffset)
+                return false;
+        }
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        m_logicalSize = logicalSize;
+        return true;
+    }
+}
+
+int CompressedBudgetReader::blockCount() const
+{
+    return m_blocks.size();
+}
+
+quint64 CompressedBudgetReader::imageSize() const
+{
+    return m_imageSize;
+}
+
+quint32 CompressedBudgetReader::blockSize() const
+{
+    return m_blockSize;
+}
+
+QByteArray CompressedBudgetReader::readBlock(int index)
+{
+    Q_ASSERT(index >= 0 && index < m_blocks.size());
+    const BlockInfo &block = m_blocks.at(index);
+    if (!m_file.seek(block.offset))
+        return QByteArray();
+    const QByteArray result = qUncompress(m_file.read(block.size));
+    const quint64 expectedSize = index == m_blocks.size() - 1 ? m_imageSize - (quint64(index) * m_blockSize) : m_blockSize;
+    if (quint64(result.size()) != expectedSize)
+        return QByteArray();
+    return result;
+}
+
+int CompressedBudgetReader::imageVersion()
+{
+    // the SQLite header lives in the first block so nothing else needs to be decompressed
+    if (m_blocks.isEmpty())
+        return -1;
+    return budgetImageVersion(readBlock(0).left(100));
+}
+
+bool CompressedBudgetReader::extract(QIODevice *destination)
+{
+    Q_ASSERT(destination);
+    for (int i = 0, maxI = m_blocks.size(); i < maxI; ++i) {
+        const QByteArray block = readBlock(i);
+        if (block.isEmpty() || destination->write(block) != block.size())
+            return false;
+    }
+    return true;
+}
+
+int CompressedBudgetReader::journalCount() const
+{
+    return m_journals.size();
+}
+
+QByteArray CompressedBudgetReader::readJournal(int index)
+{
+    Q_ASSERT(index >= 0 && index < m_journals.size());
+    const BlockInfo &journal = m_journals.at(index);
+    if (!m_file.seek(journal.offset))
+        return QByteArray();
+    return qUncompress(m_file.read(journal.size));
+}
+
+bool appendCompressedJournal(const QString &path, const QByteArray &journal)
+{
+    CompressedBudgetReader reader;
+    if (!reader.open(path))
+        return false;
+    const qint64 logicalSize = reader.m_logicalSize;
+    reader.m_file.close();
+    const QByteArray record = qCompress(journal);
+    if (record.isEmpty())
+        return false;
+    QFile destination(path);
+    if (!destination.open(QFile::ReadWrite))
+        return false;
+    // drops what is left of an interrupted append
+    if (!destination.resize(logicalSize) || !destination.seek(logicalSize))
+        return false;
+    QDataStream stream(&destination);
+    stream.setVersion(QDataStream::Qt_6_0);
+    // the record is on disk before the trailer that makes it part of the file
+    bool result = destination.write(record) == record.size() && syncFile(destination);
+    if (result) {
+        stream << quint64(logicalSize) << quint32(record.size());
+        result = stream.status() == QDataStream::Ok && destination.write(COMPRESSED_JOURNAL_MAGIC) == COMPRESSED_JOURNAL_MAGIC.size()
+                && syncFile(destination);
+    }
+    if (!result)
+        CHECK_TRUE(destination.resize(logicalSize));
+    return result;
+}
+
+bool writeCompressedBudget(const QString &imagePath, QIODevice *destination)
+{
+    Q_ASSERT(destination);
+    QFile source(imagePath);
+    if (!source.open(QFile::ReadOnly))
+        return false;
+    const quint64 imageSize = source.size();
+    uchar *image = imageSize > 0 ? source.map(0, imageSize) : nullptr;
+    if (!image)
+        return false;
+    const int blockCount = (imageSize + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE;
+    QDataStream stream(destination);
+    stream.setVersion(QDataStream::Qt_6_0);
+    destination->write(COMPRESSED_BUDGET_MAGIC);
+    stream << COMPRESSED_BUDGET_VERSION << COMPRESSED_BLOCK_SIZE << imageSize;
+    quint64 offset = COMPRESSED_HEADER_SIZE;
+    QList<quint64> offsets;
+    QList<quint32> sizes;
+    offsets.reserve(blockCount);
+    sizes.reserve(blockCount);
+    // blocks are independent so a window of them is compressed in parallel and written in order
+    const int windowSize = std::max(1, QThread::idealThreadCount()) * 2;
+    QList<int> window;
+    for (int windowStart = 0; windowStart < blockCount; windowStart += windowSize) {
+        window.resize(std::min(windowSize, blockCount - windowStart));
+        std::iota(window.begin(), window.end(), windowStart);
+        const auto compressBlock = [image, imageSize](int blockIndex) -> QByteArray {
+            const quint64 blockStart = quint64(blockIndex) * COMPRESSED_BLOCK_SIZE;
+            return qCompress(image + blockStart, std::min<quint64>(COMPRESSED_BLOCK_SIZE, imageSize - blockStart));
+        };
+        const QList<QByteArray> compressedBlocks = QtConcurrent::blockingMapped<QList<QByteArray>>(window, compressBlock);
+        for (const QByteArray &compressedBlock : compressedBlocks) {
+            if (compressedBlock.isEmpty() || destination->write(compressedBlock) != compressedBlock.size()) {
+                source.unmap(image);
+                return false;
+            }
+            offsets.append(offset);
+            sizes.append(compressedBlock.size());
+            offset += compressedBlock.size();
+        }
+    }
+    source.unmap(image);
+    const quint64 indexOffset = offset;
+    for (int i = 0; i < blockCount; ++i)
+        stream << offsets.at(i) << sizes.at(i);
+    stream << indexOffset << quint32(blockCount);
+    destination->write(COMPRESSED_BUDGET_MAGIC);
+    return stream.status() == QDataStream::Ok;
+}
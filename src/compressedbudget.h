@@ -0,0 +1,54 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef COMPRESSEDBUDGET_H
+#define COMPRESSEDBUDGET_H
+#include <QFile>
+#include <QList>
+#include <QString>
+class QIODevice;
+
+class CompressedBudgetReader
+{
+    Q_DISABLE_COPY_MOVE(CompressedBudgetReader)
+public:
+    CompressedBudgetReader();
+    bool open(const QString &path);
+    int blockCount() const;
+    quint64 imageSize() const;
+    quint32 blockSize() const;
+    QByteArray readBlock(int index);
+    int imageVersion();
+    bool extract(QIODevice *destination);
+    int journalCount() const;
+    QByteArray readJournal(int index);
+    static bool isCompressedBudget(const QString &path);
+
+private:
+    friend bool appendCompressedJournal(const QString &path, const QByteArray &journal);
+    bool readTrailers(qint64 end);
+    struct BlockInfo
+    {
+        quint64 offset;
+        quint32 size;
+    };
+    QFile m_file;
+    QList<BlockInfo> m_blocks;
+    QList<BlockInfo> m_journals;
+    quint64 m_imageSize;
+    quint32 m_blockSize;
+    qint64 m_logicalSize;
+};
+
+bool writeCompressedBudget(const QString &imagePath, QIODevice *destination);
+bool appendCompressedJournal(const QString &path, const QByteArray &journal);
+#endif // COMPRESSEDBUDGET_H
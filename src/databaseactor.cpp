@@ -0,0 +1,52 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "databaseactor.h"
+#include "globals.h"
+#include <QThread>
+
+namespace {
+DatabaseActor *activeActor = nullptr;
+}
+
+DatabaseActor::DatabaseActor()
+    : m_thread(new QThread)
+    , m_context(new QObject)
+{
+    Q_ASSERT_X(!activeActor, "DatabaseActor", "only one database actor can run at a time");
+    activeActor = this;
+    m_thread->setObjectName(QStringLiteral("BudgetDatabaseThread"));
+    m_context->moveToThread(m_thread);
+    QObject::connect(m_thread, &QThread::finished, m_context, &QObject::deleteLater);
+    m_thread->start();
+}
+
+DatabaseActor::~DatabaseActor()
+{
+    // the connection belongs to the actor thread so it has to be closed there
+    runBlocking([]() { closeDb(); });
+    m_thread->quit();
+    m_thread->wait();
+    activeActor = nullptr;
+    delete m_thread;
+}
+
+bool DatabaseActor::isDatabaseThread()
+{
+    return activeActor && QThread::currentThread() == activeActor->m_thread;
+}
+
+void DatabaseActor::post(std::function<void()> &&job)
+{
+    Q_ASSERT_X(activeActor, "DatabaseActor::post", "no database actor is running");
+    QMetaObject::invokeMethod(activeActor->m_context, std::move(job), Qt::QueuedConnection);
+}
@@ -0,0 +1,70 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef DATABASEACTOR_H
+#define DATABASEACTOR_H
+#include <QFuture>
+#include <QPromise>
+#include <functional>
+#include <memory>
+#include <type_traits>
+class QObject;
+class QThread;
+class DatabaseActor
+{
+    Q_DISABLE_COPY_MOVE(DatabaseActor)
+public:
+    DatabaseActor();
+    ~DatabaseActor();
+    static bool isDatabaseThread();
+    template<class Function>
+    static QFuture<std::invoke_result_t<Function>> run(Function function);
+    template<class Function>
+    static std::invoke_result_t<Function> runBlocking(Function function);
+
+private:
+    static void post(std::function<void()> &&job);
+    QThread *m_thread;
+    QObject *m_context;
+};
+
+template<class Function>
+QFuture<std::invoke_result_t<Function>> DatabaseActor::run(Function function)
+{
+    using Result = std::invoke_result_t<Function>;
+    // a promise instead of QtConcurrent so waiting on the future can never steal the job onto the calling thread
+    auto promise = std::make_shared<QPromise<Result>>();
+    QFuture<Result> future = promise->future();
+    promise->start();
+    post([promise, function]() mutable {
+        if constexpr (std::is_void_v<Result>)
+            function();
+        else
+            promise->addResult(function());
+        promise->finish();
+    });
+    return future;
+}
+
+template<class Function>
+std::invoke_result_t<Function> DatabaseActor::runBlocking(Function function)
+{
+    // jobs started by the actor itself would wait on their own queue
+    if (isDatabaseThread())
+        return function();
+    if constexpr (std::is_void_v<std::invoke_result_t<Function>>)
+        run(std::move(function)).waitForFinished();
+    else
+        return run(std::move(function)).result();
+}
+
+#endif // DATABASEACTOR_H
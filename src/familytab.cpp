@@ -62,14 +62,21 @@ void FamilyTab::setMainObject(MainObject *mainObj)
 void FamilyTab::onAddFamily()
 {
     Q_ASSERT(m_object);
-    AddFamilyMemberDialog addFamilyDialog(this);
-    addFamilyDialog.setMainObject(m_object);
-    while (addFamilyDialog.exec()) {
-        if (m_object->addFamilyMember(addFamilyDialog.name(), addFamilyDialog.birthday(), addFamilyDialog.annualIncome(),
-                                      addFamilyDialog.incomeCurrency(), addFamilyDialog.retirementAge()))
-            break;
-        QMessageBox::critical(this, tr("Error"), tr("Failed to add a new family member, try again or check your input"));
-    }
+    AddFamilyMemberDialog *addFamilyDialog = new AddFamilyMemberDialog(this);
+    addFamilyDialog->setMainObject(m_object);
+    connect(addFamilyDialog, &QDialog::rejected, addFamilyDialog, &QObject::deleteLater);
+    connect(addFamilyDialog, &QDialog::accepted, this, [this, addFamilyDialog]() {
+        // the dialog is reopened with the same input if the family member could not be added
+        m_object->addFamilyMember(addFamilyDialog->name(), addFamilyDialog->birthday(), addFamilyDialog->annualIncome(),
+                                  addFamilyDialog->incomeCurrency(), addFamilyDialog->retirementAge())
+                .then(this, [this, addFamilyDialog](bool added) {
+                    if (added)
+                        return addFamilyDialog->deleteLater();
+                    QMessageBox::critical(this, tr("Error"), tr("Failed to add a new family member, try again or check your input"));
+                    addFamilyDialog->open();
+                });
+    });
+    addFamilyDialog->open();
 }
 
 void FamilyTab::onRemoveFamily()
@@ -87,6 +94,9 @@ void FamilyTab::onRemoveFamily()
         == QMessageBox::No)
         return;
     Q_ASSERT(m_object);
-    if (!m_object->removeFamilyMembers(idsToRemove))
-        QMessageBox::critical(this, tr("Error"), tr("Failed to remove family member(s), try again later", "", idsToRemove.size()));
+    const int removedCount = idsToRemove.size();
+    m_object->removeFamilyMembers(idsToRemove).then(this, [this, removedCount](bool removed) {
+        if (!removed)
+            QMessageBox::critical(this, tr("Error"), tr("Failed to remove family member(s), try again later", "", removedCount));
+    });
 }
@@ -11,9 +11,31 @@
    limitations under the License.
 \****************************************************************************/
 #include "globals.h"
+#include <QCoreApplication>
 #include <QStandardPaths>
+#include <QThread>
 #include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QtEndian>
+#include <cstring>
+#include <cstdio>
+#include <QSqlQuery>
+#include <QSqlDriver>
+#ifdef Q_OS_WIN
+#    include <io.h>
+#    include <qt_windows.h>
+#else
+#    include <unistd.h>
+#endif
+#if defined(BUDGET_SQLITE_DESERIALIZE) || defined(BUDGET_SQLITE_INTERRUPT)
+#    include <sqlite3.h>
+#endif
+#ifdef QT_DEBUG
+#    include <QSqlError>
+#endif
 #define DATABASE_NAME QStringLiteral("BudgetDB")
+#define MEMORY_DB_PATH QStringLiteral(":memory:")
 QString makeStandardLocation(QStandardPaths::StandardLocation loc)
 {
     const QString stdLocation = QStandardPaths::writableLocation(loc);
@@ -32,15 +54,129 @@ QString appSettingsPath()
     return makeStandardLocation(QStandardPaths::AppConfigLocation);
 }
 
-QString dbFilePath()
+bool isGuiThread()
+{
+    const QCoreApplication *application = QCoreApplication::instance();
+    return application && QThread::currentThread() == application->thread();
+}
+
+QString workingDbFilePath()
 {
     return appDataPath() + QDir::separator() + QLatin1String("currentbudget.sqlite");
 }
 
+QString autosaveDbFilePath()
+{
+    return appDataPath() + QDir::separator() + QLatin1String("autosave.sqlite");
+}
+
+QString &currentDbFilePath()
+{
+    static QString currentPath;
+    return currentPath;
+}
+
+QString dbFilePath()
+{
+    const QString &currentPath = currentDbFilePath();
+    if (currentPath.isEmpty())
+        return workingDbFilePath();
+    return currentPath;
+}
+
+void setDbFilePath(const QString &path)
+{
+    closeDb();
+    currentDbFilePath() = path;
+}
+
+int budgetFileVersion(const QString &path)
+{
+    QFile source(path);
+    if (!source.open(QFile::ReadOnly))
+        return -1;
+    // only the fixed size SQLite header is read, the size of the budget does not matter
+    const QByteArray header = source.read(100);
+    if (header.startsWith(LEGACY_BUDGET_FILE_VERSION))
+        return 1;
+    return budgetImageVersion(header);
+}
+
+int budgetImageVersion(const QByteArray &header)
+{
+    if (header.size() < 100 || !header.startsWith(QByteArrayView("SQLite format 3\0", 16)))
+        return -1;
+    if (qFromBigEndian<quint32>(header.constData() + 68) != BUDGET_APPLICATION_ID)
+        return -1;
+    return qFromBigEndian<qint32>(header.constData() + 60);
+}
+
+bool isMemoryDb()
+{
+    return currentDbFilePath() == MEMORY_DB_PATH;
+}
+
+#if defined(BUDGET_SQLITE_DESERIALIZE) || defined(BUDGET_SQLITE_INTERRUPT)
+sqlite3 *sqliteHandle(const QSqlDatabase &db)
+{
+    const QVariant handle = db.driver()->handle();
+    if (!handle.isValid() || qstrcmp(handle.typeName(), "sqlite3*") != 0)
+        return nullptr;
+    return *static_cast<sqlite3 *const *>(handle.constData());
+}
+#endif
+
+#ifdef BUDGET_SQLITE_DESERIALIZE
+bool deserializeTemplate(const QSqlDatabase &db)
+{
+    sqlite3 *handle = sqliteHandle(db);
+    if (!handle)
+        return false;
+    QFile templateFile(QStringLiteral(":/db/defaultdb.sqlite"));
+    if (!templateFile.open(QFile::ReadOnly))
+        return false;
+    const QByteArray image = templateFile.readAll();
+    // SQLite takes ownership of the buffer and grows it as the budget is edited
+    unsigned char *buffer = static_cast<unsigned char *>(sqlite3_malloc64(image.size()));
+    if (!buffer)
+        return false;
+    std::memcpy(buffer, image.constData(), image.size());
+    return sqlite3_deserialize(handle, "main", buffer, image.size(), image.size(),
+                               SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE)
+            == SQLITE_OK;
+}
+#endif
+
+QByteArray serializeDb()
+{
+    ASSERT_NOT_GUI_THREAD();
+#ifdef BUDGET_SQLITE_DESERIALIZE
+    if (!isMemoryDb())
+        return QByteArray();
+    QSqlDatabase db = QSqlDatabase::database(DATABASE_NAME, false);
+    if (!db.isOpen())
+        return QByteArray();
+    sqlite3 *handle = sqliteHandle(db);
+    if (!handle)
+        return QByteArray();
+    sqlite3_int64 imageSize = 0;
+    unsigned char *image = sqlite3_serialize(handle, "main", &imageSize, 0);
+    if (!image)
+        return QByteArray();
+    const QByteArray result(reinterpret_cast<const char *>(image), imageSize);
+    sqlite3_free(image);
+    return result;
+#else
+    return QByteArray();
+#endif
+}
+
 QSqlDatabase openDb()
 {
+    ASSERT_NOT_GUI_THREAD();
     const QString destinationDB = dbFilePath();
-    if (!QFile::exists(destinationDB))
+    const bool inMemory = isMemoryDb();
+    if (!inMemory && !QFile::exists(destinationDB))
         return QSqlDatabase();
     QSqlDatabase db = QSqlDatabase::database(DATABASE_NAME, false);
     if (!db.isValid()) {
@@ -49,32 +185,280 @@ QSqlDatabase openDb()
     }
     Q_ASSERT(db.isValid());
     bool DbOpen = db.isOpen();
-    if (!DbOpen)
+    if (!DbOpen) {
         DbOpen = db.open();
+#ifdef BUDGET_SQLITE_DESERIALIZE
+        if (DbOpen && inMemory && !deserializeTemplate(db)) {
+            db.close();
+            return QSqlDatabase();
+        }
+#endif
+        if (DbOpen)
+            configureDb(db);
+    }
     Q_ASSERT(DbOpen);
     return db;
 }
 
+void configureDb(const QSqlDatabase &db, bool readOnly)
+{
+    // checkpoints are run by BudgetCheckpointer on its own connection so commits only append to the WAL.
+    // the journal mode is stored in the file so only the private working copy is switched to WAL
+    QStringList writerPragmas;
+    if (db.databaseName() == workingDbFilePath()) {
+        writerPragmas << QStringLiteral("PRAGMA journal_mode=WAL") << QStringLiteral("PRAGMA synchronous=NORMAL")
+                      << QStringLiteral("PRAGMA wal_autocheckpoint=0");
+    }
+    const QStringList readerPragmas{QStringLiteral("PRAGMA cache_size=-16384"), QStringLiteral("PRAGMA mmap_size=268435456"),
+                                    QStringLiteral("PRAGMA temp_store=MEMORY")};
+    QSqlQuery pragmaQuery(db);
+    for (const QString &pragma : readOnly ? readerPragmas : writerPragmas + readerPragmas) {
+        if (!pragmaQuery.exec(pragma)) {
+#ifdef QT_DEBUG
+            qDebug() << pragmaQuery.lastQuery() << pragmaQuery.lastError().text();
+#endif
+        }
+    }
+}
+
+void removeDbFile(const QString &path)
+{
+    const QString files[] = {path, path + QLatin1String("-wal"), path + QLatin1String("-shm")};
+    for (const QString &file : files) {
+        if (QFile::exists(file))
+            CHECK_TRUE(QFile::remove(file));
+    }
+}
+
 void discardDbFile()
 {
-    closeDb();
-    const QString dbFileName = dbFilePath();
-    if (QFile::exists(dbFileName))
-        CHECK_TRUE(QFile::remove(dbFileName));
+    setDbFilePath(QString());
+    removeDbFile(workingDbFilePath());
+    removeDbFile(autosaveDbFilePath());
 }
 void closeDb()
 {
-    QSqlDatabase db = QSqlDatabase::database(DATABASE_NAME, false);
-    if (db.isValid()) {
+    {
+        QSqlDatabase db = QSqlDatabase::database(DATABASE_NAME, false);
+        if (db.isOpen()) {
+            // fold the WAL back so the file on disk is self contained once closed
+            QSqlQuery checkpointQuery(db);
+            checkpointQuery.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)"));
+            // any other file goes back to a rollback journal so it leaves no -wal and -shm files behind
+            if (db.databaseName() != workingDbFilePath())
+                checkpointQuery.exec(QStringLiteral("PRAGMA journal_mode=DELETE"));
+        }
+    }
+    closeDb(DATABASE_NAME);
+}
+
+QString threadDbConnectionName()
+{
+    return QLatin1String("BudgetReadDB") + QString::number(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+}
+
+QSqlDatabase openThreadDb(const QString &path)
+{
+    // every thread other than the database one reads through its own connection, WAL lets it run next to the writer
+    ASSERT_NOT_GUI_THREAD();
+    const QString connectionName = threadDbConnectionName();
+    QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+    if (db.isValid() && db.databaseName() != path) {
+        // the budget was switched since this thread last read it
+        db = QSqlDatabase();
+        closeDb(connectionName);
+    }
+    if (path.isEmpty() || !QFile::exists(path))
+        return QSqlDatabase();
+    if (!db.isValid()) {
+        db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        db.setDatabaseName(path);
+        db.setConnectOptions(QStringLiteral("QSQLITE_OPEN_READONLY"));
+    }
+    if (!db.isOpen() && db.open())
+        configureDb(db, true);
+    return db;
+}
+
+void closeThreadDb()
+{
+    closeDb(threadDbConnectionName());
+}
+
+void closeDb(const QString &connectionName)
+{
+    ASSERT_NOT_GUI_THREAD();
+    {
+        QSqlDatabase db = QSqlDatabase::database(connectionName, false);
+        if (!db.isValid())
+            return;
         if (db.isOpen())
             db.close();
-        QSqlDatabase::removeDatabase(DATABASE_NAME);
     }
+    QSqlDatabase::removeDatabase(connectionName);
+}
+
+ReadTransaction::ReadTransaction(const QSqlDatabase &db)
+    : m_db(db)
+    , m_active(false)
+{
+    if (!m_db.isOpen() || !m_db.transaction())
+        return;
+    // a deferred transaction only takes its snapshot on the first read so pin it straight away
+    QSqlQuery snapshotQuery(m_db);
+    m_active = snapshotQuery.exec(QStringLiteral("SELECT COUNT(*) FROM sqlite_master"));
+    if (!m_active)
+        CHECK_TRUE(m_db.rollback());
+}
+
+ReadTransaction::~ReadTransaction()
+{
+    if (m_active)
+        CHECK_TRUE(m_db.commit());
+}
+
+bool ReadTransaction::isActive() const
+{
+    return m_active;
+}
+
+QueryInterrupter::QueryInterrupter()
+    : m_handle(nullptr)
+    , m_interrupted(false)
+{ }
+
+bool QueryInterrupter::attach(const QSqlDatabase &db)
+{
+    const QMutexLocker locker(&m_mutex);
+    if (m_interrupted)
+        return false;
+#ifdef BUDGET_SQLITE_INTERRUPT
+    m_handle = sqliteHandle(db);
+#else
+    Q_UNUSED(db)
+#endif
+    return true;
+}
+
+void QueryInterrupter::detach()
+{
+    // the connection may be closed once detached so it must never be interrupted afterwards
+    const QMutexLocker locker(&m_mutex);
+    m_handle = nullptr;
+}
+
+void QueryInterrupter::interrupt()
+{
+    const QMutexLocker locker(&m_mutex);
+    m_interrupted = true;
+#ifdef BUDGET_SQLITE_INTERRUPT
+    // sqlite3_interrupt is safe to call from any thread, the running statement fails at its next step
+    if (m_handle)
+        sqlite3_interrupt(static_cast<sqlite3 *>(m_handle));
+#endif
+    // otherwise the reading loop notices the flag the next time it polls isInterrupted()
+}
+
+bool QueryInterrupter::isInterrupted() const
+{
+    const QMutexLocker locker(&m_mutex);
+    return m_interrupted;
+}
+
+Savepoint::Savepoint(const QSqlDatabase &db, const QString &name)
+    : m_db(db)
+    , m_name(name)
+    , m_active(false)
+{
+    // unlike QSqlDatabase::transaction() a savepoint also nests inside a transaction that is already open
+    QSqlQuery savepointQuery(m_db);
+    m_active = savepointQuery.exec(QStringLiteral("SAVEPOINT ") + m_name);
+}
+
+Savepoint::~Savepoint()
+{
+    if (!m_active)
+        return;
+    QSqlQuery rollbackQuery(m_db);
+    CHECK_TRUE(rollbackQuery.exec(QStringLiteral("ROLLBACK TO ") + m_name));
+    CHECK_TRUE(rollbackQuery.exec(QStringLiteral("RELEASE ") + m_name));
+}
+
+bool Savepoint::isActive() const
+{
+    return m_active;
+}
+
+bool Savepoint::release()
+{
+    if (!m_active)
+        return false;
+    QSqlQuery releaseQuery(m_db);
+    if (!releaseQuery.exec(QStringLiteral("RELEASE ") + m_name))
+        return false;
+    m_active = false;
+    return true;
+}
+
+bool fillBoundIds(const QSqlDatabase &db, const QVariantList &ids)
+{
+    ASSERT_NOT_GUI_THREAD();
+    // statements join against temp.BoundIds instead of expanding a literal IN list, the table lives in memory with the connection
+    QSqlQuery boundIdsQuery(db);
+    if (!boundIdsQuery.exec(QStringLiteral("CREATE TEMP TABLE IF NOT EXISTS BoundIds (Id INTEGER PRIMARY KEY)"))
+        || !boundIdsQuery.exec(QStringLiteral("DELETE FROM temp.BoundIds"))) {
+#ifdef QT_DEBUG
+        qDebug() << boundIdsQuery.lastQuery() << boundIdsQuery.lastError().text();
+#endif
+        return false;
+    }
+    if (ids.isEmpty())
+        return true;
+    boundIdsQuery.prepare(QStringLiteral("INSERT OR IGNORE INTO temp.BoundIds (Id) VALUES (?)"));
+    boundIdsQuery.addBindValue(ids);
+    if (!boundIdsQuery.execBatch()) {
+#ifdef QT_DEBUG
+        qDebug() << boundIdsQuery.lastQuery() << boundIdsQuery.lastError().text();
+#endif
+        return false;
+    }
+    return true;
 }
 
 void createDbFile()
 {
+#ifdef BUDGET_SQLITE_DESERIALIZE
+    // nothing touches the disk until the budget is saved
+    setDbFilePath(MEMORY_DB_PATH);
+    if (openDb().isOpen())
+        return;
+    setDbFilePath(QString());
+#endif
     const QString destinationDB = dbFilePath();
     CHECK_TRUE(QFile::copy(QStringLiteral(":/db/defaultdb.sqlite"), destinationDB));
     CHECK_TRUE(QFile::setPermissions(destinationDB, QFileDevice::ReadOwner | QFileDevice::WriteOwner));
 }
+
+bool syncFile(QFile &file)
+{
+    // flush only hands the bytes to the OS, a power cut could still lose them or reorder them with later writes
+    if (!file.flush())
+        return false;
+#ifdef Q_OS_WIN
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file.handle())));
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+bool replaceFile(const QString &source, const QString &destination)
+{
+    // QFile::rename refuses an existing destination, removing it first would leave a moment with neither file
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(source).utf16()),
+                       reinterpret_cast<LPCWSTR>(QDir::toNativeSeparators(destination).utf16()),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return std::rename(QFile::encodeName(source).constData(), QFile::encodeName(destination).constData()) == 0;
+#endif
+}
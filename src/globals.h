@@ -13,10 +13,14 @@
 
 #ifndef GLOBALS_H
 #define GLOBALS_H
-#define BUDGET_FILE_VERSION QByteArrayLiteral("1.0.0")
+#define LEGACY_BUDGET_FILE_VERSION QByteArrayLiteral("1.0.0")
+#define BUDGET_FILE_VERSION 2
+#define BUDGET_APPLICATION_ID 0x42756467
 #include <QObject>
 #include <QString>
 #include <QSqlDatabase>
+#include <QMutex>
+class QFile;
 inline bool check_true_helper(bool cond) noexcept
 {
     return cond;
@@ -25,9 +29,72 @@ inline bool check_true_helper(bool cond) noexcept
     [](bool valueOfExpression) {                                                                                                                     \
         Q_ASSERT_X(valueOfExpression, "CHECK_TRUE()", "Assumption in CHECK_TRUE(\"" #Expr "\") was not correct");                                    \
     }(check_true_helper(Expr))
+#define ASSERT_NOT_GUI_THREAD() Q_ASSERT_X(!isGuiThread(), Q_FUNC_INFO, "SQL must not run on the GUI thread")
+bool isGuiThread();
 void discardDbFile();
 void createDbFile();
 QSqlDatabase openDb();
+void configureDb(const QSqlDatabase &db, bool readOnly = false);
+void removeDbFile(const QString &path);
 void closeDb();
+QSqlDatabase openThreadDb(const QString &path);
+void closeThreadDb();
+bool fillBoundIds(const QSqlDatabase &db, const QVariantList &ids);
+void closeDb(const QString &connectionName);
 QString dbFilePath();
+QString workingDbFilePath();
+QString autosaveDbFilePath();
+void setDbFilePath(const QString &path);
+bool isMemoryDb();
+QByteArray serializeDb();
+int budgetFileVersion(const QString &path);
+int budgetImageVersion(const QByteArray &header);
+bool syncFile(QFile &file);
+bool replaceFile(const QString &source, const QString &destination);
+QString appDataPath();
+QString appSettingsPath();
+
+class ReadTransaction
+{
+    Q_DISABLE_COPY_MOVE(ReadTransaction)
+public:
+    explicit ReadTransaction(const QSqlDatabase &db);
+    ~ReadTransaction();
+    bool isActive() const;
+
+private:
+    QSqlDatabase m_db;
+    bool m_active;
+};
+
+class QueryInterrupter
+{
+    Q_DISABLE_COPY_MOVE(QueryInterrupter)
+public:
+    QueryInterrupter();
+    bool attach(const QSqlDatabase &db);
+    void detach();
+    void interrupt();
+    bool isInterrupted() const;
+
+private:
+    mutable QMutex m_mutex;
+    void *m_handle;
+    bool m_interrupted;
+};
+
+class Savepoint
+{
+    Q_DISABLE_COPY_MOVE(Savepoint)
+public:
+    Savepoint(const QSqlDatabase &db, const QString &name);
+    ~Savepoint();
+    bool isActive() const;
+    bool release();
+
+private:
+    QSqlDatabase m_db;
+    QString m_name;
+    bool m_active;
+};
 #endif
@@ -12,7 +12,6 @@
 \****************************************************************************/
 #include <QApplication>
 #include <mainwindow.h>
-#include <globals.h>
 int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
@@ -21,6 +20,5 @@ int main(int argc, char *argv[])
     app.setStyle(QStringLiteral("fusion"));
     MainWindow w;
     w.show();
-    QObject::connect(&app, &QApplication::lastWindowClosed, []() { discardDbFile(); });
     return app.exec();
 }
@@ -0,0 +1,172 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "importmappingdialog.h"
+#include "ui_importmappingdialog.h"
+#include <statementimporter.h>
+#include <QFile>
+#include <QFileDialog>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QStandardPaths>
+
+ImportMappingDialog::ImportMappingDialog(QWidget *parent)
+    : QDialog(parent)
+    , m_registry(nullptr)
+    , ui(new Ui::ImportMappingDialog)
+{
+    ui->setupUi(this);
+    setMapping(CsvColumnMapping());
+    connect(ui->mappingCombo, &QComboBox::currentIndexChanged, this, &ImportMappingDialog::onMappingSelected);
+    connect(ui->removeMappingButton, &QPushButton::clicked, this, &ImportMappingDialog::onRemoveMapping);
+    connect(ui->loadSampleButton, &QPushButton::clicked, this, &ImportMappingDialog::onLoadSample);
+    connect(ui->nameEdit, &QLineEdit::textChanged, this, &ImportMappingDialog::checkOkEnabled);
+    connect(ui->separatorEdit, &QLineEdit::textChanged, this, &ImportMappingDialog::checkOkEnabled);
+    connect(ui->headersEdit, &QLineEdit::textChanged, this, &ImportMappingDialog::checkOkEnabled);
+    connect(ui->dateFormatEdit, &QLineEdit::textChanged, this, &ImportMappingDialog::checkOkEnabled);
+    connect(ui->currencyEdit, &QLineEdit::textChanged, this, &ImportMappingDialog::checkOkEnabled);
+    connect(ui->hasHeaderCheck, &QCheckBox::toggled, this, &ImportMappingDialog::checkOkEnabled);
+    for (QSpinBox *columnSpin :
+         {ui->dateColumnSpin, ui->amountColumnSpin, ui->payTypeColumnSpin, ui->descriptionColumnSpin, ui->currencyColumnSpin})
+        connect(columnSpin, &QSpinBox::valueChanged, this, &ImportMappingDialog::checkOkEnabled);
+    checkOkEnabled();
+}
+
+ImportMappingDialog::~ImportMappingDialog()
+{
+    delete ui;
+}
+
+void ImportMappingDialog::setRegistry(StatementImporterRegistry *registry)
+{
+    m_registry = registry;
+    fillMappingCombo();
+}
+
+CsvColumnMapping ImportMappingDialog::mapping() const
+{
+    CsvColumnMapping result;
+    result.name = ui->nameEdit->text().trimmed();
+    if (!ui->separatorEdit->text().isEmpty())
+        result.separator = ui->separatorEdit->text().at(0);
+    if (!ui->decimalSeparatorEdit->text().isEmpty())
+        result.decimalSeparator = ui->decimalSeparatorEdit->text().at(0);
+    result.hasHeaderRow = ui->hasHeaderCheck->isChecked();
+    if (!result.separator.isNull()) {
+        const QStringList headers = ui->headersEdit->text().split(result.separator, Qt::KeepEmptyParts);
+        for (const QString &header : headers)
+            result.headers.append(header.trimmed());
+        if (result.headers.size() == 1 && result.headers.first().isEmpty())
+            result.headers.clear();
+    }
+    result.dateFormat = ui->dateFormatEdit->text().trimmed();
+    result.currency = ui->currencyEdit->text().trimmed();
+    result.dateColumn = ui->dateColumnSpin->value() - 1;
+    result.amountColumn = ui->amountColumnSpin->value() - 1;
+    result.payTypeColumn = ui->payTypeColumnSpin->value() - 1;
+    result.descriptionColumn = ui->descriptionColumnSpin->value() - 1;
+    result.currencyColumn = ui->currencyColumnSpin->value() - 1;
+    result.mergeExtraFields = ui->mergeExtraCheck->isChecked();
+    return result;
+}
+
+void ImportMappingDialog::accept()
+{
+    Q_ASSERT(m_registry);
+    if (!m_registry->saveCsvMapping(mapping())) {
+        QMessageBox::critical(this, tr("Error"), tr("Unable to save the column mapping. Built-in formats can not be overwritten"));
+        return;
+    }
+    QDialog::accept();
+}
+
+void ImportMappingDialog::fillMappingCombo()
+{
+    const QSignalBlocker comboBlocker(ui->mappingCombo);
+    ui->mappingCombo->clear();
+    ui->mappingCombo->addItem(tr("New Mapping"));
+    if (m_registry) {
+        const QList<CsvColumnMapping> mappings = m_registry->csvMappings();
+        for (const CsvColumnMapping &userMapping : mappings)
+            ui->mappingCombo->addItem(userMapping.name);
+    }
+    ui->mappingCombo->setCurrentIndex(0);
+    onMappingSelected(0);
+}
+
+void ImportMappingDialog::onMappingSelected(int index)
+{
+    ui->removeMappingButton->setEnabled(index > 0);
+    if (index <= 0 || !m_registry) {
+        setMapping(CsvColumnMapping());
+        return;
+    }
+    const QList<CsvColumnMapping> mappings = m_registry->csvMappings();
+    for (const CsvColumnMapping &userMapping : mappings) {
+        if (userMapping.name == ui->mappingCombo->itemText(index)) {
+            setMapping(userMapping);
+            return;
+        }
+    }
+}
+
+void ImportMappingDialog::onRemoveMapping()
+{
+    Q_ASSERT(m_registry);
+    const QString mappingName = ui->mappingCombo->currentText();
+    if (QMessageBox::question(this, tr("Remove Column Mapping"), tr("Do you want to remove the %1 column mapping?").arg(mappingName))
+        != QMessageBox::Yes)
+        return;
+    m_registry->removeCsvMapping(mappingName);
+    fillMappingCombo();
+}
+
+void ImportMappingDialog::onLoadSample()
+{
+    Q_ASSERT(!QStandardPaths::standardLocations(QStandardPaths::DownloadLocation).isEmpty());
+    const QString path = QFileDialog::getOpenFileName(this, tr("Open Sample Statement"),
+                                                      QStandardPaths::standardLocations(QStandardPaths::DownloadLocation).first(),
+                                                      tr("Statement Files (*.csv)"));
+    if (path.isEmpty())
+        return;
+    QFile source(path);
+    if (!source.open(QFile::ReadOnly | QFile::Text))
+        return;
+    QString firstLine = QString::fromUtf8(source.readLine()).trimmed();
+    if (firstLine.startsWith(QChar(0xFEFF)))
+        firstLine.remove(0, 1);
+    firstLine.remove(QLatin1Char('"'));
+    ui->headersEdit->setText(firstLine);
+    ui->hasHeaderCheck->setChecked(true);
+}
+
+void ImportMappingDialog::setMapping(const CsvColumnMapping &mapping)
+{
+    ui->nameEdit->setText(mapping.name);
+    ui->separatorEdit->setText(mapping.separator);
+    ui->decimalSeparatorEdit->setText(mapping.decimalSeparator);
+    ui->hasHeaderCheck->setChecked(mapping.hasHeaderRow);
+    ui->headersEdit->setText(mapping.headers.join(mapping.separator));
+    ui->dateFormatEdit->setText(mapping.dateFormat);
+    ui->currencyEdit->setText(mapping.currency);
+    ui->dateColumnSpin->setValue(mapping.dateColumn + 1);
+    ui->amountColumnSpin->setValue(mapping.amountColumn + 1);
+    ui->payTypeColumnSpin->setValue(mapping.payTypeColumn + 1);
+    ui->descriptionColumnSpin->setValue(mapping.descriptionColumn + 1);
+    ui->currencyColumnSpin->setValue(mapping.currencyColumn + 1);
+    ui->mergeExtraCheck->setChecked(mapping.mergeExtraFields);
+}
+
+void ImportMappingDialog::checkOkEnabled()
+{
+    ui->buttonBox->button(QDialogButtonBox::Ok)->setEnabled(mapping().isValid());
+}
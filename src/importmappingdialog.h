@@ -0,0 +1,44 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef IMPORTMAPPINGDIALOG_H
+#define IMPORTMAPPINGDIALOG_H
+
+#include <QDialog>
+struct CsvColumnMapping;
+class StatementImporterRegistry;
+namespace Ui {
+class ImportMappingDialog;
+}
+class ImportMappingDialog : public QDialog
+{
+    Q_OBJECT
+
+public:
+    explicit ImportMappingDialog(QWidget *parent = nullptr);
+    ~ImportMappingDialog();
+    void setRegistry(StatementImporterRegistry *registry);
+    CsvColumnMapping mapping() const;
+    void accept() override;
+
+private:
+    void fillMappingCombo();
+    void onMappingSelected(int index);
+    void onRemoveMapping();
+    void onLoadSample();
+    void setMapping(const CsvColumnMapping &mapping);
+    void checkOkEnabled();
+    StatementImporterRegistry *m_registry;
+    Ui::ImportMappingDialog *ui;
+};
+
+#endif // IMPORTMAPPINGDIALOG_H
@@ -11,21 +11,136 @@
    limitations under the License.
 \****************************************************************************/
 #include "mainobject.h"
+#include "budgetcheckpointer.h"
+#include "changejournal.h"
+#include "compressedbudget.h"
+#include "databaseactor.h"
 #include "globals.h"
 #include "offlinesqlitetable.h"
+#include "statementimporter.h"
 #include <QStandardItemModel>
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QSaveFile>
+#include <QSettings>
+#include <QThread>
 #include <QFile>
+#include <QFileInfo>
+#include <QHash>
 #include <QMap>
 #include <QQueue>
 #include <QRegularExpression>
+#include <QDir>
+#include <QtConcurrent>
+#define SAVE_BLOCK_SIZE (1 << 20)
+#define JOURNAL_COMPACT_INTERVAL 16
+#define TRANSACTIONS_FETCH_CHUNK 2000
 #ifdef QT_DEBUG
 #    include <QSortFilterProxyModel>
 #    include <QSqlError>
 #endif
 
+namespace {
+bool saveBudgetSnapshot(const QString &sourcePath, const QString &path, bool compressed, const QByteArray &image)
+{
+    const QString connectionName = QStringLiteral("BudgetSaveDB");
+    // a plain budget is written once, next to the destination so it can be renamed over it. Only the compressed one is streamed again
+    const QString snapshotPath = compressed ? appDataPath() + QDir::separator() + QLatin1String("savesnapshot.sqlite")
+                                            : path + QLatin1String(".saving");
+    if (QFile::exists(snapshotPath) && !QFile::remove(snapshotPath))
+        return false;
+    bool snapshotCreated = false;
+    if (!image.isEmpty()) {
+        // budgets living in memory are serialized by the caller, no other connection can see them
+        QFile snapshotFile(snapshotPath);
+        snapshotCreated = snapshotFile.open(QFile::WriteOnly) && snapshotFile.write(image) == image.size();
+    } else {
+        // VACUUM INTO reads a consistent snapshot and drops the free pages
+        QSqlDatabase db = openThreadDb(sourcePath);
+        if (db.isOpen()) {
+            QSqlQuery vacuumQuery(db);
+            vacuumQuery.prepare(QStringLiteral("VACUUM INTO ?"));
+            vacuumQuery.addBindValue(snapshotPath);
+            snapshotCreated = vacuumQuery.exec();
+#ifdef QT_DEBUG
+            if (!snapshotCreated)
+                qDebug() << vacuumQuery.executedQuery() << vacuumQuery.lastError().text();
+#endif
+        }
+    }
+    closeThreadDb();
+    if (!snapshotCreated) {
+        if (QFile::exists(snapshotPath))
+            CHECK_TRUE(QFile::remove(snapshotPath));
+        return false;
+    }
+    {
+        QSqlDatabase snapshotDb = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        snapshotDb.setDatabaseName(snapshotPath);
+        if (snapshotDb.open()) {
+            QSqlQuery stampQuery(snapshotDb);
+            // VACUUM INTO keeps the WAL flag of the source, saved files go back to a plain rollback journal
+            snapshotCreated = stampQuery.exec(QStringLiteral("PRAGMA journal_mode=DELETE"))
+                    && stampQuery.exec(QStringLiteral("PRAGMA application_id=") + QString::number(BUDGET_APPLICATION_ID))
+                    && stampQuery.exec(QStringLiteral("PRAGMA user_version=") + QString::number(BUDGET_FILE_VERSION));
+#ifdef QT_DEBUG
+            if (!snapshotCreated)
+                qDebug() << stampQuery.executedQuery() << stampQuery.lastError().text();
+#endif
+        } else {
+            snapshotCreated = false;
+        }
+    }
+    closeDb(connectionName);
+    if (!snapshotCreated) {
+        CHECK_TRUE(QFile::remove(snapshotPath));
+        return false;
+    }
+    // committing the stamp synced the snapshot, the rename swaps it in whole
+    if (!compressed) {
+        if (replaceFile(snapshotPath, path))
+            return true;
+        CHECK_TRUE(QFile::remove(snapshotPath));
+        return false;
+    }
+    bool result = false;
+    {
+        QSaveFile destination(path);
+        if (destination.open(QSaveFile::WriteOnly))
+            result = writeCompressedBudget(snapshotPath, &destination) && destination.commit();
+    }
+    CHECK_TRUE(QFile::remove(snapshotPath));
+    return result;
+}
+
+QString sessionSettingsPath()
+{
+    return appSettingsPath() + QDir::separator() + QLatin1String("session.ini");
+}
+
+bool passesQuickCheck(const QString &path, const QString &connectionName)
+{
+    bool result = false;
+    {
+        // opening read-write lets SQLite replay a WAL left behind by a crashed session
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+        db.setDatabaseName(path);
+        if (db.open()) {
+            QSqlQuery checkQuery(db);
+            result = checkQuery.exec(QStringLiteral("PRAGMA quick_check")) && checkQuery.next()
+                    && checkQuery.value(0).toString() == QLatin1String("ok");
+        }
+    }
+    closeDb(connectionName);
+    return result;
+}
+
+bool isRecoverableDbFile(const QString &path)
+{
+    return budgetFileVersion(path) == BUDGET_FILE_VERSION && passesQuickCheck(path, QStringLiteral("BudgetRecoveryDB"));
+}
+}
+
 class TransactionModel : public OfflineSqliteTable
 {
     Q_DISABLE_COPY_MOVE(TransactionModel)
@@ -42,6 +157,7 @@ private:
 
 MainObject::MainObject(QObject *parent)
     : QObject(parent)
+    , m_databaseActor(new DatabaseActor)
     , m_transactionsModel(new TransactionModel(this))
     , m_accountsModel(new OfflineSqliteTable(this))
     , m_openAccountFilter(new QSortFilterProxyModel(this))
@@ -51,9 +167,20 @@ MainObject::MainObject(QObject *parent)
     , m_movementTypesModel(new OfflineSqliteTable(this))
     , m_accountTypesModel(new OfflineSqliteTable(this))
     , m_familyModel(new OfflineSqliteTable(this))
+    , m_exchangeRatesModel(new OfflineSqliteTable(this))
+    , m_importers(new StatementImporterRegistry)
+    , m_checkpointThread(new QThread(this))
+    , m_checkpointer(new BudgetCheckpointer)
+    , m_loadWatcher(new QFutureWatcher<PreparedBudget>(this))
+    , m_loadGeneration(0)
+    , m_budgetGeneration(0)
     , m_dirty(false)
+    , m_editGeneration(0)
+    , m_journalCount(0)
     , m_baseCurrency(1)
 {
+    m_transactionsModel->setFetchChunkSize(TRANSACTIONS_FETCH_CHUNK);
+    m_transactionsModel->setWriteBehind(true);
     m_transactionsModel->setTable(QStringLiteral("Transactions"));
     m_transactionsModel->sort(tcOpDate, Qt::DescendingOrder);
     m_accountsModel->setTable(QStringLiteral("Accounts"));
@@ -70,14 +197,36 @@ MainObject::MainObject(QObject *parent)
     m_accountTypesModel->setTable(QStringLiteral("AccountTypes"));
     m_familyModel->setTable(QStringLiteral("Family"));
     m_familyModel->sort(fcBirthday);
+    m_exchangeRatesModel->setTable(QStringLiteral("ExchangeRates"));
     connect(m_transactionsModel, &QAbstractItemModel::dataChanged, this, &MainObject::onTransactionCategoryChanged);
     connect(m_transactionsModel, &QAbstractItemModel::dataChanged, this, &MainObject::onTransactionCurrencyChanged);
     for (OfflineSqliteTable *model : {static_cast<OfflineSqliteTable *>(m_transactionsModel), m_accountsModel, m_categoriesModel,
-                                      m_subcategoriesModel, m_currenciesModel, m_accountTypesModel, m_familyModel, m_movementTypesModel})
+                                      m_subcategoriesModel, m_currenciesModel, m_accountTypesModel, m_familyModel, m_movementTypesModel,
+                                      m_exchangeRatesModel}) {
         connect(model, &QAbstractItemModel::dataChanged, this, std::bind(&MainObject::setDirty, this, true));
+        connect(model, &OfflineSqliteTable::editsRejected, this, &MainObject::editsRejected);
+    }
+    m_checkpointer->moveToThread(m_checkpointThread);
+    connect(m_checkpointThread, &QThread::finished, m_checkpointer, &QObject::deleteLater);
+    connect(m_checkpointer, &BudgetCheckpointer::autosaveRequested, this, &MainObject::onAutosaveRequested);
+    connect(m_loadWatcher, &QFutureWatcherBase::progressValueChanged, this, &MainObject::loadProgress);
+    connect(m_transactionsModel, &OfflineSqliteTable::fetchProgress, this, &MainObject::transactionsFetchProgress);
+    m_checkpointThread->start(QThread::LowPriority);
 }
 
-MainObject::~MainObject() { }
+MainObject::~MainObject()
+{
+    cancelLoad();
+    waitForSave();
+    releaseDbFile();
+    m_checkpointThread->quit();
+    m_checkpointThread->wait();
+    // a clean exit leaves nothing to recover
+    DatabaseActor::runBlocking(&discardDbFile);
+    setRecoveryPending(false);
+    delete m_importers;
+    delete m_databaseActor;
+}
 
 QAbstractItemModel *MainObject::transactionsModel() const
 {
@@ -124,20 +273,25 @@ QAbstractItemModel *MainObject::movementTypesModel() const
     return m_movementTypesModel;
 }
 
-bool MainObject::addFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge)
+QFuture<bool> MainObject::addFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge)
 {
     if (name.isEmpty())
-        return false;
+        return QtFuture::makeReadyFuture(false);
+    return applyWhenCommitted(DatabaseActor::run([name, birthday, income, incomeCurr, retirementAge]() -> bool {
+                                  return insertFamilyMember(name, birthday, income, incomeCurr, retirementAge);
+                              }),
+                              {m_familyModel});
+}
+
+bool MainObject::insertFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge)
+{
     QSqlDatabase db = openDb();
     if (!db.isOpen())
         return false;
-    int newID = 0;
-    for (int i = 0, maxI = m_familyModel->rowCount(); i < maxI; ++i)
-        newID = std::max(newID, m_familyModel->index(i, fcId).data().toInt());
     QSqlQuery addFamilyMemberQuery(db);
-    addFamilyMemberQuery.prepare(
-            QStringLiteral("INSERT INTO Family (Id, Name, Birthday, TaxableIncome, IncomeCurrency, RetirementAge) VALUES (?,?,?,?,?,?)"));
-    addFamilyMemberQuery.addBindValue(++newID);
+    // the id is picked by the statement itself, the models may not show members added by inserts still queued
+    addFamilyMemberQuery.prepare(QStringLiteral("INSERT INTO Family (Id, Name, Birthday, TaxableIncome, IncomeCurrency, RetirementAge) "
+                                                "VALUES ((SELECT COALESCE(MAX(Id),0)+1 FROM Family),?,?,?,?,?)"));
     addFamilyMemberQuery.addBindValue(name);
     addFamilyMemberQuery.addBindValue(birthday.toString(Qt::ISODate));
     addFamilyMemberQuery.addBindValue(income);
@@ -149,15 +303,21 @@ bool MainObject::addFamilyMember(const QString &name, const QDate &birthday, dou
 #endif
         return false;
     }
-    m_familyModel->select();
-    setDirty(true);
     return true;
 }
 
-bool MainObject::removeFamilyMembers(const QList<int> &ids)
+QFuture<bool> MainObject::removeFamilyMembers(const QList<int> &ids)
 {
     if (ids.isEmpty())
-        return false;
+        return QtFuture::makeReadyFuture(false);
+    // members cascade to their accounts and transactions, buffered edits must reach the file before those rows go
+    m_transactionsModel->flushEdits();
+    return applyWhenCommitted(DatabaseActor::run([ids]() -> bool { return deleteFamilyMembers(ids); }),
+                              {m_familyModel, m_accountsModel, m_transactionsModel});
+}
+
+bool MainObject::deleteFamilyMembers(const QList<int> &ids)
+{
     QString filterString;
     for (int id : ids)
         filterString += QString::number(id) + QLatin1Char(',');
@@ -211,7 +371,7 @@ bool MainObject::removeFamilyMembers(const QList<int> &ids)
         }
     }
     if (!accountsToRemove.isEmpty()) {
-        if (!removeAccounts(accountsToRemove, false)) {
+        if (!deleteAccounts(accountsToRemove, false)) {
             CHECK_TRUE(db.rollback());
             return false;
         }
@@ -227,28 +387,26 @@ bool MainObject::removeFamilyMembers(const QList<int> &ids)
             return false;
         }
     }
-    if (!db.commit())
-        return false;
-    m_familyModel->select();
-    if (!accountsToAmend.isEmpty())
-        m_accountsModel->select();
-    setDirty(true);
-    return true;
+    return db.commit();
 }
 
-bool MainObject::addAccount(const QString &name, const QString &owner, int curr, int typ)
+QFuture<bool> MainObject::addAccount(const QString &name, const QString &owner, int curr, int typ)
 {
     if (name.isEmpty() || owner.isEmpty())
-        return false;
+        return QtFuture::makeReadyFuture(false);
+    return applyWhenCommitted(DatabaseActor::run([name, owner, curr, typ]() -> bool { return insertAccount(name, owner, curr, typ); }),
+                              {m_accountsModel});
+}
+
+bool MainObject::insertAccount(const QString &name, const QString &owner, int curr, int typ)
+{
     QSqlDatabase db = openDb();
     if (!db.isOpen())
         return false;
-    int newID = 0;
-    for (int i = 0, maxI = m_accountsModel->rowCount(); i < maxI; ++i)
-        newID = std::max(newID, m_accountsModel->index(i, acId).data().toInt());
     QSqlQuery addAccountQuery(db);
-    addAccountQuery.prepare(QStringLiteral("INSERT INTO Accounts (Id, Name, Owner, Currency, AccountType) VALUES (?,?,?,?,?)"));
-    addAccountQuery.addBindValue(++newID);
+    // the id is picked by the statement itself, the models may not show accounts added by inserts still queued
+    addAccountQuery.prepare(QStringLiteral("INSERT INTO Accounts (Id, Name, Owner, Currency, AccountType) "
+                                           "VALUES ((SELECT COALESCE(MAX(Id),0)+1 FROM Accounts),?,?,?,?)"));
     addAccountQuery.addBindValue(name);
     addAccountQuery.addBindValue(owner);
     addAccountQuery.addBindValue(curr);
@@ -259,20 +417,19 @@ bool MainObject::addAccount(const QString &name, const QString &owner, int curr,
 #endif
         return false;
     }
-    m_accountsModel->select();
-    setDirty(true);
     return true;
 }
 
-bool MainObject::removeAccounts(const QList<int> &ids)
+QFuture<bool> MainObject::removeAccounts(const QList<int> &ids)
 {
-    return removeAccounts(ids, true);
+    if (ids.isEmpty())
+        return QtFuture::makeReadyFuture(false);
+    m_transactionsModel->flushEdits();
+    return applyWhenCommitted(DatabaseActor::run([ids]() -> bool { return deleteAccounts(ids, true); }), {m_accountsModel, m_transactionsModel});
 }
 
-bool MainObject::removeAccounts(const QList<int> &ids, bool transaction)
+bool MainObject::deleteAccounts(const QList<int> &ids, bool transaction)
 {
-    if (ids.isEmpty())
-        return false;
     QString filterString;
     for (int id : ids)
         filterString += QString::number(id) + QLatin1Char(',');
@@ -306,16 +463,24 @@ bool MainObject::removeAccounts(const QList<int> &ids, bool transaction)
             return false;
         }
     }
-    if (transaction) {
-        if (!db.commit())
-            return false;
-    }
-    m_accountsModel->select();
-    m_transactionsModel->select();
-    setDirty(true);
+    if (transaction)
+        return db.commit();
     return true;
 }
 
+QFuture<bool> MainObject::applyWhenCommitted(const QFuture<bool> &edit, const QList<OfflineSqliteTable *> &models)
+{
+    // the database thread only touches the file, the models are refreshed back on the thread that owns them
+    return edit.then(this, [this, models](bool committed) -> bool {
+        if (!committed)
+            return false;
+        for (OfflineSqliteTable *model : models)
+            model->select();
+        setDirty(true);
+        return true;
+    });
+}
+
 void MainObject::onTransactionCategoryChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
 {
     if (topLeft.column() > tcCategory || bottomRight.column() < tcCategory)
@@ -340,20 +505,22 @@ void MainObject::onTransactionCategoryChanged(const QModelIndex &topLeft, const
 
 double MainObject::getExchangeRate(int fromCurrencyID, int toCurrencyID, double defaultVal) const
 {
-    QSqlDatabase db = openDb();
-    if (db.isOpen()) {
-        QSqlQuery getExchangeRateQuery(db);
-        getExchangeRateQuery.prepare(
-                QStringLiteral("SELECT Intermediate.ExchangeRate, Intermediate.FromCurrencyID, Currencies.Id as ToCurrencyID FROM (SELECT "
-                               "Currencies.Id as FromCurrencyID, ExchangeRates.ToCurrency, ExchangeRates.ExchangeRate from ExchangeRates LEFT "
-                               "JOIN Currencies ON Currencies.Currency=ExchangeRates.FromCurrency) as Intermediate LEFT JOIN Currencies ON "
-                               "Currencies.Currency=Intermediate.ToCurrency WHERE FromCurrencyID =? AND ToCurrencyID=?"));
-        getExchangeRateQuery.addBindValue(fromCurrencyID);
-        getExchangeRateQuery.addBindValue(toCurrencyID);
-        if (getExchangeRateQuery.exec()) {
-            if (getExchangeRateQuery.next())
-                return getExchangeRateQuery.value(0).toDouble();
-        }
+    // rates are keyed by currency code, both lookup tables are cached so this never waits for the database thread
+    QString fromCurrency;
+    QString toCurrency;
+    for (int i = 0, maxI = m_currenciesModel->rowCount(); i < maxI; ++i) {
+        const int currencyId = m_currenciesModel->index(i, ccId).data().toInt();
+        if (currencyId == fromCurrencyID)
+            fromCurrency = m_currenciesModel->index(i, ccCurrency).data().toString();
+        if (currencyId == toCurrencyID)
+            toCurrency = m_currenciesModel->index(i, ccCurrency).data().toString();
+    }
+    if (fromCurrency.isEmpty() || toCurrency.isEmpty())
+        return defaultVal;
+    for (int i = 0, maxI = m_exchangeRatesModel->rowCount(); i < maxI; ++i) {
+        if (m_exchangeRatesModel->index(i, ercFromCurrency).data().toString() == fromCurrency
+            && m_exchangeRatesModel->index(i, ercToCurrency).data().toString() == toCurrency)
+            return m_exchangeRatesModel->index(i, ercExchangeRate).data().toDouble();
     }
     return defaultVal;
 }
@@ -371,28 +538,43 @@ void MainObject::onTransactionCurrencyChanged(const QModelIndex &topLeft, const
     }
 }
 
-bool MainObject::removeTransactions(const QList<int> &ids)
+QFuture<bool> MainObject::removeTransactions(const QList<int> &ids)
 {
     if (ids.isEmpty())
-        return false;
-    QString filterString;
-    for (int id : ids)
-        filterString += QString::number(id) + QLatin1Char(',');
-    filterString.chop(1);
+        return QtFuture::makeReadyFuture(false);
+    // buffered edits to the surviving rows are written before the delete is queued behind them
+    m_transactionsModel->flushEdits();
+    return DatabaseActor::run([ids]() -> bool { return deleteTransactions(ids); }).then(this, [this, ids](bool removed) -> bool {
+        if (!removed)
+            return false;
+        // drop the deleted rows from the cache instead of reading the whole table again
+        if (!m_transactionsModel->removeCachedRows(tcId, ids))
+            m_transactionsModel->select();
+        setDirty(true);
+        return true;
+    });
+}
+
+bool MainObject::deleteTransactions(const QList<int> &ids)
+{
     QSqlDatabase db = openDb();
     if (!db.isOpen())
         return false;
+    QVariantList boundIds;
+    boundIds.reserve(ids.size());
+    for (int id : ids)
+        boundIds.append(id);
+    Savepoint savepoint(db, QStringLiteral("RemoveTransactions"));
+    if (!savepoint.isActive() || !fillBoundIds(db, boundIds))
+        return false;
     QSqlQuery removeTransactionsQuery(db);
-    removeTransactionsQuery.prepare(QStringLiteral("DELETE FROM Transactions WHERE Id IN (") + filterString + QLatin1Char(')'));
-    if (!removeTransactionsQuery.exec()) {
+    if (!removeTransactionsQuery.exec(QStringLiteral("DELETE FROM Transactions WHERE Id IN (SELECT Id FROM temp.BoundIds)"))) {
 #ifdef QT_DEBUG
-        qDebug() << removeTransactionsQuery.executedQuery() << removeTransactionsQuery.lastError().text();
+        qDebug() << removeTransactionsQuery.lastQuery() << removeTransactionsQuery.lastError().text();
 #endif
         return false;
     }
-    m_transactionsModel->select();
-    setDirty(true);
-    return true;
+    return savepoint.release();
 }
 
 bool MainObject::isDirty() const
@@ -402,69 +584,335 @@ bool MainObject::isDirty() const
 
 void MainObject::newBudget()
 {
-    discardDbFile();
-    createDbFile();
+    cancelLoad();
+    discardBudget();
+    DatabaseActor::runBlocking(&createDbFile);
     reselectModels();
     setDirty(false);
 }
 
-bool MainObject::saveBudget(const QString &path)
+QFuture<bool> MainObject::saveBudget(const QString &path, bool compact)
 {
     if (path.isEmpty())
+        return QtFuture::makeReadyFuture(false);
+    waitForSave();
+    flushEdits();
+    const quint64 budgetGeneration = m_budgetGeneration;
+    const quint64 savedGeneration = m_editGeneration;
+    const bool compressed = QFileInfo(path).suffix().compare(QLatin1String("buddbz"), Qt::CaseInsensitive) == 0;
+    if (compressed && !compact && m_journalCount < JOURNAL_COMPACT_INTERVAL && !m_journalPath.isEmpty()
+        && QFileInfo(path) == QFileInfo(m_journalPath)) {
+        QByteArray journal;
+        const bool collected = DatabaseActor::runBlocking([&journal]() -> bool {
+            QSqlDatabase db = openDb();
+            return collectChangeJournal(db, &journal);
+        });
+        if (collected) {
+            if (journal.isEmpty()) {
+                setDirty(false);
+                return QtFuture::makeReadyFuture(true);
+            }
+            m_saveFuture = QtConcurrent::run(&appendCompressedJournal, path, journal);
+            return m_saveFuture.then(this, [this, budgetGeneration, savedGeneration](bool saved) -> bool {
+                // the budget was replaced before the save finished, its state must not leak into the new one
+                if (budgetGeneration != m_budgetGeneration)
+                    return saved;
+                if (!saved) {
+                    // the collected changes are gone from the log so the next save must be a full one
+                    m_journalPath.clear();
+                    return false;
+                }
+                ++m_journalCount;
+                if (savedGeneration == m_editGeneration)
+                    setDirty(false);
+                return true;
+            });
+        }
+    }
+    // changes made from now on are not guaranteed to be in the snapshot
+    const QByteArray image = DatabaseActor::runBlocking([compressed]() -> QByteArray {
+        if (compressed) {
+            QSqlDatabase db = openDb();
+            CHECK_TRUE(clearChangeJournal(db));
+        }
+        return serializeDb();
+    });
+    const QString sourcePath = image.isEmpty() ? dbFilePath() : QString();
+    m_saveFuture = QtConcurrent::run(&saveBudgetSnapshot, sourcePath, path, compressed, image);
+    return m_saveFuture.then(this, [this, budgetGeneration, savedGeneration, path, compressed](bool saved) -> bool {
+        if (budgetGeneration != m_budgetGeneration)
+            return saved;
+        if (compressed) {
+            m_journalPath = saved ? path : QString();
+            m_journalCount = 0;
+        }
+        // edits made while the snapshot was being written are not part of the file
+        if (saved && savedGeneration == m_editGeneration)
+            setDirty(false);
+        return saved;
+    });
+}
+
+void MainObject::waitForSave()
+{
+    m_saveFuture.waitForFinished();
+}
+
+bool MainObject::hasRecoverableBudget() const
+{
+    const QSettings session(sessionSettingsPath(), QSettings::IniFormat);
+    if (!session.value(QStringLiteral("RecoveryPending"), false).toBool())
         return false;
-    QFile source(dbFilePath());
-    if (!source.open(QFile::ReadOnly))
-        return false;
-    QSaveFile destination(path);
-    if (!destination.open(QSaveFile::WriteOnly))
-        return false;
-    destination.write(BUDGET_FILE_VERSION);
-    while (!source.atEnd())
-        destination.write(source.read(1024));
-    if (!destination.commit())
+    return QFile::exists(workingDbFilePath()) || QFile::exists(autosaveDbFilePath());
+}
+
+bool MainObject::recoverBudget()
+{
+    cancelLoad();
+    waitForSave();
+    ++m_budgetGeneration;
+    releaseDbFile();
+    m_journalPath.clear();
+    // the working copy holds every committed edit, the autosave snapshot is the fallback if it got damaged
+    const bool recovered = DatabaseActor::runBlocking([]() -> bool {
+        setDbFilePath(QString());
+        if (isRecoverableDbFile(workingDbFilePath()))
+            return true;
+        if (!isRecoverableDbFile(autosaveDbFilePath()))
+            return false;
+        removeDbFile(workingDbFilePath());
+        CHECK_TRUE(QFile::rename(autosaveDbFilePath(), workingDbFilePath()));
+        return true;
+    });
+    if (!recovered)
         return false;
-    setDirty(false);
+    reselectModels();
+    m_dirty = false;
+    setDirty(true);
     return true;
 }
 
-bool MainObject::loadBudget(const QString &path)
+void MainObject::discardBudget()
+{
+    waitForSave();
+    ++m_budgetGeneration;
+    releaseDbFile();
+    DatabaseActor::runBlocking(&discardDbFile);
+    m_journalPath.clear();
+}
+
+void MainObject::flushEdits()
+{
+    for (OfflineSqliteTable *model : {static_cast<OfflineSqliteTable *>(m_transactionsModel), m_accountsModel, m_categoriesModel,
+                                      m_subcategoriesModel, m_currenciesModel, m_movementTypesModel, m_accountTypesModel, m_familyModel,
+                                      m_exchangeRatesModel})
+        model->flushEdits();
+}
+
+void MainObject::releaseDbFile()
+{
+    flushEdits();
+    for (OfflineSqliteTable *model : {static_cast<OfflineSqliteTable *>(m_transactionsModel), m_accountsModel, m_categoriesModel,
+                                      m_subcategoriesModel, m_currenciesModel, m_movementTypesModel, m_accountTypesModel, m_familyModel,
+                                      m_exchangeRatesModel})
+        model->cancelPrefetch();
+    QMetaObject::invokeMethod(m_checkpointer, &BudgetCheckpointer::suspend, Qt::BlockingQueuedConnection);
+}
+
+void MainObject::onAutosaveRequested()
+{
+    // the image is taken by the database thread and handed straight to the checkpointer
+    BudgetCheckpointer *checkpointer = m_checkpointer;
+    DatabaseActor::run(&serializeDb).then(m_checkpointer, [checkpointer](const QByteArray &image) {
+        if (!image.isEmpty())
+            checkpointer->writeAutosave(image);
+    });
+}
+
+void MainObject::setRecoveryPending(bool pending)
+{
+    QSettings session(sessionSettingsPath(), QSettings::IniFormat);
+    session.setValue(QStringLiteral("RecoveryPending"), pending);
+    session.sync();
+}
+
+QFuture<bool> MainObject::loadBudget(const QString &path)
 {
     if (path.isEmpty())
-        return false;
-    discardDbFile();
+        return QtFuture::makeReadyFuture(false);
+    cancelLoad();
+    const quint64 generation = m_loadGeneration;
+    m_loadFuture = QtConcurrent::run(&MainObject::prepareBudget, path);
+    m_loadWatcher->setFuture(m_loadFuture);
+    return m_loadFuture.then(this, [this, generation](QFuture<PreparedBudget> future) -> bool {
+        // the current budget stays usable until the new one is ready to be switched in
+        if (generation != m_loadGeneration || future.resultCount() == 0)
+            return false;
+        const PreparedBudget prepared = future.result();
+        discardBudget();
+        CHECK_TRUE(QFile::rename(prepared.path, workingDbFilePath()));
+        m_journalPath = prepared.journalPath;
+        m_journalCount = prepared.journalCount;
+        reselectModels();
+        setDirty(false);
+        return true;
+    });
+}
+
+void MainObject::cancelLoad()
+{
+    ++m_loadGeneration;
+    m_loadFuture.cancel();
+    m_loadFuture.waitForFinished();
+}
+
+void MainObject::prepareBudget(QPromise<PreparedBudget> &promise, const QString &path)
+{
+    const QString stagingPath = appDataPath() + QDir::separator() + QLatin1String("loadstaging.sqlite");
+    removeDbFile(stagingPath);
+    promise.setProgressRange(0, 100);
+    PreparedBudget prepared;
+    prepared.path = stagingPath;
+    prepared.journalCount = 0;
+    CompressedBudgetReader reader;
+    if (CompressedBudgetReader::isCompressedBudget(path)) {
+        if (!reader.open(path) || reader.imageVersion() != BUDGET_FILE_VERSION)
+            return;
+        QSaveFile destination(stagingPath);
+        if (!destination.open(QSaveFile::WriteOnly))
+            return;
+        if (!reader.extract(&destination) || promise.isCanceled()) {
+            destination.cancelWriting();
+            return;
+        }
+        if (!destination.commit())
+            return;
+        prepared.journalPath = path;
+        prepared.journalCount = reader.journalCount();
+    } else {
+        const int fileVersion = budgetFileVersion(path);
+        if (fileVersion != BUDGET_FILE_VERSION && fileVersion != 1)
+            return;
+        // edits always go to a private working copy so the saved file only changes on save and discarding keeps working
+        QFile source(path);
+        if (!source.open(QFile::ReadOnly))
+            return;
+        if (fileVersion == 1)
+            source.seek(LEGACY_BUDGET_FILE_VERSION.size());
+        QSaveFile destination(stagingPath);
+        if (!destination.open(QSaveFile::WriteOnly))
+            return;
+        const qint64 sourceSize = std::max<qint64>(1, source.size());
+        while (!source.atEnd()) {
+            if (promise.isCanceled()) {
+                destination.cancelWriting();
+                return;
+            }
+            destination.write(source.read(SAVE_BLOCK_SIZE));
+            promise.setProgressValue(int((90 * source.pos()) / sourceSize));
+        }
+        if (!destination.commit())
+            return;
+    }
+    promise.setProgressValue(90);
+    bool valid = passesQuickCheck(prepared.path, QStringLiteral("BudgetLoadDB"));
+    if (valid && prepared.journalCount > 0) {
+        const QString connectionName = QStringLiteral("BudgetLoadDB");
+        {
+            QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), connectionName);
+            db.setDatabaseName(prepared.path);
+            valid = db.open() && db.transaction();
+            for (int i = 0; valid && i < prepared.journalCount; ++i)
+                valid = applyChangeJournal(db, reader.readJournal(i));
+            if (valid)
+                valid = db.commit();
+            else if (db.isOpen())
+                db.rollback();
+        }
+        closeDb(connectionName);
+    }
+    if (!valid || promise.isCanceled()) {
+        removeDbFile(stagingPath);
+        return;
+    }
+    CHECK_TRUE(QFile::setPermissions(stagingPath, QFileDevice::ReadOwner | QFileDevice::WriteOwner));
+    promise.setProgressValue(100);
+    promise.addResult(prepared);
+}
+
+bool MainObject::readStatement(const QString &path, const QString &format, QList<ImportedStatement> *statements) const
+{
+    Q_ASSERT(statements);
     QFile source(path);
     if (!source.open(QFile::ReadOnly))
         return false;
-    QSaveFile destination(dbFilePath());
-    if (!destination.open(QSaveFile::WriteOnly))
-        return false;
-    const QByteArray fileVersion = source.read(BUDGET_FILE_VERSION.size());
-    if (BUDGET_FILE_VERSION != fileVersion)
-        return false;
-    while (!source.atEnd())
-        destination.write(source.read(1024));
-    if (!destination.commit())
+    const StatementImporter *importer = format.isEmpty() ? m_importers->detect(&source) : m_importers->importer(format);
+    if (!importer)
         return false;
-    reselectModels();
-    setDirty(false);
-    return true;
+    return importer->import(&source, statements);
 }
 
-bool MainObject::importStatement(int account, const QString &path, ImportFormats format)
+QFuture<bool> MainObject::importStatement(int account, const QString &path, const QString &format)
 {
-    QFile source(path);
-    if (!source.open(QFile::ReadOnly | QFile::Text))
-        return false;
-    switch (format) {
-    case MainObject::ifBarclays:
-        return importBarclaysStatement(account, &source);
-    case MainObject::ifNatwest:
-        break;
-    case MainObject::ifRevolut:
-        break;
+    QList<ImportedStatement> statements;
+    if (!readStatement(path, format, &statements))
+        return QtFuture::makeReadyFuture(false);
+    return importStatements(statements, QList<int>(statements.size(), account));
+}
+
+QFuture<bool> MainObject::importStatements(const QList<ImportedStatement> &statements, const QList<int> &accounts)
+{
+    if (statements.size() != accounts.size())
+        return QtFuture::makeReadyFuture(false);
+    // lookups against the models happen here, the database thread only receives plain ids
+    QList<TransactionBatch> batches;
+    batches.reserve(statements.size());
+    for (qsizetype i = 0, maxI = statements.size(); i < maxI; ++i) {
+        if (accounts.at(i) < 0 || statements.at(i).amounts.isEmpty())
+            continue;
+        TransactionBatch batch;
+        if (!prepareImportedStatement(accounts.at(i), statements.at(i), &batch))
+            return QtFuture::makeReadyFuture(false);
+        batches.append(batch);
     }
-    Q_UNREACHABLE();
-    return false;
+    return DatabaseActor::run([batches]() mutable -> int {
+               QSqlDatabase db = openDb();
+               if (!db.isOpen())
+                   return -1;
+               if (!db.transaction())
+                   return -1;
+               int duplicateSkipped = 0;
+               for (TransactionBatch &batch : batches) {
+                   if (batch.currencies.isEmpty()) {
+                       const int currencyID = accountCurrency(batch.account);
+                       if (currencyID >= 0)
+                           batch.currencies.append(currencyID);
+                   }
+                   int batchSkipped = 0;
+                   if (batch.currencies.isEmpty() || !insertTransactions(batch, true, false, &batchSkipped)) {
+                       CHECK_TRUE(db.rollback());
+                       return -1;
+                   }
+                   duplicateSkipped += batchSkipped;
+               }
+               if (!db.commit())
+                   return -1;
+               return duplicateSkipped;
+           })
+            .then(this, [this](int duplicateSkipped) -> bool {
+                if (duplicateSkipped < 0)
+                    return false;
+                if (duplicateSkipped > 0)
+                    Q_EMIT addTransactionSkippedDuplicates(duplicateSkipped);
+                m_transactionsModel->select();
+                setDirty(true);
+                return true;
+            });
+}
+
+StatementImporterRegistry *MainObject::importers() const
+{
+    return m_importers;
 }
 
 int MainObject::idForCurrency(const QString &curr) const
@@ -485,57 +933,67 @@ int MainObject::idForMovementType(const QString &mov) const
     return -1;
 }
 
-bool MainObject::importBarclaysStatement(int account, QFile *source)
+bool MainObject::prepareImportedStatement(int account, const ImportedStatement &statement, TransactionBatch *batch) const
 {
-    QTextStream stream(source);
-    QString line;
-    bool needCheckFirstLine = true;
-    const int gbpID = idForCurrency(QStringLiteral("GBP"));
-    if (gbpID < 0)
-        return false;
-    QList<QDate> opDates;
-    QList<double> amounts;
-    QList<QString> payTypes;
-    QList<QString> descriptions;
-    QList<int> movTypes;
-    while (stream.readLineInto(&line)) {
-        auto parts = line.split(QLatin1Char(','), Qt::KeepEmptyParts);
-        if (line.trimmed().isEmpty())
-            continue;
-        while (parts.size() > 6)
-            parts[parts.size() - 2] += parts.takeLast();
-        if (parts.size() != 6)
-            return false;
-        if (needCheckFirstLine) {
-            const QString expectedHeaders[6] = {QStringLiteral("Number"), QStringLiteral("Date"),        QStringLiteral("Account"),
-                                                QStringLiteral("Amount"), QStringLiteral("Subcategory"), QStringLiteral("Memo")};
-            for (int i = 0; i < 6; ++i) {
-                if (parts.at(i).trimmed().compare(expectedHeaders[i], Qt::CaseInsensitive) != 0)
-                    return false;
-            }
-            needCheckFirstLine = false;
-        } else {
-            bool amountCheck = false;
-            const double amnt = parts.at(3).trimmed().toDouble(&amountCheck);
-            if (!amountCheck)
+    Q_ASSERT(batch);
+    batch->account = account;
+    if (statement.currencies.isEmpty()) {
+        // without a currency the statement uses the one of the account, resolved by the database thread
+        if (!statement.currency.isEmpty()) {
+            const int currencyID = idForCurrency(statement.currency);
+            if (currencyID < 0)
                 return false;
-            if (qFuzzyIsNull(amnt))
-                continue;
-            amounts.append(amnt);
-            opDates.append(QDate::fromString(parts.at(1).trimmed(), QStringLiteral("dd/MM/yyyy")));
-            payTypes.append(parts.at(4).trimmed());
-            descriptions.append(parts.at(5).trimmed());
-            if (amnt < 0)
-                movTypes.append(idForMovementType(QStringLiteral("Expense")));
-            else
-                movTypes.append(idForMovementType(QStringLiteral("Income")));
+            batch->currencies.append(currencyID);
+        }
+    } else {
+        QHash<QString, int> currencyIDs;
+        batch->currencies.reserve(statement.currencies.size());
+        for (const QString &currency : statement.currencies) {
+            auto currencyIter = currencyIDs.find(currency);
+            if (currencyIter == currencyIDs.end())
+                currencyIter = currencyIDs.insert(currency, idForCurrency(currency));
+            if (currencyIter.value() < 0)
+                return false;
+            batch->currencies.append(currencyIter.value());
         }
     }
-    return addTransactions(account, opDates, {gbpID}, amounts, payTypes, descriptions, QList<int>(), QList<int>(), movTypes, QList<int>(),
-                           QList<double>(), true);
+    const int expenseID = idForMovementType(QStringLiteral("Expense"));
+    const int incomeID = idForMovementType(QStringLiteral("Income"));
+    batch->movementTypes.reserve(statement.amounts.size());
+    for (double amnt : statement.amounts)
+        batch->movementTypes.append(amnt < 0 ? expenseID : incomeID);
+    batch->opDates = statement.opDates;
+    batch->amounts = statement.amounts;
+    batch->payTypes = statement.payTypes;
+    batch->descriptions = statement.descriptions;
+    return true;
+}
+
+int MainObject::accountCurrency(int account)
+{
+    QSqlDatabase db = openDb();
+    if (!db.isOpen())
+        return -1;
+    QSqlQuery accountCurrencyQuery(db);
+    accountCurrencyQuery.prepare(QStringLiteral("SELECT Currency FROM Accounts WHERE Id=?"));
+    accountCurrencyQuery.addBindValue(account);
+    if (!accountCurrencyQuery.exec()) {
+#ifdef QT_DEBUG
+        qDebug() << accountCurrencyQuery.executedQuery() << accountCurrencyQuery.lastError().text();
+#endif
+        return -1;
+    }
+    if (!accountCurrencyQuery.next())
+        return -1;
+    return accountCurrencyQuery.value(0).toInt();
 }
 
-QDate MainObject::lastTransactionDate() const
+QFuture<QDate> MainObject::lastTransactionDate() const
+{
+    return DatabaseActor::run(&MainObject::readLastTransactionDate);
+}
+
+QDate MainObject::readLastTransactionDate()
 {
     QSqlDatabase db = openDb();
     if (!db.isOpen())
@@ -587,21 +1045,12 @@ void MainObject::setTransactionsFilter(const QList<TransactionModelColumn> &col,
             filterString += QStringLiteral(" AND ");
         filterString += m_transactionsModel->fieldName(col.at(i)) + filter.at(i);
     }
-    m_transactionsModel->setFilter(filterString);
+    m_transactionsModel->setFilterInBackground(filterString);
 }
 
 bool MainObject::validSubcategory(int category, int subcategory) const
 {
-    QSqlDatabase db = openDb();
-    if (db.isOpen()) {
-        QSqlQuery subcategoryQuery(db);
-        subcategoryQuery.prepare(QStringLiteral("SELECT Id from Subcategories WHERE Id=? AND Category=?"));
-        subcategoryQuery.addBindValue(subcategory);
-        subcategoryQuery.addBindValue(category);
-        if (subcategoryQuery.exec())
-            return subcategoryQuery.next();
-    }
-    // backup
+    // subcategories are a cached lookup table, answering from it never waits for the database thread
     for (int i = 0, maxI = m_subcategoriesModel->rowCount(); i < maxI; ++i) {
         if (m_subcategoriesModel->index(i, sccCategoryId).data().toInt() == category
             && m_subcategoriesModel->index(i, sccId).data().toInt() == subcategory)
@@ -621,21 +1070,6 @@ constexpr bool MainObject::isInternalTransferCategory(int category)
 int MainObject::forcedSubcategory(int category) const
 {
     int result = -1;
-    QSqlDatabase db = openDb();
-    if (db.isOpen()) {
-        QSqlQuery subcategoryQuery(db);
-        subcategoryQuery.prepare(QStringLiteral("SELECT Id from Subcategories WHERE Category=?"));
-        subcategoryQuery.addBindValue(category);
-        if (subcategoryQuery.exec()) {
-            if (subcategoryQuery.next()) {
-                result = subcategoryQuery.value(0).toInt();
-                if (subcategoryQuery.next())
-                    return -1;
-                return result;
-            }
-        }
-    }
-    // backup
     for (int i = 0, maxI = m_subcategoriesModel->rowCount(); i < maxI; ++i) {
         if (m_subcategoriesModel->index(i, sccCategoryId).data().toInt() == category) {
             if (result >= 0)
@@ -661,35 +1095,56 @@ int MainObject::movementTypeForInternalTransfer(int category, double amount) con
 
 void MainObject::setDirty(bool dirty)
 {
+    if (dirty) {
+        ++m_editGeneration;
+        m_checkpointer->markChanged();
+    }
     if (dirty == m_dirty)
         return;
     m_dirty = dirty;
+    setRecoveryPending(m_dirty);
     dirtyChanged(m_dirty);
 }
 
 void MainObject::reselectModels()
 {
-    for (OfflineSqliteTable *model : {static_cast<OfflineSqliteTable *>(m_transactionsModel), m_accountsModel, m_categoriesModel,
-                                      m_subcategoriesModel, m_currenciesModel, m_movementTypesModel, m_accountTypesModel, m_familyModel})
+    // models read their rows on first access, the small lookup tables are warmed in the background
+    m_transactionsModel->setTable(m_transactionsModel->tableName());
+    for (OfflineSqliteTable *model : {m_accountsModel, m_categoriesModel, m_subcategoriesModel, m_currenciesModel, m_movementTypesModel,
+                                      m_accountTypesModel, m_familyModel, m_exchangeRatesModel}) {
         model->setTable(model->tableName());
+        model->prefetch();
+    }
+    const bool opened = DatabaseActor::runBlocking([]() -> bool {
+        QSqlDatabase db = openDb();
+        if (!db.isOpen())
+            return false;
+        CHECK_TRUE(installChangeTracking(db));
+        return true;
+    });
+    if (!opened)
+        return;
+    const QString path = isMemoryDb() ? QString() : dbFilePath();
+    BudgetCheckpointer *checkpointer = m_checkpointer;
+    QMetaObject::invokeMethod(m_checkpointer, [checkpointer, path]() { checkpointer->start(path); }, Qt::QueuedConnection);
 }
 
-bool MainObject::addTransactions(int account, const QList<QDate> &opDt, const QList<int> &curr, const QList<double> &amount,
-                                 const QList<QString> &payType, const QList<QString> &desc, const QList<int> &categ, const QList<int> &subcateg,
-                                 const QList<int> &movementType, const QList<int> &destination, const QList<double> &exchangeRate,
-                                 bool checkDuplicates)
+bool MainObject::insertTransactions(const TransactionBatch &batch, bool checkDuplicates, bool transaction, int *duplicateSkipped)
 {
-
-    QSqlDatabase db = openDb();
-    if (!db.isOpen())
-        return false;
-    if (!db.transaction())
-        return false;
+    Q_ASSERT(duplicateSkipped);
+    const int account = batch.account;
+    const QList<QDate> &opDt = batch.opDates;
+    const QList<int> &curr = batch.currencies;
+    const QList<double> &amount = batch.amounts;
+    const QList<QString> &payType = batch.payTypes;
+    const QList<QString> &desc = batch.descriptions;
+    const QList<int> &categ = batch.categories;
+    const QList<int> &subcateg = batch.subcategories;
+    const QList<int> &movementType = batch.movementTypes;
+    const QList<int> &destination = batch.destinations;
+    const QList<double> &exchangeRate = batch.exchangeRates;
     if (account < 0 || opDt.isEmpty() || curr.isEmpty() || amount.isEmpty())
         return false;
-    int newID = 0;
-    for (int i = 0, maxI = m_transactionsModel->rowCount(); i < maxI; ++i)
-        newID = std::max(newID, m_transactionsModel->index(i, tcId).data().toInt());
     auto maxI = opDt.size();
     if (maxI > 1 && curr.size() > 1 && curr.size() != maxI)
         return false;
@@ -718,36 +1173,66 @@ bool MainObject::addTransactions(int account, const QList<QDate> &opDt, const QL
     if (maxI > 1 && exchangeRate.size() > 1 && exchangeRate.size() != maxI)
         return false;
     maxI = std::max(maxI, exchangeRate.size());
+    QSqlDatabase db = openDb();
+    if (!db.isOpen())
+        return false;
+    if (transaction) {
+        if (!db.transaction())
+            return false;
+    }
+    const auto rollbackIfOwned = [&db, transaction]() {
+        if (transaction)
+            CHECK_TRUE(db.rollback());
+    };
+    // the model might not contain rows inserted earlier in the same transaction
+    int newID = 0;
+    {
+        QSqlQuery maxIdQuery(db);
+        if (!maxIdQuery.exec(QStringLiteral("SELECT MAX(Id) FROM Transactions"))) {
+#ifdef QT_DEBUG
+            qDebug() << maxIdQuery.executedQuery() << maxIdQuery.lastError().text();
+#endif
+            rollbackIfOwned();
+            return false;
+        }
+        if (maxIdQuery.next())
+            newID = maxIdQuery.value(0).toInt();
+    }
     QQueue<int> iToSkip;
     if (checkDuplicates) {
+        QSqlQuery duplicateQuery(db);
+        duplicateQuery.prepare(QStringLiteral("SELECT Id FROM Transactions WHERE Account=? AND OperationDate=? AND Currency=? AND Amount=? AND "
+                                              "PaymentType=? AND Description=?"));
         for (decltype(maxI) i = 0; i < maxI; ++i) {
-            QSqlQuery duplicateQuery(db);
-            duplicateQuery.prepare(QStringLiteral("SELECT Id FROM Transactions WHERE Account=? AND OperationDate=? AND Currency=? AND Amount=? AND "
-                                                  "PaymentType=? AND Description=?"));
-            duplicateQuery.addBindValue(account);
-            duplicateQuery.addBindValue((opDt.size() > 1 ? opDt.at(i) : opDt.first()).toString(Qt::ISODate));
-            duplicateQuery.addBindValue(curr.size() > 1 ? curr.at(i) : curr.first());
-            duplicateQuery.addBindValue(amount.size() > 1 ? amount.at(i) : amount.first());
+            duplicateQuery.bindValue(0, account);
+            duplicateQuery.bindValue(1, (opDt.size() > 1 ? opDt.at(i) : opDt.first()).toString(Qt::ISODate));
+            duplicateQuery.bindValue(2, curr.size() > 1 ? curr.at(i) : curr.first());
+            duplicateQuery.bindValue(3, amount.size() > 1 ? amount.at(i) : amount.first());
             if (payType.isEmpty())
-                duplicateQuery.addBindValue(QVariant(QMetaType::fromType<QString>()));
+                duplicateQuery.bindValue(4, QVariant(QMetaType::fromType<QString>()));
             else
-                duplicateQuery.addBindValue(payType.size() > 1 ? payType.at(i) : payType.first());
+                duplicateQuery.bindValue(4, payType.size() > 1 ? payType.at(i) : payType.first());
             if (desc.isEmpty())
-                duplicateQuery.addBindValue(QVariant(QMetaType::fromType<QString>()));
+                duplicateQuery.bindValue(5, QVariant(QMetaType::fromType<QString>()));
             else
-                duplicateQuery.addBindValue(desc.size() > 1 ? desc.at(i) : desc.first());
+                duplicateQuery.bindValue(5, desc.size() > 1 ? desc.at(i) : desc.first());
             if (!duplicateQuery.exec()) {
 #ifdef QT_DEBUG
                 qDebug() << duplicateQuery.executedQuery() << duplicateQuery.lastError().text();
 #endif
-                CHECK_TRUE(db.rollback());
+                rollbackIfOwned();
                 return false;
             }
             if (duplicateQuery.next())
                 iToSkip.enqueue(i);
+            duplicateQuery.finish();
         }
     }
-    const int duplicateSkipped = iToSkip.size();
+    *duplicateSkipped = iToSkip.size();
+    QSqlQuery addTransactionQuery(db);
+    addTransactionQuery.prepare(
+            QStringLiteral("INSERT INTO Transactions (Id, Account, OperationDate, Currency, Amount, PaymentType, Description, Category, "
+                           "Subcategory, MovementType, DestinationAccount, ExchangeRate) VALUES (?,?,?,?,?,?,?,?,?,?,?,?)"));
     for (decltype(maxI) i = 0; i < maxI; ++i) {
         if (!iToSkip.isEmpty()) {
             if (iToSkip.head() == i) {
@@ -755,57 +1240,49 @@ bool MainObject::addTransactions(int account, const QList<QDate> &opDt, const QL
                 continue;
             }
         }
-        QSqlQuery addTransactionQuery(db);
-        addTransactionQuery.prepare(
-                QStringLiteral("INSERT INTO Transactions (Id, Account, OperationDate, Currency, Amount, PaymentType, Description, Category, "
-                               "Subcategory, MovementType, DestinationAccount, ExchangeRate) VALUES (?,?,?,?,?,?,?,?,?,?,?,?)"));
-        addTransactionQuery.addBindValue(++newID);
-        addTransactionQuery.addBindValue(account);
-        addTransactionQuery.addBindValue((opDt.size() > 1 ? opDt.at(i) : opDt.first()).toString(Qt::ISODate));
-        addTransactionQuery.addBindValue(curr.size() > 1 ? curr.at(i) : curr.first());
-        addTransactionQuery.addBindValue(amount.size() > 1 ? amount.at(i) : amount.first());
+        addTransactionQuery.bindValue(0, ++newID);
+        addTransactionQuery.bindValue(1, account);
+        addTransactionQuery.bindValue(2, (opDt.size() > 1 ? opDt.at(i) : opDt.first()).toString(Qt::ISODate));
+        addTransactionQuery.bindValue(3, curr.size() > 1 ? curr.at(i) : curr.first());
+        addTransactionQuery.bindValue(4, amount.size() > 1 ? amount.at(i) : amount.first());
         if (payType.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<QString>()));
+            addTransactionQuery.bindValue(5, QVariant(QMetaType::fromType<QString>()));
         else
-            addTransactionQuery.addBindValue(payType.size() > 1 ? payType.at(i) : payType.first());
+            addTransactionQuery.bindValue(5, payType.size() > 1 ? payType.at(i) : payType.first());
         if (desc.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<QString>()));
+            addTransactionQuery.bindValue(6, QVariant(QMetaType::fromType<QString>()));
         else
-            addTransactionQuery.addBindValue(desc.size() > 1 ? desc.at(i) : desc.first());
+            addTransactionQuery.bindValue(6, desc.size() > 1 ? desc.at(i) : desc.first());
         if (categ.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<int>()));
+            addTransactionQuery.bindValue(7, QVariant(QMetaType::fromType<int>()));
         else
-            addTransactionQuery.addBindValue(categ.size() > 1 ? categ.at(i) : categ.first());
+            addTransactionQuery.bindValue(7, categ.size() > 1 ? categ.at(i) : categ.first());
         if (subcateg.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<int>()));
+            addTransactionQuery.bindValue(8, QVariant(QMetaType::fromType<int>()));
         else
-            addTransactionQuery.addBindValue(subcateg.size() > 1 ? subcateg.at(i) : subcateg.first());
+            addTransactionQuery.bindValue(8, subcateg.size() > 1 ? subcateg.at(i) : subcateg.first());
         if (movementType.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<int>()));
+            addTransactionQuery.bindValue(9, QVariant(QMetaType::fromType<int>()));
         else
-            addTransactionQuery.addBindValue(movementType.size() > 1 ? movementType.at(i) : movementType.first());
+            addTransactionQuery.bindValue(9, movementType.size() > 1 ? movementType.at(i) : movementType.first());
         if (destination.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<int>()));
+            addTransactionQuery.bindValue(10, QVariant(QMetaType::fromType<int>()));
         else
-            addTransactionQuery.addBindValue(destination.size() > 1 ? destination.at(i) : destination.first());
+            addTransactionQuery.bindValue(10, destination.size() > 1 ? destination.at(i) : destination.first());
         if (exchangeRate.isEmpty())
-            addTransactionQuery.addBindValue(QVariant(QMetaType::fromType<double>()));
+            addTransactionQuery.bindValue(11, QVariant(QMetaType::fromType<double>()));
         else
-            addTransactionQuery.addBindValue(exchangeRate.size() > 1 ? exchangeRate.at(i) : movementType.first());
+            addTransactionQuery.bindValue(11, exchangeRate.size() > 1 ? exchangeRate.at(i) : exchangeRate.first());
         if (!addTransactionQuery.exec()) {
 #ifdef QT_DEBUG
             qDebug() << addTransactionQuery.executedQuery() << addTransactionQuery.lastError().text();
 #endif
-            CHECK_TRUE(db.rollback());
+            rollbackIfOwned();
             return false;
         }
     }
-    if (!db.commit())
-        return false;
-    m_transactionsModel->select();
-    if (duplicateSkipped > 0)
-        Q_EMIT addTransactionSkippedDuplicates(duplicateSkipped);
-    setDirty(true);
+    if (transaction)
+        return db.commit();
     return true;
 }
 
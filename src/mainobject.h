@@ -15,10 +15,17 @@
 #define MAINOBJECT_H
 #include <QObject>
 #include <QDate>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QPromise>
 class QSortFilterProxyModel;
 class OfflineSqliteTable;
 class QAbstractItemModel;
-class QFile;
+class StatementImporterRegistry;
+class BudgetCheckpointer;
+class DatabaseActor;
+class QThread;
+struct ImportedStatement;
 class TransactionModel;
 class MainObject : public QObject
 {
@@ -42,11 +49,11 @@ public:
     };
     enum CurrencyModelColumn { ccId, ccCurrency };
     enum AccountTypeModelColumn { atcId, atcName };
-    enum ImportFormats { ifBarclays, ifNatwest, ifRevolut };
     enum FamilyModelColumn { fcId, fcName, fcBirthday, fcIncome, fcIncomeCurrency, fcRetirementAge };
     enum MovementTypeModelColumn { mtcId, mtcName };
     enum CategoriesModelColumn { cacId, cacName };
     enum SubcategoriesModelColumn { sccId, sccCategoryId, sccName, sccNeedWant };
+    enum ExchangeRateModelColumn { ercFromCurrency, ercToCurrency, ercExchangeRate };
     explicit MainObject(QObject *parent = nullptr);
     ~MainObject();
     bool createBlankBudget();
@@ -59,19 +66,24 @@ public:
     QAbstractItemModel *accountTypesModel() const;
     QAbstractItemModel *familyModel() const;
     QAbstractItemModel *subcategoriesModel() const;
-    bool addFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge);
-    bool removeFamilyMembers(const QList<int> &ids);
-    bool addAccount(const QString &name, const QString &owner, int curr, int typ);
-    bool removeAccounts(const QList<int> &ids);
-    bool addTransaction(int account, const QDate &opDt, int curr, double amount, const QString &payType, const QString &desc, int categ, int subcateg,
-                        int movementType, int destination, double exchangeRate);
-    bool removeTransactions(const QList<int> &ids);
+    QFuture<bool> addFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge);
+    QFuture<bool> removeFamilyMembers(const QList<int> &ids);
+    QFuture<bool> addAccount(const QString &name, const QString &owner, int curr, int typ);
+    QFuture<bool> removeAccounts(const QList<int> &ids);
+    QFuture<bool> addTransaction(int account, const QDate &opDt, int curr, double amount, const QString &payType, const QString &desc, int categ,
+                                 int subcateg, int movementType, int destination, double exchangeRate);
+    QFuture<bool> removeTransactions(const QList<int> &ids);
     bool isDirty() const;
-    bool saveBudget(const QString &path);
-    bool loadBudget(const QString &path);
-    bool importStatement(int account, const QString &path, ImportFormats format);
-    bool importBarclaysStatement(int account, QFile *source);
-    QDate lastTransactionDate() const;
+    QFuture<bool> saveBudget(const QString &path, bool compact = false);
+    void waitForSave();
+    QFuture<bool> loadBudget(const QString &path);
+    bool hasRecoverableBudget() const;
+    bool recoverBudget();
+    bool readStatement(const QString &path, const QString &format, QList<ImportedStatement> *statements) const;
+    QFuture<bool> importStatement(int account, const QString &path, const QString &format = QString());
+    QFuture<bool> importStatements(const QList<ImportedStatement> &statements, const QList<int> &accounts);
+    StatementImporterRegistry *importers() const;
+    QFuture<QDate> lastTransactionDate() const;
     int baseCurrency() const;
     bool setBaseCurrency(const QString &crncy);
     bool setBaseCurrency(int crncy);
@@ -81,26 +93,63 @@ public:
     constexpr static bool isInternalTransferCategory(int category);
 public slots:
     void newBudget();
+    void cancelLoad();
 signals:
+    void loadProgress(int percent);
+    void transactionsFetchProgress(int fetchedRows, bool complete);
+    void editsRejected(int editCount);
     void dirtyChanged(bool dirty);
     void lastUpdateChanged();
     void baseCurrencyChanged();
     void addTransactionSkippedDuplicates(int count);
 
 private:
+    struct PreparedBudget
+    {
+        QString path;
+        QString journalPath;
+        int journalCount;
+    };
+    struct TransactionBatch
+    {
+        int account;
+        QList<QDate> opDates;
+        QList<int> currencies;
+        QList<double> amounts;
+        QList<QString> payTypes;
+        QList<QString> descriptions;
+        QList<int> categories;
+        QList<int> subcategories;
+        QList<int> movementTypes;
+        QList<int> destinations;
+        QList<double> exchangeRates;
+    };
+    static void prepareBudget(QPromise<PreparedBudget> &promise, const QString &path);
+    static bool insertFamilyMember(const QString &name, const QDate &birthday, double income, int incomeCurr, int retirementAge);
+    static bool deleteFamilyMembers(const QList<int> &ids);
+    static bool insertAccount(const QString &name, const QString &owner, int curr, int typ);
+    static bool deleteAccounts(const QList<int> &ids, bool transaction);
+    static bool deleteTransactions(const QList<int> &ids);
+    static bool insertTransactions(const TransactionBatch &batch, bool checkDuplicates, bool transaction, int *duplicateSkipped);
+    static int accountCurrency(int account);
+    static QDate readLastTransactionDate();
+    QFuture<bool> applyWhenCommitted(const QFuture<bool> &edit, const QList<OfflineSqliteTable *> &models);
     double getExchangeRate(int fromCurrencyID, int toCurrencyID, double defaultVal = 1.0) const;
     int forcedSubcategory(int category) const;
     int movementTypeForInternalTransfer(int category, double amount) const;
-    bool addTransactions(int account, const QList<QDate> &opDt, const QList<int> &curr, const QList<double> &amount, const QList<QString> &payType,
-                         const QList<QString> &desc, const QList<int> &categ, const QList<int> &subcateg, const QList<int> &movementType,
-                         const QList<int> &destination, const QList<double> &exchangeRate, bool checkDuplicates);
+    bool prepareImportedStatement(int account, const ImportedStatement &statement, TransactionBatch *batch) const;
     int idForCurrency(const QString &curr) const;
     int idForMovementType(const QString &mov) const;
     void setDirty(bool dirty);
+    void discardBudget();
+    void flushEdits();
+    void releaseDbFile();
+    void setRecoveryPending(bool pending);
+    void onAutosaveRequested();
     void reselectModels();
-    bool removeAccounts(const QList<int> &ids, bool transaction);
     void onTransactionCategoryChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
     void onTransactionCurrencyChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    DatabaseActor *m_databaseActor;
     TransactionModel *m_transactionsModel;
     OfflineSqliteTable *m_accountsModel;
     QSortFilterProxyModel *m_openAccountFilter;
@@ -110,7 +159,19 @@ private:
     OfflineSqliteTable *m_movementTypesModel;
     OfflineSqliteTable *m_accountTypesModel;
     OfflineSqliteTable *m_familyModel;
+    OfflineSqliteTable *m_exchangeRatesModel;
+    StatementImporterRegistry *m_importers;
+    QThread *m_checkpointThread;
+    BudgetCheckpointer *m_checkpointer;
+    QFutureWatcher<PreparedBudget> *m_loadWatcher;
+    QFuture<PreparedBudget> m_loadFuture;
+    quint64 m_loadGeneration;
+    quint64 m_budgetGeneration;
     bool m_dirty;
+    quint64 m_editGeneration;
+    QFuture<bool> m_saveFuture;
+    QString m_journalPath;
+    int m_journalCount;
     int m_baseCurrency;
 };
 
@@ -18,11 +18,15 @@
 #include <mainobject.h>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QProgressDialog>
 #include <QCloseEvent>
 #include <QStandardPaths>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
+    , m_pendingSave(QtFuture::makeReadyFuture(true))
+    , m_budgetGeneration(0)
+    , m_closeConfirmed(false)
     , m_object(new MainObject(this))
     , m_settingsDialog(new SettingsDialog(this))
     , ui(new Ui::MainWindow)
@@ -40,7 +44,24 @@ MainWindow::MainWindow(QWidget *parent)
     connect(ui->actionExit, &QAction::triggered, this, &MainWindow::onFileExit);
     connect(ui->actionOptions, &QAction::triggered, m_settingsDialog, &SettingsDialog::show);
     connect(m_object, &MainObject::dirtyChanged, this, &MainWindow::setWindowModified);
-    QMetaObject::invokeMethod(m_object, &MainObject::newBudget, Qt::QueuedConnection);
+    connect(m_object, &MainObject::transactionsFetchProgress, this, &MainWindow::onTransactionsFetchProgress);
+    connect(m_object, &MainObject::editsRejected, this, &MainWindow::onEditsRejected);
+    QMetaObject::invokeMethod(this, &MainWindow::onStartup, Qt::QueuedConnection);
+}
+
+void MainWindow::onStartup()
+{
+    if (m_object->hasRecoverableBudget()) {
+        if (QMessageBox::question(this, tr("Recover Budget"),
+                                  tr("The budget was not closed properly last time. Do you want to recover the unsaved changes?"),
+                                  QMessageBox::Yes | QMessageBox::No)
+            == QMessageBox::Yes) {
+            if (m_object->recoverBudget())
+                return;
+            QMessageBox::critical(this, tr("Error"), tr("The unsaved changes could not be recovered"));
+        }
+    }
+    m_object->newBudget();
 }
 
 MainWindow::~MainWindow()
@@ -56,78 +77,163 @@ void MainWindow::onAboutQt()
 void MainWindow::onFileNew()
 {
     Q_ASSERT(m_object);
-    if (m_object->isDirty()) {
-        const QMessageBox::StandardButton answer = QMessageBox::question(
-                this, tr("Do you want to save?"), tr("There are unsaved changes to your budget. Do you want to save them before continuing?"),
-                QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
-        if (answer == QMessageBox::Cancel)
-            return;
-        if (answer == QMessageBox::Save)
-            onFileSave();
-    }
-    m_object->newBudget();
-    m_lastSavedPath.clear();
+    whenBudgetReleased([this]() {
+        ++m_budgetGeneration;
+        m_object->newBudget();
+        m_lastSavedPath.clear();
+    });
 }
 
-bool MainWindow::onFileSave()
+void MainWindow::whenBudgetReleased(const std::function<void()> &proceed)
+{
+    // a save still running decides what is left unsaved and reports its errors before the budget is replaced
+    m_pendingSave.then(this, [this, proceed](bool) {
+        if (m_object->isDirty()) {
+            const QMessageBox::StandardButton answer =
+                    QMessageBox::question(this, tr("Do you want to save?"),
+                                          tr("There are unsaved changes to your budget. Do you want to save them before continuing?"),
+                                          QMessageBox::Save | QMessageBox::Discard | QMessageBox::Cancel);
+            if (answer == QMessageBox::Cancel)
+                return;
+            if (answer == QMessageBox::Save) {
+                saveCurrentBudget().then(this, [proceed](bool saved) {
+                    if (saved)
+                        proceed();
+                });
+                return;
+            }
+        }
+        proceed();
+    });
+}
+
+void MainWindow::onFileSave()
+{
+    saveCurrentBudget();
+}
+
+void MainWindow::onFileSaveAs()
+{
+    saveBudgetAs();
+}
+
+QFuture<bool> MainWindow::saveCurrentBudget()
 {
     if (m_lastSavedPath.isEmpty())
-        return onFileSaveAs();
-    Q_ASSERT(m_object);
-    if (!m_object->saveBudget(m_lastSavedPath)) {
-        QMessageBox::critical(this, tr("Error"), tr("Error while saving the budget. Try again later"));
-        return false;
-    }
-    return true;
+        return saveBudgetAs();
+    return saveBudget(m_lastSavedPath, false);
 }
 
-bool MainWindow::onFileSaveAs()
+QFuture<bool> MainWindow::saveBudgetAs()
 {
     Q_ASSERT(m_object);
     const QString startingPath =
             m_lastSavedPath.isEmpty() ? QStandardPaths::standardLocations(QStandardPaths::DocumentsLocation).first() : m_lastSavedPath;
-    QString path = QFileDialog::getSaveFileName(this, tr("Save Budget"), startingPath, tr("Budget Files (*.buddb)"));
+    QString path = QFileDialog::getSaveFileName(this, tr("Save Budget"), startingPath,
+                                                tr("Budget Files (*.buddb);;Compressed Budget Files (*.buddbz)"));
     if (path.isEmpty())
-        return false;
-    if (!m_object->saveBudget(path)) {
-        QMessageBox::critical(this, tr("Error"), tr("Error while saving the budget. Try again later"));
-        return false;
-    }
-    m_lastSavedPath = path;
-    return true;
+        return QtFuture::makeReadyFuture(false);
+    return saveBudget(path, true);
 }
 
-bool MainWindow::onFileLoad()
+QFuture<bool> MainWindow::saveBudget(const QString &path, bool compact)
+{
+    Q_ASSERT(m_object);
+    ui->statusbar->showMessage(tr("Saving..."));
+    const quint64 generation = m_budgetGeneration;
+    m_pendingSave = m_object->saveBudget(path, compact).then(this, [this, path, generation](bool saved) -> bool {
+        ui->statusbar->clearMessage();
+        if (!saved) {
+            QMessageBox::critical(this, tr("Error"), tr("Error while saving the budget. Try again later"));
+            return false;
+        }
+        // the budget was replaced while saving, the next save must not overwrite this file with it
+        if (generation == m_budgetGeneration)
+            m_lastSavedPath = path;
+        ui->statusbar->showMessage(tr("Budget saved"), 2000);
+        return true;
+    });
+    return m_pendingSave;
+}
+
+void MainWindow::onFileLoad()
 {
     Q_ASSERT(m_object);
     const QString startingPath =
             m_lastSavedPath.isEmpty() ? QStandardPaths::standardLocations(QStandardPaths::DocumentsLocation).first() : m_lastSavedPath;
-    QString path = QFileDialog::getOpenFileName(this, tr("Open Budget"), startingPath, tr("Budget Files (*.buddb)"));
+    QString path = QFileDialog::getOpenFileName(this, tr("Open Budget"), startingPath, tr("Budget Files (*.buddb *.buddbz)"));
     if (path.isEmpty())
-        return false;
-    if (!m_object->loadBudget(path)) {
-        QMessageBox::critical(this, tr("Error"), tr("Error while loading the budget. The file might be currupted"));
-        return false;
-    }
-    m_lastSavedPath = path;
-    return true;
+        return;
+    whenBudgetReleased([this, path]() { loadBudget(path); });
+}
+
+void MainWindow::loadBudget(const QString &path)
+{
+    Q_ASSERT(m_object);
+    const quint64 generation = m_budgetGeneration;
+    QProgressDialog *progressDialog = new QProgressDialog(tr("Opening budget..."), tr("Cancel"), 0, 100, this);
+    progressDialog->setAttribute(Qt::WA_DeleteOnClose);
+    progressDialog->setWindowModality(Qt::WindowModal);
+    progressDialog->setMinimumDuration(500);
+    connect(m_object, &MainObject::loadProgress, progressDialog, &QProgressDialog::setValue);
+    connect(progressDialog, &QProgressDialog::canceled, m_object, &MainObject::cancelLoad);
+    m_object->loadBudget(path)
+            .then(this,
+                  [this, path, generation, progressDialog](bool loaded) {
+                      progressDialog->close();
+                      // a new budget was created while loading and cancelled it
+                      if (generation != m_budgetGeneration)
+                          return;
+                      if (!loaded) {
+                          QMessageBox::critical(this, tr("Error"), tr("Error while loading the budget. The file might be currupted"));
+                          return;
+                      }
+                      ++m_budgetGeneration;
+                      m_lastSavedPath = path;
+                  })
+            .onCanceled(this, [progressDialog]() { progressDialog->close(); });
+}
+
+void MainWindow::onTransactionsFetchProgress(int fetchedRows, bool complete)
+{
+    if (complete)
+        ui->statusbar->clearMessage();
+    else
+        ui->statusbar->showMessage(tr("Loading transactions... (%n loaded)", "", fetchedRows));
+}
+
+void MainWindow::onEditsRejected(int editCount)
+{
+    QMessageBox::warning(this, tr("Edits Not Saved"),
+                         tr("%n edit(s) could not be written to the budget and were reverted.", "", editCount));
 }
 
 void MainWindow::onFileExit()
 {
     Q_ASSERT(m_object);
-    if (m_object->isDirty()) {
-        if (QMessageBox::question(this, tr("Are you sure?"), tr("There are unsaved changes to your budget. Do you really want to quit?"),
-                                  QMessageBox::Yes | QMessageBox::No)
-            == QMessageBox::No)
-            return;
-    }
-    qApp->quit();
+    // a save still running reports its result before deciding whether anything is left unsaved
+    m_pendingSave.then(this, [this](bool) {
+        if (m_object->isDirty()) {
+            if (QMessageBox::question(this, tr("Are you sure?"), tr("There are unsaved changes to your budget. Do you really want to quit?"),
+                                      QMessageBox::Yes | QMessageBox::No)
+                == QMessageBox::No)
+                return;
+        }
+        m_closeConfirmed = true;
+        m_object->waitForSave();
+        qApp->quit();
+    });
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
-    if (event->spontaneous() && m_object->isDirty()) {
+    if (!m_pendingSave.isFinished()) {
+        // the window is closed again once the save finished and showed any error
+        event->ignore();
+        m_pendingSave.then(this, [this](bool) { close(); });
+        return;
+    }
+    if (!m_closeConfirmed && m_object->isDirty()) {
         if (QMessageBox::question(this, tr("Are you sure?"), tr("There are unsaved changes to your budget. Do you really want to quit?"),
                                   QMessageBox::Yes | QMessageBox::No)
             == QMessageBox::No) {
@@ -135,5 +241,6 @@ void MainWindow::closeEvent(QCloseEvent *event)
             return;
         }
     }
+    m_object->waitForSave();
     QMainWindow::closeEvent(event);
 }
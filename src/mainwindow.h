@@ -15,6 +15,8 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QFuture>
+#include <functional>
 namespace Ui {
 class MainWindow;
 }
@@ -29,16 +31,27 @@ public:
 private slots:
     void onAboutQt();
     void onFileNew();
-    bool onFileSave();
-    bool onFileSaveAs();
-    bool onFileLoad();
+    void onFileSave();
+    void onFileSaveAs();
+    void onFileLoad();
     void onFileExit();
+    void onStartup();
+    void onTransactionsFetchProgress(int fetchedRows, bool complete);
+    void onEditsRejected(int editCount);
 
 protected:
     void closeEvent(QCloseEvent *event) override;
 
 private:
+    QFuture<bool> saveBudget(const QString &path, bool compact);
+    QFuture<bool> saveCurrentBudget();
+    QFuture<bool> saveBudgetAs();
+    void loadBudget(const QString &path);
+    void whenBudgetReleased(const std::function<void()> &proceed);
     QString m_lastSavedPath;
+    QFuture<bool> m_pendingSave;
+    quint64 m_budgetGeneration;
+    bool m_closeConfirmed;
     MainObject *m_object;
     SettingsDialog *m_settingsDialog;
     Ui::MainWindow *ui;
@@ -15,6 +15,7 @@
 #include <QStandardItemModel>
 #include <QListView>
 #include <QEvent>
+#include <QSet>
 class CheckableRoleMaskProxyModel : public RoleMaskProxyModel
 {
     Q_DISABLE_COPY_MOVE(CheckableRoleMaskProxyModel)
@@ -30,6 +31,7 @@ MultichoiceCombo::MultichoiceCombo(QWidget *parent)
     : QComboBox(parent)
     , m_baseModel(new QStandardItemModel(0, 1, this))
     , m_choiceMask(new CheckableRoleMaskProxyModel(this))
+    , m_settingChecks(false)
 {
     m_choiceMask->setTransparentIfEmpty(false);
     m_choiceMask->setMaskedRoles({Qt::CheckStateRole});
@@ -44,7 +46,7 @@ MultichoiceCombo::MultichoiceCombo(QWidget *parent)
     connect(m_choiceMask, &QAbstractItemModel::rowsMoved, this, &MultichoiceCombo::updateChosenText);
     connect(m_choiceMask, &QAbstractItemModel::columnsMoved, this, &MultichoiceCombo::updateChosenText);
     connect(m_choiceMask, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex &, const QModelIndex &, const QList<int> &roles) {
-        if (roles.isEmpty() || roles.contains(Qt::CheckStateRole))
+        if (!m_settingChecks && (roles.isEmpty() || roles.contains(Qt::CheckStateRole)))
             updateChosenText();
     });
 }
@@ -74,8 +76,17 @@ QList<int> MultichoiceCombo::checkedIndexes() const
 
 void MultichoiceCombo::setCheckedIndexes(const QList<int> &idx)
 {
-    for (int i = 0, maxI = m_choiceMask->rowCount(); i < maxI; ++i)
-        m_choiceMask->setData(m_choiceMask->index(i, modelColumn()), idx.contains(i) ? Qt::Checked : Qt::Unchecked, Qt::CheckStateRole);
+    const QSet<int> checkedRows(idx.cbegin(), idx.cend());
+    // the text is rebuilt once at the end rather than after every row
+    m_settingChecks = true;
+    for (int i = 0, maxI = m_choiceMask->rowCount(); i < maxI; ++i) {
+        const QModelIndex choiceIndex = m_choiceMask->index(i, modelColumn());
+        const Qt::CheckState state = checkedRows.contains(i) ? Qt::Checked : Qt::Unchecked;
+        if (choiceIndex.data(Qt::CheckStateRole).toInt() != state)
+            m_choiceMask->setData(choiceIndex, state, Qt::CheckStateRole);
+    }
+    m_settingChecks = false;
+    updateChosenText();
 }
 
 void MultichoiceCombo::initStyleOption(QStyleOptionComboBox *option) const
@@ -36,6 +36,7 @@ private:
     QStandardItemModel *m_baseModel;
     RoleMaskProxyModel *m_choiceMask;
     QString m_chosenText;
+    bool m_settingChecks;
     void updateChosenText();
 };
 
@@ -11,18 +11,61 @@
    limitations under the License.
 \****************************************************************************/
 #include "multiplefilterproxy.h"
+#include <QtConcurrent>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#define PARALLEL_FILTER_MIN_ROWS 20000
+#define PARALLEL_FILTER_CHUNK 4096
+#define PARALLEL_SORT_MIN_ROWS 20000
+#define PARALLEL_SORT_CHUNK 4096
+
+MultipleFilterProxy::FilterPredicate::FilterPredicate()
+    : kind(pkBool)
+    , expected(true)
+    , column(-1)
+    , role(Qt::DisplayRole)
+    , minDay(std::numeric_limits<qint64>::min())
+    , maxDay(std::numeric_limits<qint64>::max())
+    , minValue(-std::numeric_limits<double>::infinity())
+    , maxValue(std::numeric_limits<double>::infinity())
+    , caseSensitivity(Qt::CaseSensitive)
+{ }
+
+MultipleFilterProxy::SortKey::SortKey()
+    : kind(skInvalid)
+    , number(0.0)
+{ }
+
+MultipleFilterProxy::CachedSortKey::CachedSortKey()
+    : kind(skInvalid)
+    , stale(true)
+    , number(0.0)
+    , text(-1)
+{ }
 
 MultipleFilterProxy::MultipleFilterProxy(QObject *parent)
     : QSortFilterProxyModel(parent)
+    , m_columnCount(0)
+    , m_refilterMode(rmFull)
+    , m_askedRows(0)
+    , m_sortKeyColumn(-1)
 {
     setDynamicSortFilter(false);
     setSortLocaleAware(true);
+    connect(this, &QSortFilterProxyModel::sortRoleChanged, this, &MultipleFilterProxy::clearSortKeys);
+    connect(this, &QSortFilterProxyModel::sortLocaleAwareChanged, this, &MultipleFilterProxy::clearSortKeys);
+    connect(this, &QSortFilterProxyModel::sortCaseSensitivityChanged, this, [this](Qt::CaseSensitivity sortCaseSensitivity) {
+        m_collator.setCaseSensitivity(sortCaseSensitivity);
+        clearSortKeys();
+    });
 }
 
 MultipleFilterProxy::~MultipleFilterProxy() = default;
 
 void MultipleFilterProxy::setSourceModel(QAbstractItemModel *mdl)
 {
+    m_suspendedSource.clear();
     if (sourceModel() == mdl)
         return;
     for (const auto &conn : std::as_const(m_sourceConnections))
@@ -30,20 +73,63 @@ void MultipleFilterProxy::setSourceModel(QAbstractItemModel *mdl)
     m_sourceConnections.clear();
     if (mdl) {
         m_sourceConnections << connect(mdl, &QAbstractItemModel::columnsInserted, this, &MultipleFilterProxy::onColumnsInserted)
-                            << connect(mdl, &QAbstractItemModel::modelReset, this, std::bind(&MultipleFilterProxy::onModelReset, this, mdl));
+                            << connect(mdl, &QAbstractItemModel::modelReset, this, std::bind(&MultipleFilterProxy::onModelReset, this, mdl))
+                            // connected before QSortFilterProxyModel so the row states are aligned by the time it filters new rows
+                            << connect(mdl, &QAbstractItemModel::rowsInserted, this, &MultipleFilterProxy::onRowsInserted)
+                            << connect(mdl, &QAbstractItemModel::rowsRemoved, this, &MultipleFilterProxy::onRowsRemoved)
+                            << connect(mdl, &QAbstractItemModel::dataChanged, this, &MultipleFilterProxy::onDataChanged)
+                            << connect(mdl, &QAbstractItemModel::rowsMoved, this, &MultipleFilterProxy::onRowsReordered)
+                            << connect(mdl, &QAbstractItemModel::layoutChanged, this, &MultipleFilterProxy::onRowsReordered);
     }
+    onRowsReordered();
     onModelReset(mdl);
     QSortFilterProxyModel::setSourceModel(mdl);
 }
 
+bool MultipleFilterProxy::isSuspended() const
+{
+    return !m_suspendedSource.isNull();
+}
+
+void MultipleFilterProxy::setSuspended(bool suspended)
+{
+    if (suspended == isSuspended())
+        return;
+    if (suspended) {
+        // changes to the source no longer reach the proxy, the filters and the sort order are kept for when it resumes
+        QAbstractItemModel *source = sourceModel();
+        if (!source)
+            return;
+        setSourceModel(nullptr);
+        m_suspendedSource = source;
+        return;
+    }
+    QAbstractItemModel *source = m_suspendedSource;
+    const QList<FilterPredicate> plan = m_filterPlan;
+    const int columnCount = m_columnCount;
+    const int column = sortColumn();
+    const Qt::SortOrder order = sortOrder();
+    setSourceModel(source);
+    // reattaching resets the plan, it still applies if the columns did not change meanwhile
+    if (!plan.isEmpty() && m_columnCount == columnCount) {
+        m_filterPlan = plan;
+        refilter(QList<FilterPredicate>());
+    }
+    // without dynamic sorting the new source rows are not sorted on their own
+    if (column >= 0)
+        sort(column, order);
+}
+
 void MultipleFilterProxy::onColumnsInserted(const QModelIndex &parent, int first, int last)
 {
     if (parent.isValid())
         return;
-    for (; first <= last; --last) {
-        m_dateRangeFilter.insert(first, QHash<qint32, std::pair<QDate, QDate>>());
-        m_regExpFilter.insert(first, QHash<qint32, std::pair<QRegularExpression, bool>>());
-        m_boolFilter.insert(first, QHash<qint32, bool>());
+    const int count = last - first + 1;
+    m_columnCount += count;
+    clearSortKeys();
+    for (FilterPredicate &predicate : m_filterPlan) {
+        if (predicate.column >= first)
+            predicate.column += count;
     }
 }
 
@@ -51,39 +137,667 @@ void MultipleFilterProxy::onModelReset(QAbstractItemModel *mdl)
 {
     if (!mdl)
         return;
-    m_dateRangeFilter.clear();
-    m_regExpFilter.clear();
-    m_boolFilter.clear();
-    const int sourceCols = mdl->columnCount();
-    m_dateRangeFilter.reserve(sourceCols);
-    m_regExpFilter.reserve(sourceCols);
-    m_boolFilter.reserve(sourceCols);
-    for (int i = 0; i < sourceCols; ++i) {
-        m_dateRangeFilter.append(QHash<qint32, std::pair<QDate, QDate>>());
-        m_regExpFilter.append(QHash<qint32, std::pair<QRegularExpression, bool>>());
-        m_boolFilter.append(QHash<qint32, bool>());
+    m_filterPlan.clear();
+    m_columnCount = mdl->columnCount();
+    onRowsReordered();
+}
+
+void MultipleFilterProxy::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    const int count = last - first + 1;
+    m_sortRanks.clear();
+    if (!m_sortKeys.isEmpty()) {
+        if (first > m_sortKeys.size())
+            clearSortKeys();
+        else
+            m_sortKeys.insert(first, count, CachedSortKey());
+    }
+    if (m_rowStates.isEmpty())
+        return;
+    if (first > m_rowStates.size())
+        return clearRowStates();
+    m_rowStates.insert(first, count, rsUnknown);
+}
+
+void MultipleFilterProxy::onRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    m_sortRanks.clear();
+    if (last < m_sortKeys.size())
+        m_sortKeys.remove(first, last - first + 1);
+    else
+        clearSortKeys();
+    if (m_rowStates.isEmpty())
+        return;
+    if (last >= m_rowStates.size())
+        return clearRowStates();
+    m_rowStates.remove(first, last - first + 1);
+}
+
+void MultipleFilterProxy::onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if (topLeft.parent().isValid())
+        return;
+    for (int i = topLeft.row(), iEnd = std::min<int>(bottomRight.row(), m_rowStates.size() - 1); i <= iEnd; ++i)
+        m_rowStates[i] = rsUnknown;
+    // only the keys of the edited rows are read again at the next sort
+    if (m_sortKeyColumn >= topLeft.column() && m_sortKeyColumn <= bottomRight.column()) {
+        for (int i = topLeft.row(), iEnd = std::min<int>(bottomRight.row(), m_sortKeys.size() - 1); i <= iEnd; ++i)
+            m_sortKeys[i].stale = true;
+        m_sortRanks.clear();
     }
 }
 
+void MultipleFilterProxy::onRowsReordered()
+{
+    clearRowStates();
+    clearSortKeys();
+}
+
+void MultipleFilterProxy::clearSortKeys()
+{
+    m_sortKeyColumn = -1;
+    m_sortKeys.clear();
+    m_textKeys.clear();
+    m_sortRanks.clear();
+}
+
+MultipleFilterProxy::SortKey MultipleFilterProxy::sortKey(int source_row, qint32 column, const QModelIndex &source_parent) const
+{
+    SortKey key;
+    const QVariant value = filterValue(source_row, column, sortRole(), source_parent);
+    switch (value.typeId()) {
+    case QMetaType::UnknownType:
+        break;
+    case QMetaType::Bool:
+    case QMetaType::Int:
+    case QMetaType::UInt:
+    case QMetaType::Long:
+    case QMetaType::ULong:
+    case QMetaType::LongLong:
+    case QMetaType::ULongLong:
+    case QMetaType::Short:
+    case QMetaType::UShort:
+    case QMetaType::Float:
+    case QMetaType::Double:
+        key.number = value.toDouble();
+        key.kind = std::isnan(key.number) ? skInvalid : skNumber;
+        break;
+    case QMetaType::QDate:
+        key.kind = skNumber;
+        key.number = value.toDate().toJulianDay();
+        break;
+    case QMetaType::QTime:
+        key.kind = skNumber;
+        key.number = value.toTime().msecsSinceStartOfDay();
+        break;
+    case QMetaType::QDateTime:
+        key.kind = skNumber;
+        key.number = value.toDateTime().toMSecsSinceEpoch();
+        break;
+    default:
+        key.kind = skText;
+        key.text = value.toString();
+        break;
+    }
+    return key;
+}
+
+void MultipleFilterProxy::prepareSortKeys(qint32 column) const
+{
+    const int sourceRows = sourceModel()->rowCount();
+    if (m_sortKeyColumn == column && m_sortKeys.size() == sourceRows)
+        return;
+    m_sortKeyColumn = column;
+    m_sortKeys.fill(CachedSortKey(), sourceRows);
+    m_textKeys.clear();
+    m_sortRanks.clear();
+}
+
+void MultipleFilterProxy::refreshSortKey(int row) const
+{
+    CachedSortKey &cached = m_sortKeys[row];
+    if (!cached.stale)
+        return;
+    const SortKey key = sortKey(row, m_sortKeyColumn, QModelIndex());
+    cached.kind = key.kind;
+    cached.number = key.number;
+    cached.stale = false;
+    if (key.kind != skText)
+        return;
+    if (cached.text < 0) {
+        cached.text = m_textKeys.size();
+        m_textKeys.append(m_collator.sortKey(key.text));
+    } else {
+        m_textKeys[cached.text] = m_collator.sortKey(key.text);
+    }
+}
+
+void MultipleFilterProxy::refreshSortKeys()
+{
+    // removed rows leave their text keys behind, past a point it is cheaper to collate everything again
+    if (m_textKeys.size() > 2 * m_sortKeys.size()) {
+        m_textKeys.clear();
+        for (CachedSortKey &cached : m_sortKeys) {
+            cached.stale = true;
+            cached.text = -1;
+        }
+    }
+    QList<int> staleRows;
+    for (int i = 0, iEnd = m_sortKeys.size(); i < iEnd; ++i) {
+        if (m_sortKeys.at(i).stale)
+            staleRows.append(i);
+    }
+    if (staleRows.size() < PARALLEL_SORT_MIN_ROWS) {
+        for (int row : std::as_const(staleRows))
+            refreshSortKey(row);
+        return;
+    }
+    // the model can only be read on its own thread, the workers only collate the texts
+    QList<SortKey> keys;
+    keys.reserve(staleRows.size());
+    for (int row : std::as_const(staleRows))
+        keys.append(sortKey(row, m_sortKeyColumn, QModelIndex()));
+    QList<std::pair<qsizetype, qsizetype>> chunks;
+    for (qsizetype i = 0; i < keys.size(); i += PARALLEL_SORT_CHUNK)
+        chunks.append(std::make_pair(i, std::min<qsizetype>(i + PARALLEL_SORT_CHUNK, keys.size())));
+    QList<qsizetype> chunkIndexes(chunks.size());
+    std::iota(chunkIndexes.begin(), chunkIndexes.end(), 0);
+    QList<QList<QCollatorSortKey>> chunkTextKeys(chunks.size());
+    QList<QCollatorSortKey> *chunkTextKeysData = chunkTextKeys.data();
+    const QLocale locale = m_collator.locale();
+    const Qt::CaseSensitivity caseSensitivity = m_collator.caseSensitivity();
+    QtConcurrent::blockingMap(chunkIndexes, [&keys, &chunks, chunkTextKeysData, &locale, caseSensitivity](qsizetype chunkIndex) {
+        // each worker collates with its own instance
+        QCollator collator(locale);
+        collator.setCaseSensitivity(caseSensitivity);
+        for (qsizetype i = chunks.at(chunkIndex).first; i < chunks.at(chunkIndex).second; ++i) {
+            if (keys.at(i).kind == skText)
+                chunkTextKeysData[chunkIndex].append(collator.sortKey(keys.at(i).text));
+        }
+    });
+    qsizetype keyIndex = 0;
+    for (qsizetype i = 0, iEnd = chunks.size(); i < iEnd; ++i) {
+        qsizetype textIndex = 0;
+        for (; keyIndex < chunks.at(i).second; ++keyIndex) {
+            const SortKey &key = keys.at(keyIndex);
+            CachedSortKey &cached = m_sortKeys[staleRows.at(keyIndex)];
+            cached.kind = key.kind;
+            cached.number = key.number;
+            cached.stale = false;
+            if (key.kind != skText)
+                continue;
+            const QCollatorSortKey &textKey = chunkTextKeys.at(i).at(textIndex++);
+            if (cached.text < 0) {
+                cached.text = m_textKeys.size();
+                m_textKeys.append(textKey);
+            } else {
+                m_textKeys[cached.text] = textKey;
+            }
+        }
+    }
+}
+
+int MultipleFilterProxy::compareSortKeys(int leftRow, int rightRow) const
+{
+    const CachedSortKey &left = m_sortKeys.at(leftRow);
+    const CachedSortKey &right = m_sortKeys.at(rightRow);
+    // values that cannot be compared go last, as QSortFilterProxyModel does
+    if (left.kind != right.kind)
+        return left.kind < right.kind ? -1 : 1;
+    if (left.number != right.number)
+        return left.number < right.number ? -1 : 1;
+    if (left.kind != skText)
+        return 0;
+    return m_textKeys.at(left.text).compare(m_textKeys.at(right.text));
+}
+
+void MultipleFilterProxy::rankSortKeys()
+{
+    QList<int> sortedRows(m_sortKeys.size());
+    std::iota(sortedRows.begin(), sortedRows.end(), 0);
+    const auto rowLessThan = [this](int left, int right) -> bool { return compareSortKeys(left, right) < 0; };
+    if (sortedRows.size() < PARALLEL_SORT_MIN_ROWS) {
+        std::sort(sortedRows.begin(), sortedRows.end(), rowLessThan);
+    } else {
+        // every worker sorts its own slice then neighbouring slices are merged in rounds of doubling width
+        QList<std::pair<qsizetype, qsizetype>> chunks;
+        for (qsizetype i = 0; i < sortedRows.size(); i += PARALLEL_SORT_CHUNK)
+            chunks.append(std::make_pair(i, std::min<qsizetype>(i + PARALLEL_SORT_CHUNK, sortedRows.size())));
+        int *rowData = sortedRows.data();
+        QtConcurrent::blockingMap(chunks, [rowData, &rowLessThan](const std::pair<qsizetype, qsizetype> &chunk) {
+            std::sort(rowData + chunk.first, rowData + chunk.second, rowLessThan);
+        });
+        for (qsizetype width = PARALLEL_SORT_CHUNK; width < sortedRows.size(); width *= 2) {
+            QList<qsizetype> merges;
+            for (qsizetype i = 0; i + width < sortedRows.size(); i += 2 * width)
+                merges.append(i);
+            const qsizetype rowCount = sortedRows.size();
+            QtConcurrent::blockingMap(merges, [rowData, rowCount, width, &rowLessThan](qsizetype start) {
+                std::inplace_merge(rowData + start, rowData + start + width, rowData + std::min(start + 2 * width, rowCount), rowLessThan);
+            });
+        }
+    }
+    // equal keys share a rank so QSortFilterProxyModel keeps their previous relative order
+    m_sortRanks.resize(sortedRows.size());
+    int rank = 0;
+    for (qsizetype i = 0, iEnd = sortedRows.size(); i < iEnd; ++i) {
+        if (i > 0 && compareSortKeys(sortedRows.at(i - 1), sortedRows.at(i)) != 0)
+            ++rank;
+        m_sortRanks[sortedRows.at(i)] = rank;
+    }
+}
+
+void MultipleFilterProxy::sort(int column, Qt::SortOrder order)
+{
+    // every key is computed once and ranked up front, the sort itself then only compares integers
+    if (column >= 0 && sourceModel() && isSortLocaleAware()) {
+        prepareSortKeys(column);
+        if (m_sortRanks.isEmpty()) {
+            refreshSortKeys();
+            rankSortKeys();
+        }
+    }
+    QSortFilterProxyModel::sort(column, order);
+}
+
+bool MultipleFilterProxy::lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const
+{
+    if (!isSortLocaleAware() || source_left.parent().isValid() || source_right.parent().isValid()
+        || source_left.column() != source_right.column())
+        return QSortFilterProxyModel::lessThan(source_left, source_right);
+    prepareSortKeys(source_left.column());
+    if (!m_sortRanks.isEmpty())
+        return m_sortRanks.at(source_left.row()) < m_sortRanks.at(source_right.row());
+    // rows inserted after the last sort are placed comparing their keys directly
+    refreshSortKey(source_left.row());
+    refreshSortKey(source_right.row());
+    return compareSortKeys(source_left.row(), source_right.row()) < 0;
+}
+
+void MultipleFilterProxy::clearRowStates()
+{
+    m_rowStates.clear();
+}
+
 bool MultipleFilterProxy::hasAnyFilter() const
 {
-    return std::any_of(m_dateRangeFilter.cbegin(), m_dateRangeFilter.cend(),
-                       [](const QHash<qint32, std::pair<QDate, QDate>> &filter) -> bool { return !filter.isEmpty(); })
-            || std::any_of(m_regExpFilter.cbegin(), m_regExpFilter.cend(),
-                           [](const QHash<qint32, std::pair<QRegularExpression, bool>> &filter) -> bool { return !filter.isEmpty(); })
-            || std::any_of(m_boolFilter.cbegin(), m_boolFilter.cend(), [](const QHash<qint32, bool> &filter) -> bool { return !filter.isEmpty(); });
+    return !m_filterPlan.isEmpty();
+}
+
+const QList<MultipleFilterProxy::FilterPredicate> &MultipleFilterProxy::filterPlan() const
+{
+    return m_filterPlan;
+}
+
+bool MultipleFilterProxy::isFilterableColumn(qint32 col) const
+{
+    return col >= 0 && col < m_columnCount;
+}
+
+void MultipleFilterProxy::setPredicate(FilterPredicate &&predicate)
+{
+    const QList<FilterPredicate> previousPlan = m_filterPlan;
+    // a column holds at most one filter per role
+    m_filterPlan.removeIf(
+            [&predicate](const FilterPredicate &other) -> bool { return other.column == predicate.column && other.role == predicate.role; });
+    const auto position = std::upper_bound(m_filterPlan.begin(), m_filterPlan.end(), predicate.kind,
+                                           [](PredicateKind kind, const FilterPredicate &other) -> bool { return kind < other.kind; });
+    m_filterPlan.insert(position, std::move(predicate));
+    refilter(previousPlan);
+}
+
+bool MultipleFilterProxy::isLiteralPattern(QStringView pattern)
+{
+    return std::none_of(pattern.cbegin(), pattern.cend(), [](QChar c) -> bool { return QStringView(u"\\^$.|?*+()[]{}").contains(c); });
+}
+
+bool MultipleFilterProxy::isNarrowerOrEqual(const FilterPredicate &narrow, const FilterPredicate &wide)
+{
+    if (narrow.column != wide.column || narrow.role != wide.role || narrow.kind != wide.kind || narrow.expected != wide.expected)
+        return false;
+    switch (narrow.kind) {
+    case pkBool:
+        return true;
+    case pkValueSet:
+        return wide.values.contains(narrow.values);
+    case pkNumericRange:
+        return narrow.minValue >= wide.minValue && narrow.maxValue <= wide.maxValue;
+    case pkDateRange:
+        return narrow.minDay >= wide.minDay && narrow.maxDay <= wide.maxDay;
+    case pkSubstring:
+        if (narrow.caseSensitivity != wide.caseSensitivity)
+            return false;
+        // a longer needle matches fewer rows, a negative filter the other way round
+        if (narrow.expected)
+            return narrow.text.contains(wide.text, narrow.caseSensitivity);
+        return wide.text.contains(narrow.text, narrow.caseSensitivity);
+    case pkRegExp: {
+        if (narrow.regExp.patternOptions() != wide.regExp.patternOptions()
+            || narrow.regExp.patternOptions().testFlag(QRegularExpression::ExtendedPatternSyntaxOption))
+            return false;
+        // appending text to a literal pattern can only remove matches, after a metacharacter it could complete an escape (\x + 41, \0 + 1)
+        const QString longer = narrow.expected ? narrow.regExp.pattern() : wide.regExp.pattern();
+        const QString shorter = narrow.expected ? wide.regExp.pattern() : narrow.regExp.pattern();
+        return longer.startsWith(shorter) && isLiteralPattern(longer);
+    }
+    }
+    return false;
+}
+
+MultipleFilterProxy::RefilterMode MultipleFilterProxy::refilterDirection(const QList<FilterPredicate> &previousPlan) const
+{
+    // every predicate of the first plan is inside some predicate of the second
+    const auto containedIn = [](const QList<FilterPredicate> &inner, const QList<FilterPredicate> &outer) -> bool {
+        return std::all_of(inner.cbegin(), inner.cend(), [&outer](const FilterPredicate &innerPredicate) -> bool {
+            return std::any_of(outer.cbegin(), outer.cend(), [&innerPredicate](const FilterPredicate &outerPredicate) -> bool {
+                return isNarrowerOrEqual(innerPredicate, outerPredicate);
+            });
+        });
+    };
+    // every predicate of the second plan is tightened by some predicate of the first
+    const auto tightens = [](const QList<FilterPredicate> &narrowPlan, const QList<FilterPredicate> &widePlan) -> bool {
+        return std::all_of(widePlan.cbegin(), widePlan.cend(), [&narrowPlan](const FilterPredicate &widePredicate) -> bool {
+            return std::any_of(narrowPlan.cbegin(), narrowPlan.cend(), [&widePredicate](const FilterPredicate &narrowPredicate) -> bool {
+                return isNarrowerOrEqual(narrowPredicate, widePredicate);
+            });
+        });
+    };
+    if (requiresAllFilters()) {
+        if (tightens(m_filterPlan, previousPlan))
+            return rmNarrowing;
+        if (tightens(previousPlan, m_filterPlan))
+            return rmWidening;
+        return rmFull;
+    }
+    // without any filter every row is accepted
+    if (previousPlan.isEmpty())
+        return rmNarrowing;
+    if (m_filterPlan.isEmpty())
+        return rmWidening;
+    if (containedIn(m_filterPlan, previousPlan))
+        return rmNarrowing;
+    if (containedIn(previousPlan, m_filterPlan))
+        return rmWidening;
+    return rmFull;
+}
+
+void MultipleFilterProxy::refilter(const QList<FilterPredicate> &previousPlan)
+{
+    // a narrower plan only needs to re-test the accepted rows, a wider one only the rejected rows
+    m_refilterMode = refilterDirection(previousPlan);
+    if (m_refilterMode == rmFull)
+        m_rowStates.fill(rsUnknown);
+    // large flat sources are evaluated up front on every core, the proxy then applies the results in a single pass
+    if (evaluateInParallel())
+        m_refilterMode = rmCached;
+    m_askedRows = 0;
+    invalidateRowsFilter();
+    // rows that were not asked keep a state from the old plan
+    if (m_askedRows < m_rowStates.size())
+        clearRowStates();
+    m_refilterMode = rmFull;
+}
+
+bool MultipleFilterProxy::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+{
+    if (source_parent.isValid())
+        return acceptsRow(source_row, source_parent);
+    const int sourceRows = sourceModel()->rowCount();
+    if (m_rowStates.size() != sourceRows)
+        m_rowStates.fill(rsUnknown, sourceRows);
+    ++m_askedRows;
+    quint8 &state = m_rowStates[source_row];
+    if (m_refilterMode == rmNarrowing && state == rsRejected)
+        return false;
+    if (m_refilterMode == rmWidening && state == rsAccepted)
+        return true;
+    if (m_refilterMode == rmCached && state != rsUnknown)
+        return state == rsAccepted;
+    const bool accepted = acceptsRow(source_row, source_parent);
+    state = accepted ? rsAccepted : rsRejected;
+    return accepted;
+}
+
+qint64 MultipleFilterProxy::dayValue(const QVariant &value)
+{
+    const QDate date = value.metaType().id() == QMetaType::QDate ? value.toDate() : QDate::fromString(value.toString(), Qt::ISODate);
+    // null dates sort before every valid one, same as QDate comparisons
+    return date.isValid() ? date.toJulianDay() : std::numeric_limits<qint64>::min();
+}
+
+double MultipleFilterProxy::numberValue(const QVariant &value)
+{
+    bool isNumber = false;
+    const double number = value.toDouble(&isNumber);
+    return isNumber ? number : std::numeric_limits<double>::quiet_NaN();
+}
+
+bool MultipleFilterProxy::testDay(const FilterPredicate &predicate, qint64 day)
+{
+    return day >= predicate.minDay && day <= predicate.maxDay;
+}
+
+bool MultipleFilterProxy::testNumber(const FilterPredicate &predicate, double number)
+{
+    // NaN fails both comparisons
+    return number >= predicate.minValue && number <= predicate.maxValue;
+}
+
+bool MultipleFilterProxy::testText(const FilterPredicate &predicate, const QString &text)
+{
+    if (predicate.kind == pkSubstring)
+        return text.contains(predicate.text, predicate.caseSensitivity);
+    return predicate.regExp.match(text).hasMatch();
+}
+
+bool MultipleFilterProxy::testIdList(const FilterPredicate &predicate, const QString &idList)
+{
+    // multi valued relations are stored as comma separated ids
+    for (QStringView element : QStringView(idList).split(QLatin1Char(','))) {
+        bool isInt = false;
+        const int elementValue = element.toInt(&isInt);
+        if (isInt && predicate.values.contains(elementValue))
+            return true;
+    }
+    return false;
+}
+
+bool MultipleFilterProxy::testPredicate(const FilterPredicate &predicate, const QVariant &value)
+{
+    switch (predicate.kind) {
+    case pkBool:
+        return value.toBool();
+    case pkValueSet: {
+        bool isInt = false;
+        const int intValue = value.toInt(&isInt);
+        return isInt ? predicate.values.contains(intValue) : testIdList(predicate, value.toString());
+    }
+    case pkNumericRange:
+        return testNumber(predicate, numberValue(value));
+    case pkDateRange:
+        return testDay(predicate, dayValue(value));
+    case pkSubstring:
+    case pkRegExp:
+        return testText(predicate, value.toString());
+    }
+    Q_UNREACHABLE();
+    return false;
+}
+
+bool MultipleFilterProxy::testSnapshot(const FilterPredicate &predicate, const ColumnSnapshot &snapshot, qsizetype position)
+{
+    switch (predicate.kind) {
+    case pkBool:
+        return snapshot.ints.at(position) != 0;
+    case pkValueSet:
+        if (snapshot.hasInt.at(position))
+            return predicate.values.contains(snapshot.ints.at(position));
+        return testIdList(predicate, snapshot.texts.at(position));
+    case pkNumericRange:
+        return testNumber(predicate, snapshot.numbers.at(position));
+    case pkDateRange:
+        return testDay(predicate, snapshot.days.at(position));
+    case pkSubstring:
+    case pkRegExp:
+        return testText(predicate, snapshot.texts.at(position));
+    }
+    Q_UNREACHABLE();
+    return false;
+}
+
+MultipleFilterProxy::ColumnSnapshot MultipleFilterProxy::snapshotColumn(const FilterPredicate &predicate, const QList<int> &rows) const
+{
+    ColumnSnapshot snapshot;
+    switch (predicate.kind) {
+    case pkBool:
+        snapshot.ints.reserve(rows.size());
+        for (int row : rows)
+            snapshot.ints.append(filterValue(row, predicate.column, predicate.role, QModelIndex()).toBool() ? 1 : 0);
+        break;
+    case pkValueSet:
+        snapshot.ints.reserve(rows.size());
+        snapshot.hasInt.reserve(rows.size());
+        snapshot.texts.reserve(rows.size());
+        for (int row : rows) {
+            const QVariant value = filterValue(row, predicate.column, predicate.role, QModelIndex());
+            bool isInt = false;
+            snapshot.ints.append(value.toInt(&isInt));
+            snapshot.hasInt.append(isInt);
+            snapshot.texts.append(isInt ? QString() : value.toString());
+        }
+        break;
+    case pkNumericRange:
+        snapshot.numbers.reserve(rows.size());
+        for (int row : rows)
+            snapshot.numbers.append(numberValue(filterValue(row, predicate.column, predicate.role, QModelIndex())));
+        break;
+    case pkDateRange:
+        snapshot.days.reserve(rows.size());
+        for (int row : rows)
+            snapshot.days.append(dayValue(filterValue(row, predicate.column, predicate.role, QModelIndex())));
+        break;
+    case pkSubstring:
+    case pkRegExp:
+        snapshot.texts.reserve(rows.size());
+        for (int row : rows)
+            snapshot.texts.append(filterValue(row, predicate.column, predicate.role, QModelIndex()).toString());
+        break;
+    }
+    return snapshot;
+}
+
+bool MultipleFilterProxy::evaluateInParallel()
+{
+    const QAbstractTableModel *source = qobject_cast<const QAbstractTableModel *>(sourceModel());
+    if (!source || m_filterPlan.isEmpty())
+        return false;
+    const int sourceRows = source->rowCount();
+    if (sourceRows < PARALLEL_FILTER_MIN_ROWS)
+        return false;
+    if (m_rowStates.size() != sourceRows)
+        m_rowStates.fill(rsUnknown, sourceRows);
+    QList<int> pendingRows;
+    pendingRows.reserve(sourceRows);
+    for (int i = 0; i < sourceRows; ++i) {
+        const quint8 state = m_rowStates.at(i);
+        if ((m_refilterMode == rmNarrowing && state == rsRejected) || (m_refilterMode == rmWidening && state == rsAccepted))
+            continue;
+        pendingRows.append(i);
+    }
+    // the model can only be read on its own thread, the workers only see typed copies of the filtered columns
+    QList<ColumnSnapshot> snapshots;
+    snapshots.reserve(m_filterPlan.size());
+    for (const FilterPredicate &predicate : std::as_const(m_filterPlan))
+        snapshots.append(snapshotColumn(predicate, pendingRows));
+    QList<std::pair<qsizetype, qsizetype>> chunks;
+    for (qsizetype i = 0; i < pendingRows.size(); i += PARALLEL_FILTER_CHUNK)
+        chunks.append(std::make_pair(i, std::min<qsizetype>(i + PARALLEL_FILTER_CHUNK, pendingRows.size())));
+    QList<quint8> results(pendingRows.size(), rsUnknown);
+    quint8 *resultData = results.data();
+    const QList<FilterPredicate> &plan = m_filterPlan;
+    const bool requireAll = requiresAllFilters();
+    QtConcurrent::blockingMap(chunks, [&plan, &snapshots, resultData, requireAll](const std::pair<qsizetype, qsizetype> &chunk) {
+        for (qsizetype i = chunk.first; i < chunk.second; ++i) {
+            bool accepted = requireAll;
+            for (qsizetype j = 0, jEnd = plan.size(); j < jEnd; ++j) {
+                const bool passed = testSnapshot(plan.at(j), snapshots.at(j), i) == plan.at(j).expected;
+                // the first failure decides a conjunction, the first success a disjunction
+                if (passed != requireAll) {
+                    accepted = passed;
+                    break;
+                }
+            }
+            resultData[i] = accepted ? rsAccepted : rsRejected;
+        }
+    });
+    for (qsizetype i = 0, iEnd = pendingRows.size(); i < iEnd; ++i)
+        m_rowStates[pendingRows.at(i)] = results.at(i);
+    return true;
+}
+
+QVariant MultipleFilterProxy::filterValue(int source_row, qint32 column, qint32 role, const QModelIndex &source_parent) const
+{
+    QModelIndex valueIndex = sourceModel()->index(source_row, column, source_parent);
+    if (source_parent.isValid() && valueIndex.data().isNull())
+        valueIndex = sourceModel()->index(source_parent.row(), column, source_parent.parent());
+    return valueIndex.data(role);
 }
 
 void MultipleFilterProxy::setDateRangeFilter(qint32 col, const QDate &minDate, const QDate &maxDate, qint32 role)
 {
-    if (col < 0 || col >= m_dateRangeFilter.size())
+    if (!isFilterableColumn(col))
         return;
     if (minDate.isNull() && maxDate.isNull())
         return removeFilterFromColumn(col, role);
-    m_regExpFilter[col].remove(role);
-    m_boolFilter[col].remove(role);
-    m_dateRangeFilter[col][role] = std::make_pair(minDate, maxDate);
-    invalidateFilter();
+    FilterPredicate predicate;
+    predicate.kind = pkDateRange;
+    predicate.column = col;
+    predicate.role = role;
+    if (!minDate.isNull())
+        predicate.minDay = minDate.toJulianDay();
+    if (!maxDate.isNull())
+        predicate.maxDay = maxDate.toJulianDay();
+    setPredicate(std::move(predicate));
+}
+
+void MultipleFilterProxy::setNumericRangeFilter(qint32 col, const QVariant &minValue, const QVariant &maxValue, qint32 role)
+{
+    if (!isFilterableColumn(col))
+        return;
+    if (minValue.isNull() && maxValue.isNull())
+        return removeFilterFromColumn(col, role);
+    FilterPredicate predicate;
+    predicate.kind = pkNumericRange;
+    predicate.column = col;
+    predicate.role = role;
+    if (!minValue.isNull())
+        predicate.minValue = minValue.toDouble();
+    if (!maxValue.isNull())
+        predicate.maxValue = maxValue.toDouble();
+    setPredicate(std::move(predicate));
+}
+
+void MultipleFilterProxy::setValueFilter(qint32 col, int value, qint32 role)
+{
+    setValueFilter(col, QList<int>{value}, role);
+}
+
+void MultipleFilterProxy::setValueFilter(qint32 col, const QList<int> &values, qint32 role)
+{
+    if (!isFilterableColumn(col))
+        return;
+    if (values.isEmpty())
+        return removeFilterFromColumn(col, role);
+    FilterPredicate predicate;
+    predicate.kind = pkValueSet;
+    predicate.column = col;
+    predicate.role = role;
+    predicate.values = QSet<int>(values.cbegin(), values.cend());
+    setPredicate(std::move(predicate));
 }
 
 void MultipleFilterProxy::setRegExpFilter(qint32 col, const QRegularExpression &matcher, qint32 role)
@@ -100,14 +814,28 @@ void MultipleFilterProxy::setRegExpFilter(qint32 col, const QString &matcher, qi
 
 void MultipleFilterProxy::setRegExpFilter(qint32 col, const QRegularExpression &matcher, qint32 role, bool match)
 {
-    if (col < 0 || col >= m_dateRangeFilter.size())
+    if (!isFilterableColumn(col))
         return;
     if (matcher.pattern().isEmpty() || !matcher.isValid())
         return removeFilterFromColumn(col, role);
-    m_dateRangeFilter[col].remove(role);
-    m_boolFilter[col].remove(role);
-    m_regExpFilter[col][role] = std::make_pair(matcher, match);
-    invalidateFilter();
+    FilterPredicate predicate;
+    predicate.column = col;
+    predicate.role = role;
+    predicate.expected = match;
+    const QString pattern = matcher.pattern();
+    const QRegularExpression::PatternOptions options = matcher.patternOptions();
+    const QRegularExpression::PatternOptions literalOptions = QRegularExpression::CaseInsensitiveOption;
+    if (isLiteralPattern(pattern) && !(options & ~literalOptions)) {
+        // plain text typed in a search box does not need the regular expression engine
+        predicate.kind = pkSubstring;
+        predicate.text = pattern;
+        predicate.caseSensitivity = options.testFlag(QRegularExpression::CaseInsensitiveOption) ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    } else {
+        predicate.kind = pkRegExp;
+        predicate.regExp = matcher;
+        predicate.regExp.optimize();
+    }
+    setPredicate(std::move(predicate));
 }
 
 void MultipleFilterProxy::setNegativeRegExpFilter(qint32 col, const QRegularExpression &matcher, qint32 role)
@@ -124,112 +852,81 @@ void MultipleFilterProxy::setNegativeRegExpFilter(qint32 col, const QString &mat
 
 void MultipleFilterProxy::setBoolFilter(qint32 col, bool showWhat, qint32 role)
 {
-    if (col < 0 || col >= m_dateRangeFilter.size())
+    if (!isFilterableColumn(col))
         return;
-    m_regExpFilter[col].remove(role);
-    m_dateRangeFilter[col].remove(role);
-    m_boolFilter[col][role] = showWhat;
-    invalidateFilter();
+    FilterPredicate predicate;
+    predicate.kind = pkBool;
+    predicate.column = col;
+    predicate.role = role;
+    predicate.expected = showWhat;
+    setPredicate(std::move(predicate));
 }
 
 void MultipleFilterProxy::clearFilters()
 {
-    for (int i = 0; i < m_dateRangeFilter.size(); ++i) {
-        m_dateRangeFilter[i].clear();
-        m_regExpFilter[i].clear();
-        m_boolFilter[i].clear();
-    }
-    invalidateFilter();
+    const QList<FilterPredicate> previousPlan = m_filterPlan;
+    m_filterPlan.clear();
+    refilter(previousPlan);
 }
 
 void MultipleFilterProxy::removeFilterFromColumn(qint32 col)
 {
-    removeFilterFromColumn(m_dateRangeFilter, col);
-    removeFilterFromColumn(m_regExpFilter, col);
-    removeFilterFromColumn(m_boolFilter, col);
-    invalidateFilter();
+    const QList<FilterPredicate> previousPlan = m_filterPlan;
+    m_filterPlan.removeIf([col](const FilterPredicate &predicate) -> bool { return predicate.column == col; });
+    refilter(previousPlan);
 }
 
 void MultipleFilterProxy::removeFilterFromColumn(qint32 col, qint32 role)
 {
-    if (col < 0 || col >= m_dateRangeFilter.size())
+    if (!isFilterableColumn(col))
         return;
-    m_dateRangeFilter[col].remove(role);
-    m_regExpFilter[col].remove(role);
-    m_boolFilter[col].remove(role);
-    invalidateFilter();
+    const QList<FilterPredicate> previousPlan = m_filterPlan;
+    m_filterPlan.removeIf([col, role](const FilterPredicate &predicate) -> bool { return predicate.column == col && predicate.role == role; });
+    refilter(previousPlan);
+}
+
+bool AndFilterProxy::requiresAllFilters() const
+{
+    return true;
 }
 
-bool AndFilterProxy::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+bool AndFilterProxy::acceptsRow(int source_row, const QModelIndex &source_parent) const
 {
-    QModelIndex currntIndex = sourceModel()->index(source_row, 0, source_parent);
+    const QModelIndex currntIndex = sourceModel()->index(source_row, 0, source_parent);
     if (sourceModel()->hasChildren(currntIndex)) {
         bool result = false;
         for (int i = 0; i < sourceModel()->rowCount(currntIndex) && !result; ++i) {
             result = result || filterAcceptsRow(i, currntIndex);
         }
         return result;
-    } else {
-        for (int i = 0; i < sourceModel()->columnCount(source_parent); ++i) {
-            currntIndex = sourceModel()->index(source_row, i, source_parent);
-            if (currntIndex.data().isNull() && currntIndex.parent().isValid()) {
-                currntIndex = sourceModel()->index(source_parent.row(), i, source_parent.parent());
-            }
-            for (auto dateRngIter = m_dateRangeFilter.at(i).constBegin(); dateRngIter != m_dateRangeFilter.at(i).constEnd(); ++dateRngIter) {
-                const QVariant testDateVariant = currntIndex.data(dateRngIter.key());
-                const QDate testDate =
-                        testDateVariant.canConvert<QDate>() ? testDateVariant.toDate() : QDate::fromString(testDateVariant.toString(), Qt::ISODate);
-                if (!((testDate >= dateRngIter.value().first || dateRngIter.value().first.isNull())
-                      && (testDate <= dateRngIter.value().second || dateRngIter.value().second.isNull())))
-                    return false;
-            }
-            for (auto boolIter = m_boolFilter.at(i).constBegin(); boolIter != m_boolFilter.at(i).constEnd(); ++boolIter) {
-                const bool testBool = currntIndex.data(boolIter.key()).toBool();
-                if (testBool != boolIter.value())
-                    return false;
-            }
-            for (auto regExpIter = m_regExpFilter.at(i).constBegin(); regExpIter != m_regExpFilter.at(i).constEnd(); ++regExpIter) {
-                if (regExpIter.value().first.match(currntIndex.data(regExpIter.key()).toString()).hasMatch() != regExpIter.value().second)
-                    return false;
-            }
-        }
+    }
+    for (const FilterPredicate &predicate : filterPlan()) {
+        if (testPredicate(predicate, filterValue(source_row, predicate.column, predicate.role, source_parent)) != predicate.expected)
+            return false;
     }
     return true;
 }
 
-bool OrFilterProxy::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+bool OrFilterProxy::requiresAllFilters() const
+{
+    return false;
+}
+
+bool OrFilterProxy::acceptsRow(int source_row, const QModelIndex &source_parent) const
 {
-    QModelIndex currntIndex = sourceModel()->index(source_row, 0, source_parent);
+    const QModelIndex currntIndex = sourceModel()->index(source_row, 0, source_parent);
     if (sourceModel()->hasChildren(currntIndex)) {
         bool result = false;
         for (int i = 0; i < sourceModel()->rowCount(currntIndex) && !result; ++i) {
             result = result || filterAcceptsRow(i, currntIndex);
         }
         return result;
-    } else {
-        if (!hasAnyFilter())
+    }
+    if (!hasAnyFilter())
+        return true;
+    for (const FilterPredicate &predicate : filterPlan()) {
+        if (testPredicate(predicate, filterValue(source_row, predicate.column, predicate.role, source_parent)) == predicate.expected)
             return true;
-        for (int i = 0; i < sourceModel()->columnCount(source_parent); ++i) {
-            currntIndex = sourceModel()->index(source_row, i, source_parent);
-            if (currntIndex.data().isNull() && currntIndex.parent().isValid()) {
-                currntIndex = sourceModel()->index(source_parent.row(), i, source_parent.parent());
-            }
-            for (auto dateRngIter = m_dateRangeFilter.at(i).constBegin(); dateRngIter != m_dateRangeFilter.at(i).constEnd(); ++dateRngIter) {
-                const QDate testDate = currntIndex.data(dateRngIter.key()).toDate();
-                if (((testDate >= dateRngIter.value().first || dateRngIter.value().first.isNull())
-                     && (testDate <= dateRngIter.value().second || dateRngIter.value().second.isNull())))
-                    return true;
-            }
-            for (auto boolIter = m_boolFilter.at(i).constBegin(); boolIter != m_boolFilter.at(i).constEnd(); ++boolIter) {
-                const bool testBool = currntIndex.data(boolIter.key()).toBool();
-                if (testBool == boolIter.value())
-                    return true;
-            }
-            for (auto regExpIter = m_regExpFilter.at(i).constBegin(); regExpIter != m_regExpFilter.at(i).constEnd(); ++regExpIter) {
-                if (regExpIter.value().first.match(currntIndex.data(regExpIter.key()).toString()).hasMatch() == regExpIter.value().second)
-                    return true;
-            }
-        }
     }
     return false;
 }
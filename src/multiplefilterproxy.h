@@ -14,8 +14,10 @@
 #define MULTIPLEFILTERPROXY_H
 
 #include <QSortFilterProxyModel>
-#include <QPair>
-#include <QHash>
+#include <QCollator>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
 #include <QDate>
 #include <QRegularExpression>
 class MultipleFilterProxy : public QSortFilterProxyModel
@@ -28,6 +30,9 @@ public:
     explicit MultipleFilterProxy(QObject *parent = nullptr);
     ~MultipleFilterProxy();
     virtual void setDateRangeFilter(qint32 col, const QDate &minDate, const QDate &maxDate, qint32 role = Qt::DisplayRole);
+    virtual void setNumericRangeFilter(qint32 col, const QVariant &minValue, const QVariant &maxValue, qint32 role = Qt::DisplayRole);
+    virtual void setValueFilter(qint32 col, int value, qint32 role = Qt::DisplayRole);
+    virtual void setValueFilter(qint32 col, const QList<int> &values, qint32 role = Qt::DisplayRole);
     virtual void setRegExpFilter(qint32 col, const QRegularExpression &matcher, qint32 role = Qt::DisplayRole);
     virtual void setRegExpFilter(qint32 col, const QString &matcher, qint32 role = Qt::DisplayRole);
     virtual void setNegativeRegExpFilter(qint32 col, const QRegularExpression &matcher, qint32 role = Qt::DisplayRole);
@@ -37,25 +42,109 @@ public:
     virtual void removeFilterFromColumn(qint32 col, qint32 role);
     virtual void removeFilterFromColumn(qint32 col);
     void setSourceModel(QAbstractItemModel *mdl) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+    bool isSuspended() const;
+    void setSuspended(bool suspended);
 
 private:
     void onColumnsInserted(const QModelIndex &parent, int first, int last);
     void onModelReset(QAbstractItemModel *mdl);
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void onRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    void onRowsReordered();
 
 protected:
+    // ordered from the cheapest to the most expensive test, the plan is evaluated in this order
+    enum PredicateKind : quint8 { pkBool, pkValueSet, pkNumericRange, pkDateRange, pkSubstring, pkRegExp };
+    struct FilterPredicate
+    {
+        FilterPredicate();
+        PredicateKind kind;
+        bool expected;
+        qint32 column;
+        qint32 role;
+        qint64 minDay;
+        qint64 maxDay;
+        double minValue;
+        double maxValue;
+        QSet<int> values;
+        QString text;
+        Qt::CaseSensitivity caseSensitivity;
+        QRegularExpression regExp;
+    };
     bool hasAnyFilter() const;
-    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override = 0;
-    template<class T>
-    void removeFilterFromColumn(QList<QHash<qint32, T>> &filter, qint32 col)
+    const QList<FilterPredicate> &filterPlan() const;
+    static bool testPredicate(const FilterPredicate &predicate, const QVariant &value);
+    static qint64 dayValue(const QVariant &value);
+    static double numberValue(const QVariant &value);
+    QVariant filterValue(int source_row, qint32 column, qint32 role, const QModelIndex &source_parent) const;
+    // keys compare by kind first, then by number and last by collated text
+    enum SortKeyKind : quint8 { skNumber, skText, skInvalid };
+    struct SortKey
+    {
+        SortKey();
+        SortKeyKind kind;
+        double number;
+        QString text;
+    };
+    virtual SortKey sortKey(int source_row, qint32 column, const QModelIndex &source_parent) const;
+    bool lessThan(const QModelIndex &source_left, const QModelIndex &source_right) const override;
+    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override;
+    virtual bool acceptsRow(int source_row, const QModelIndex &source_parent) const = 0;
+    virtual bool requiresAllFilters() const = 0;
+
+private:
+    enum RefilterMode : quint8 { rmFull, rmNarrowing, rmWidening, rmCached };
+    enum RowState : quint8 { rsUnknown, rsAccepted, rsRejected };
+    struct ColumnSnapshot
+    {
+        QList<int> ints;
+        QList<bool> hasInt;
+        QList<double> numbers;
+        QList<qint64> days;
+        QStringList texts;
+    };
+    struct CachedSortKey
     {
-        if (col < 0 || col >= filter.size())
-            return;
-        filter[col].clear();
-    }
-    QList<QHash<qint32, std::pair<QDate, QDate>>> m_dateRangeFilter;
-    QList<QHash<qint32, std::pair<QRegularExpression, bool>>> m_regExpFilter;
-    QList<QHash<qint32, bool>> m_boolFilter;
+        CachedSortKey();
+        SortKeyKind kind;
+        bool stale;
+        double number;
+        qsizetype text;
+    };
+    static bool testDay(const FilterPredicate &predicate, qint64 day);
+    static bool testNumber(const FilterPredicate &predicate, double number);
+    static bool testText(const FilterPredicate &predicate, const QString &text);
+    static bool testIdList(const FilterPredicate &predicate, const QString &idList);
+    static bool testSnapshot(const FilterPredicate &predicate, const ColumnSnapshot &snapshot, qsizetype position);
+    static bool isLiteralPattern(QStringView pattern);
+    static bool isNarrowerOrEqual(const FilterPredicate &narrow, const FilterPredicate &wide);
+    RefilterMode refilterDirection(const QList<FilterPredicate> &previousPlan) const;
+    void refilter(const QList<FilterPredicate> &previousPlan);
+    bool evaluateInParallel();
+    ColumnSnapshot snapshotColumn(const FilterPredicate &predicate, const QList<int> &rows) const;
+    bool isFilterableColumn(qint32 col) const;
+    void setPredicate(FilterPredicate &&predicate);
+    void clearRowStates();
+    void clearSortKeys();
+    void prepareSortKeys(qint32 column) const;
+    void refreshSortKey(int row) const;
+    void refreshSortKeys();
+    int compareSortKeys(int leftRow, int rightRow) const;
+    void rankSortKeys();
+    QList<FilterPredicate> m_filterPlan;
     QList<QMetaObject::Connection> m_sourceConnections;
+    QPointer<QAbstractItemModel> m_suspendedSource;
+    int m_columnCount;
+    RefilterMode m_refilterMode;
+    mutable QList<quint8> m_rowStates;
+    mutable int m_askedRows;
+    QCollator m_collator;
+    mutable qint32 m_sortKeyColumn;
+    mutable QList<CachedSortKey> m_sortKeys;
+    mutable QList<QCollatorSortKey> m_textKeys;
+    mutable QList<int> m_sortRanks;
 };
 
 class AndFilterProxy : public MultipleFilterProxy
@@ -65,7 +154,8 @@ public:
     using MultipleFilterProxy::MultipleFilterProxy;
 
 protected:
-    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override;
+    bool acceptsRow(int source_row, const QModelIndex &source_parent) const override;
+    bool requiresAllFilters() const override;
 };
 class OrFilterProxy : public MultipleFilterProxy
 {
@@ -74,7 +164,8 @@ public:
     using MultipleFilterProxy::MultipleFilterProxy;
 
 protected:
-    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override;
+    bool acceptsRow(int source_row, const QModelIndex &source_parent) const override;
+    bool requiresAllFilters() const override;
 };
 
 #endif // MULTIPLEFILTERPROXY_H
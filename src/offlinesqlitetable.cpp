@@ -11,76 +11,200 @@
    limitations under the License.
 \****************************************************************************/
 #include "offlinesqlitetable.h"
+#include "databaseactor.h"
 #include "globals.h"
 #include <QSqlDriver>
+#include <QSqlError>
 #include <QSqlRecord>
-#ifdef QT_DEBUG
-#    include <QSqlError>
-#endif
+#include <QSet>
+#include <QTimer>
+#include <QtConcurrent>
+#include <algorithm>
+#include <numeric>
+#define WRITE_BEHIND_IDLE_INTERVAL 200
+#define WRITE_BEHIND_MAX_DELAY 2000
+#define MAX_REMOVED_RANGES 64
+#define INTERRUPT_CHECK_ROWS 1024
 OfflineSqliteTable::OfflineSqliteTable(QObject *parent)
     : QAbstractTableModel(parent)
     , m_colCount(0)
     , m_rowCount(0)
     , m_needTableInfo(true)
+    , m_needSelect(false)
+    , m_fetchComplete(false)
+    , m_cacheUnfiltered(false)
+    , m_fetchGeneration(0)
+    , m_fetchChunkSize(0)
+    , m_writeBehind(false)
+    , m_flushTimer(new QTimer(this))
+    , m_flushSerial(0)
+    , m_editSerial(0)
     , m_sortColumn(-1)
     , m_sortOrder(Qt::AscendingOrder)
-{ }
+{
+    m_flushTimer->setSingleShot(true);
+    m_flushTimer->setInterval(WRITE_BEHIND_IDLE_INTERVAL);
+    connect(m_flushTimer, &QTimer::timeout, this, &OfflineSqliteTable::startFlush);
+}
 
 bool OfflineSqliteTable::removeRows(int row, int count, const QModelIndex &parent)
 {
     if (parent.isValid() || row < 0 || row + count - 1 >= m_rowCount)
         return false;
+    materializeRows();
     const bool hasPk = hasPrimaryKey();
-    QSqlDatabase db = openDb();
-    if (!db.isValid() || !db.isOpen())
-        return false;
-    QString removeQueryString =
-            QLatin1String("DELETE FROM ") + db.driver()->escapeIdentifier(m_tableName, QSqlDriver::TableName) + QLatin1String(" WHERE ");
     const int colCount = m_colCount;
-    bool firstRow = true;
-    for (int h = 0; h < count; ++h) {
-        if (!firstRow)
-            removeQueryString += QLatin1String(" OR ");
-        firstRow = false;
-        bool firstField = true;
-        removeQueryString += QLatin1Char('(');
-        for (int i = 0; i < colCount; ++i) {
-            if (hasPk && !m_fields.at(i).isPrimaryKey)
-                continue;
-            if (!firstField)
-                removeQueryString += QLatin1String("AND ");
-            firstField = false;
-            removeQueryString += db.driver()->escapeIdentifier(m_fields.at(i).fieldName, QSqlDriver::FieldName);
-            if (index(row + h, i).data().isValid())
-                removeQueryString += QLatin1String("=? ");
-            else
-                removeQueryString += QLatin1String(" IS NULL ");
+    QStringList keyFields;
+    int keyColumn = -1;
+    for (int i = 0; i < colCount; ++i) {
+        if (!hasPk || m_fields.at(i).isPrimaryKey) {
+            keyFields.append(m_fields.at(i).fieldName);
+            keyColumn = i;
         }
-        removeQueryString += QLatin1Char(')');
     }
-    QSqlQuery removeQuery(db);
-    removeQuery.prepare(removeQueryString);
+    // a single integer primary key can never be null so it can be bound as a set of ids
+    const bool integerKey = hasPk && keyFields.size() == 1 && m_fields.at(keyColumn).fieldType == QMetaType::Int;
+    QList<QVariantList> keyValues;
+    keyValues.reserve(count);
     for (int h = 0; h < count; ++h) {
+        QVariantList rowKeys;
         for (int i = 0; i < colCount; ++i) {
-            if (hasPk && !m_fields.at(i).isPrimaryKey)
-                continue;
-            const QVariant currData = index(row + h, i).data();
-            if (currData.isValid())
-                removeQuery.addBindValue(currData);
+            if (!hasPk || m_fields.at(i).isPrimaryKey)
+                rowKeys.append(index(row + h, i).data());
         }
+        keyValues.append(rowKeys);
     }
-    if (!db.transaction()) // dry run to make sure query runs before calling beginRemoveRows
+    // the rows leave the model straight away, if the statement fails the cache is read again from the file
+    ++m_editSerial;
+    DatabaseActor::run([tableName = m_tableName, keyFields, keyValues, integerKey]() -> bool {
+        return deleteRows(tableName, keyFields, keyValues, integerKey);
+    }).then(this, [this, count](bool removed) { finishRemoveRows(count, removed); });
+    QList<int> newRows(m_data.size() / colCount);
+    for (qsizetype i = 0, maxI = newRows.size(); i < maxI; ++i)
+        newRows[i] = i < row ? i : (i < row + count ? -1 : i - count);
+    moveCachedEdits(newRows);
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    m_data.erase(m_data.begin() + (row * colCount), m_data.begin() + ((row + count) * colCount));
+    m_rowCount -= count;
+    endRemoveRows();
+    return true;
+}
+
+void OfflineSqliteTable::finishRemoveRows(int count, bool removed)
+{
+    if (removed)
+        return;
+    // the savepoint kept the rows in the file, they come back with the next read
+    invalidate();
+    prefetch();
+    Q_EMIT editsRejected(count);
+}
+
+bool OfflineSqliteTable::deleteRows(const QString &tableName, const QStringList &keyFields, const QList<QVariantList> &keyValues, bool integerKey)
+{
+    QSqlDatabase db = openDb();
+    if (!db.isValid() || !db.isOpen())
+        return false;
+    Savepoint savepoint(db, QStringLiteral("RemoveRows"));
+    if (!savepoint.isActive())
         return false;
+    const QString escapedTable = db.driver()->escapeIdentifier(tableName, QSqlDriver::TableName);
+    QSqlQuery removeQuery(db);
+    if (integerKey) {
+        QVariantList boundIds;
+        boundIds.reserve(keyValues.size());
+        for (const QVariantList &rowKeys : keyValues)
+            boundIds.append(rowKeys.first());
+        if (!fillBoundIds(db, boundIds))
+            return false;
+        removeQuery.prepare(QLatin1String("DELETE FROM ") + escapedTable + QLatin1String(" WHERE ")
+                            + db.driver()->escapeIdentifier(keyFields.first(), QSqlDriver::FieldName)
+                            + QLatin1String(" IN (SELECT Id FROM temp.BoundIds)"));
+    } else {
+        QString removeQueryString = QLatin1String("DELETE FROM ") + escapedTable + QLatin1String(" WHERE ");
+        bool firstRow = true;
+        for (const QVariantList &rowKeys : keyValues) {
+            if (!firstRow)
+                removeQueryString += QLatin1String(" OR ");
+            firstRow = false;
+            removeQueryString += QLatin1Char('(');
+            for (qsizetype i = 0, maxI = keyFields.size(); i < maxI; ++i) {
+                if (i > 0)
+                    removeQueryString += QLatin1String("AND ");
+                removeQueryString += db.driver()->escapeIdentifier(keyFields.at(i), QSqlDriver::FieldName);
+                if (rowKeys.at(i).isValid())
+                    removeQueryString += QLatin1String("=? ");
+                else
+                    removeQueryString += QLatin1String(" IS NULL ");
+            }
+            removeQueryString += QLatin1Char(')');
+        }
+        removeQuery.prepare(removeQueryString);
+        for (const QVariantList &rowKeys : keyValues) {
+            for (const QVariant &key : rowKeys) {
+                if (key.isValid())
+                    removeQuery.addBindValue(key);
+            }
+        }
+    }
     if (!removeQuery.exec()) {
 #ifdef QT_DEBUG
         qDebug().noquote() << removeQuery.executedQuery() << removeQuery.lastError().text();
 #endif
         return false;
     }
-    CHECK_TRUE(db.rollback());
-    beginRemoveRows(QModelIndex(), row, row + count - 1);
-    CHECK_TRUE(removeQuery.exec());
-    endRemoveRows();
+    return savepoint.release();
+}
+
+bool OfflineSqliteTable::removeCachedRows(int keyColumn, const QList<int> &keys)
+{
+    // rows still streaming in could come from before the delete, only a complete cache can be patched
+    if (m_needSelect)
+        return true;
+    if (!m_fetchComplete || keyColumn < 0 || keyColumn >= m_colCount)
+        return false;
+    materializeRows();
+    const QSet<int> keySet(keys.cbegin(), keys.cend());
+    QList<std::pair<int, int>> ranges;
+    QList<int> newRows(m_rowCount);
+    int keptRows = 0;
+    for (int row = 0; row < m_rowCount; ++row) {
+        if (!keySet.contains(m_data.at((row * m_colCount) + keyColumn).toInt())) {
+            newRows[row] = keptRows++;
+            continue;
+        }
+        newRows[row] = -1;
+        if (!ranges.isEmpty() && ranges.last().second == row - 1)
+            ranges.last().second = row;
+        else
+            ranges.append(std::make_pair(row, row));
+    }
+    if (ranges.isEmpty())
+        return true;
+    moveCachedEdits(newRows);
+    if (ranges.size() > MAX_REMOVED_RANGES) {
+        // scattered rows are compacted in one pass, a reset is cheaper than thousands of removal signals
+        beginResetModel();
+        QVariantList keptData;
+        keptData.reserve(m_data.size());
+        int lastEnd = 0;
+        for (const std::pair<int, int> &range : std::as_const(ranges)) {
+            keptData.append(m_data.mid(lastEnd * m_colCount, (range.first - lastEnd) * m_colCount));
+            lastEnd = range.second + 1;
+        }
+        keptData.append(m_data.mid(lastEnd * m_colCount));
+        m_rowCount = keptData.size() / m_colCount;
+        m_data = std::move(keptData);
+        endResetModel();
+        return true;
+    }
+    // from the bottom up so the ranges still to be removed keep their position
+    for (auto i = ranges.crbegin(), iEnd = ranges.crend(); i != iEnd; ++i) {
+        beginRemoveRows(QModelIndex(), i->first, i->second);
+        m_data.erase(m_data.begin() + (i->first * m_colCount), m_data.begin() + ((i->second + 1) * m_colCount));
+        m_rowCount -= i->second - i->first + 1;
+        endRemoveRows();
+    }
     return true;
 }
 
@@ -90,61 +214,207 @@ bool OfflineSqliteTable::setData(const QModelIndex &index, const QVariant &value
         return false;
     if (role != Qt::DisplayRole && role != Qt::EditRole)
         return false;
-    QSqlDatabase db = openDb();
-    if (!db.isValid() || !db.isOpen())
-        return false;
-    QString updateQueryString = QLatin1String("UPDATE ") + db.driver()->escapeIdentifier(m_tableName, QSqlDriver::TableName) + QLatin1String(" SET ")
-            + db.driver()->escapeIdentifier(m_fields.at(index.column()).fieldName, QSqlDriver::FieldName) + QLatin1String("=");
-    if (value.isValid())
-        updateQueryString += QLatin1Char('?');
-    else
-        updateQueryString += QLatin1String("NULL");
-    updateQueryString += QLatin1String(" WHERE ");
+    QVariant boundValue = value;
+    if (value.isValid()) {
+        if (value.typeId() != m_fields.at(index.column()).fieldType && !boundValue.convert(QMetaType(m_fields.at(index.column()).fieldType)))
+            return false;
+    } else {
+        if (!m_fields.at(index.column()).allowNull)
+            return false;
+    }
     const bool hasPk = hasPrimaryKey();
-    bool firstField = true;
     const int colCount = m_colCount;
+    QStringList keyFields;
+    QVariantList keyValues;
     for (int i = 0; i < colCount; ++i) {
         if (hasPk && !m_fields.at(i).isPrimaryKey)
             continue;
-        if (!firstField)
+        keyFields.append(m_fields.at(i).fieldName);
+        keyValues.append(data(index.sibling(index.row(), i)));
+    }
+    const QString fieldName = m_fields.at(index.column()).fieldName;
+    // reads started before this edit cannot be trusted to contain it
+    ++m_editSerial;
+    // the cache answers straight away, the file catches up when the buffer is flushed.
+    // the edit remembers its position in the cache, sorting and in memory filters only move the visible rows around
+    PendingEdit edit;
+    edit.cachedRow = dataRow(index.row());
+    edit.column = index.column();
+    edit.fieldName = fieldName;
+    edit.keyFields = keyFields;
+    edit.keyValues = keyValues;
+    edit.value = boundValue;
+    edit.previousValue = data(index);
+    m_pendingEdits.append(edit);
+    setInternalData(index, value);
+    // without write behind the edit is written right away, a failure reverts it like a rejected batch
+    if (m_writeBehind)
+        scheduleFlush();
+    else
+        startFlush();
+    return true;
+}
+
+bool OfflineSqliteTable::updateRow(const QSqlDatabase &db, const QString &tableName, const QString &fieldName, const QVariant &value,
+                                   const QStringList &keyFields, const QVariantList &keyValues)
+{
+    QString updateQueryString = QLatin1String("UPDATE ") + db.driver()->escapeIdentifier(tableName, QSqlDriver::TableName) + QLatin1String(" SET ")
+            + db.driver()->escapeIdentifier(fieldName, QSqlDriver::FieldName) + QLatin1String("=");
+    if (value.isValid())
+        updateQueryString += QLatin1Char('?');
+    else
+        updateQueryString += QLatin1String("NULL");
+    updateQueryString += QLatin1String(" WHERE ");
+    for (qsizetype i = 0, maxI = keyFields.size(); i < maxI; ++i) {
+        if (i > 0)
             updateQueryString += QLatin1String("AND ");
-        firstField = false;
-        updateQueryString += db.driver()->escapeIdentifier(m_fields.at(i).fieldName, QSqlDriver::FieldName);
-        if (data(index.sibling(index.row(), i)).isValid())
+        updateQueryString += db.driver()->escapeIdentifier(keyFields.at(i), QSqlDriver::FieldName);
+        if (keyValues.at(i).isValid())
             updateQueryString += QLatin1String("=? ");
         else
             updateQueryString += QLatin1String(" IS NULL ");
     }
     QSqlQuery updateQuery(db);
     updateQuery.prepare(updateQueryString);
-    if (value.isValid()) {
-        if (value.typeId() == m_fields.at(index.column()).fieldType) {
-            updateQuery.addBindValue(value);
-        } else {
-            QVariant valueCopy = value;
-            if (!valueCopy.convert(QMetaType(m_fields.at(index.column()).fieldType)))
-                return false;
-            updateQuery.addBindValue(valueCopy);
-        }
-    } else {
-        if (!m_fields.at(index.column()).allowNull)
+    if (value.isValid())
+        updateQuery.addBindValue(value);
+    for (const QVariant &key : keyValues) {
+        if (key.isValid())
+            updateQuery.addBindValue(key);
+    }
+    if (!updateQuery.exec()) {
+#ifdef QT_DEBUG
+        qDebug().noquote() << updateQuery.executedQuery() << updateQuery.lastError().text();
+#endif
+        return false;
+    }
+    return true;
+}
+
+bool OfflineSqliteTable::writeEdits(const QString &tableName, const QList<PendingEdit> &edits)
+{
+    QSqlDatabase db = openDb();
+    if (!db.isValid() || !db.isOpen())
+        return false;
+    if (!db.transaction())
+        return false;
+    // a row deleted since its edit was buffered just matches nothing, the edit goes away with the row
+    for (const PendingEdit &edit : edits) {
+        if (!updateRow(db, tableName, edit.fieldName, edit.value, edit.keyFields, edit.keyValues)) {
+            CHECK_TRUE(db.rollback());
             return false;
+        }
     }
-    for (int i = 0; i < colCount; ++i) {
-        if (hasPk && !m_fields.at(i).isPrimaryKey)
-            continue;
-        const QVariant currData = data(index.sibling(index.row(), i));
-        if (currData.isValid())
-            updateQuery.addBindValue(currData);
+    return db.commit();
+}
+
+bool OfflineSqliteTable::writeBehind() const
+{
+    return m_writeBehind;
+}
+
+void OfflineSqliteTable::setWriteBehind(bool enabled)
+{
+    if (m_writeBehind == enabled)
+        return;
+    if (!enabled)
+        flushEdits();
+    m_writeBehind = enabled;
+}
+
+bool OfflineSqliteTable::hasPendingEdits() const
+{
+    return !m_pendingEdits.isEmpty() || !m_flushingEdits.isEmpty();
+}
+
+void OfflineSqliteTable::scheduleFlush()
+{
+    // edits are flushed once editing pauses, a steady stream of edits is still written every few seconds
+    if (m_pendingEdits.size() == 1)
+        m_pendingSince.start();
+    if (m_pendingSince.elapsed() >= WRITE_BEHIND_MAX_DELAY)
+        startFlush();
+    else
+        m_flushTimer->start();
+}
+
+void OfflineSqliteTable::startFlush()
+{
+    m_flushTimer->stop();
+    // a batch still being written reschedules the rest when it completes
+    if (m_pendingEdits.isEmpty() || !m_flushingEdits.isEmpty())
+        return;
+    m_flushingEdits = std::exchange(m_pendingEdits, QList<PendingEdit>());
+    const quint64 serial = m_flushSerial;
+    m_flushFuture = DatabaseActor::run([tableName = m_tableName, edits = m_flushingEdits]() -> bool { return writeEdits(tableName, edits); });
+    m_flushFuture.then(this, [this, serial](bool flushed) { finishFlush(serial, flushed); });
+}
+
+bool OfflineSqliteTable::flushEdits()
+{
+    m_flushTimer->stop();
+    bool flushed = true;
+    if (!m_flushingEdits.isEmpty()) {
+        flushed = m_flushFuture.result();
+        finishFlush(m_flushSerial, flushed);
     }
-    if (updateQuery.exec()) {
-        setInternalData(index, value);
-        return true;
+    if (m_pendingEdits.isEmpty())
+        return flushed;
+    m_flushingEdits = std::exchange(m_pendingEdits, QList<PendingEdit>());
+    const QString tableName = m_tableName;
+    const QList<PendingEdit> edits = m_flushingEdits;
+    const bool written = DatabaseActor::runBlocking([tableName, edits]() -> bool { return writeEdits(tableName, edits); });
+    finishFlush(m_flushSerial, written);
+    return flushed && written;
+}
+
+void OfflineSqliteTable::finishFlush(quint64 serial, bool flushed)
+{
+    // flushEdits already handled this batch
+    if (serial != m_flushSerial)
+        return;
+    ++m_flushSerial;
+    const QList<PendingEdit> edits = std::exchange(m_flushingEdits, QList<PendingEdit>());
+    if (!flushed) {
+        // the whole batch was rolled back in the file so the cache goes back to what the file holds
+        for (auto i = edits.crbegin(), iEnd = edits.crend(); i != iEnd; ++i) {
+            const auto laterEdit = std::find_if(m_pendingEdits.begin(), m_pendingEdits.end(), [i](const PendingEdit &pending) -> bool {
+                return i->cachedRow >= 0 && pending.cachedRow == i->cachedRow && pending.column == i->column;
+            });
+            if (laterEdit != m_pendingEdits.end())
+                laterEdit->previousValue = i->previousValue;
+            else
+                restoreCachedValue(i->cachedRow, i->column, i->previousValue);
+        }
+        Q_EMIT editsRejected(edits.size());
     }
-#ifdef QT_DEBUG
-    qDebug().noquote() << updateQuery.executedQuery() << updateQuery.lastError().text();
-#endif
-    return false;
+    if (m_pendingEdits.isEmpty())
+        return;
+    if (m_writeBehind)
+        scheduleFlush();
+    else
+        startFlush();
+}
+
+void OfflineSqliteTable::moveCachedEdits(const QList<int> &newRows)
+{
+    // buffered edits follow their row when the cache is rearranged, rows that left it can no longer be reverted on screen
+    for (QList<PendingEdit> *edits : {&m_pendingEdits, &m_flushingEdits}) {
+        for (PendingEdit &edit : *edits)
+            edit.cachedRow = edit.cachedRow >= 0 && edit.cachedRow < newRows.size() ? newRows.at(edit.cachedRow) : -1;
+    }
+}
+
+void OfflineSqliteTable::restoreCachedValue(int cachedRow, int column, const QVariant &value)
+{
+    // every path that replaces the cache flushes first, a batch can only outlive it if it was superseded
+    if (cachedRow < 0 || ((cachedRow + 1) * m_colCount) > m_data.size())
+        return;
+    const int row = m_rowMap.isEmpty() && m_visibleRows.isEmpty() ? cachedRow : m_rowMap.indexOf(cachedRow);
+    if (row >= 0)
+        setInternalData(index(row, column), value);
+    else
+        m_data[(cachedRow * m_colCount) + column] = value;
 }
 
 Qt::ItemFlags OfflineSqliteTable::flags(const QModelIndex &index) const
@@ -164,46 +434,516 @@ QString OfflineSqliteTable::filter() const
     return m_filter;
 }
 
-QSqlQuery OfflineSqliteTable::createQuery() const
+QString OfflineSqliteTable::selectStatement(const QSqlDatabase &db, const QString &tableName, const QString &filter, const QList<FiledInfo> &fields,
+                                            int sortColumn, Qt::SortOrder sortOrder)
 {
-    QSqlDatabase db = openDb();
-    if (!db.isValid() || !db.isOpen())
-        return QSqlQuery();
-    QString queryString = QLatin1String("SELECT * FROM ") + db.driver()->escapeIdentifier(m_tableName, QSqlDriver::TableName);
-    if (!m_filter.isEmpty())
-        queryString += QLatin1String(" WHERE ") + m_filter;
-    if (m_sortColumn >= 0 && m_sortColumn < m_colCount) {
-        queryString += QLatin1String(" ORDER BY ") + db.driver()->escapeIdentifier(m_fields.at(m_sortColumn).fieldName, QSqlDriver::FieldName);
-        if (m_sortOrder == Qt::AscendingOrder)
+    QString queryString = QLatin1String("SELECT * FROM ") + db.driver()->escapeIdentifier(tableName, QSqlDriver::TableName);
+    if (!filter.isEmpty())
+        queryString += QLatin1String(" WHERE ") + filter;
+    if (sortColumn >= 0 && sortColumn < fields.size()) {
+        queryString += QLatin1String(" ORDER BY ") + db.driver()->escapeIdentifier(fields.at(sortColumn).fieldName, QSqlDriver::FieldName);
+        if (sortOrder == Qt::AscendingOrder)
             queryString += QLatin1String(" ASC");
         else
             queryString += QLatin1String(" DESC");
     }
-    QSqlQuery selectQuery(db);
-    selectQuery.prepare(queryString);
-    return selectQuery;
+    return queryString;
+}
+
+OfflineSqliteTable::RowChunk OfflineSqliteTable::readFirstChunk() const
+{
+    const std::shared_ptr<QSqlQuery> cachedQuery = m_query;
+    const QString tableName = m_tableName;
+    const QString filter = m_filter;
+    const QList<FiledInfo> fields = m_fields;
+    const int sortColumn = m_sortColumn;
+    const Qt::SortOrder sortOrder = m_sortOrder;
+    const int colCount = m_colCount;
+    const int chunkSize = m_fetchChunkSize;
+    return DatabaseActor::runBlocking([cachedQuery, tableName, filter, fields, sortColumn, sortOrder, colCount, chunkSize]() -> RowChunk {
+        RowChunk chunk;
+        chunk.query = cachedQuery;
+        chunk.rowCount = 0;
+        chunk.complete = true;
+        chunk.valid = false;
+        if (!chunk.query) {
+            QSqlDatabase db = openDb();
+            if (!db.isValid() || !db.isOpen())
+                return chunk;
+            chunk.query = std::make_shared<QSqlQuery>(db);
+            chunk.query->setForwardOnly(chunkSize > 0);
+            chunk.query->prepare(selectStatement(db, tableName, filter, fields, sortColumn, sortOrder));
+        }
+        if (chunkSize <= 0) {
+            chunk.valid = readRows(*chunk.query, colCount, &chunk.data, &chunk.rowCount);
+            return chunk;
+        }
+        if (!chunk.query->exec()) {
+#ifdef QT_DEBUG
+            qDebug() << chunk.query->executedQuery() << chunk.query->lastError().text();
+#endif
+            return chunk;
+        }
+        chunk.valid = readChunk(*chunk.query, colCount, chunkSize, &chunk.data, &chunk.rowCount, &chunk.complete);
+        return chunk;
+    });
+}
+
+void OfflineSqliteTable::releaseQuery()
+{
+    if (!m_query)
+        return;
+    // statements belong to the connection of the database thread and are finalized there
+    DatabaseActor::run([query = std::move(m_query)]() { *query = QSqlQuery(); });
+    m_query.reset();
 }
 
 void OfflineSqliteTable::setTable(const QString &tableName)
 {
-    const bool refreshStructure = m_tableName != tableName;
+    if (m_tableName != tableName)
+        m_needTableInfo = true;
     m_tableName = tableName;
-    if (refreshStructure || m_needTableInfo)
-        getTableStructure();
-    setQuery(createQuery());
+    releaseQuery();
+    invalidate();
 }
 
 void OfflineSqliteTable::setFilter(const QString &filter)
 {
+    if (m_filterInterrupter)
+        m_filterInterrupter->interrupt();
     m_filter = filter;
-    setQuery(createQuery());
+    releaseQuery();
+    if (!filterInMemory())
+        invalidate();
+}
+
+void OfflineSqliteTable::setFilterInBackground(const QString &filter)
+{
+    // nothing on screen to keep or other connections cannot see an in memory budget
+    if (m_needSelect || m_tableName.isEmpty() || isMemoryDb())
+        return setFilter(filter);
+    if (m_filterInterrupter)
+        m_filterInterrupter->interrupt();
+    flushEdits();
+    m_filter = filter;
+    releaseQuery();
+    // the current rows stay visible until the new ones are ready, any other read started meanwhile supersedes this one
+    const quint64 generation = ++m_fetchGeneration;
+    const quint64 editSerial = m_editSerial;
+    if (canFilterInMemory()) {
+        m_filterInterrupter.reset();
+        if (m_filter.isEmpty()) {
+            m_visibleRows = QBitArray();
+            updateRowMap();
+            return;
+        }
+        // only the keys of the matching rows travel back, the cached rows are reused as they are
+        m_filterInterrupter = std::make_shared<QueryInterrupter>();
+        m_keysFuture = QtConcurrent::run(&OfflineSqliteTable::readKeySnapshot, dbFilePath(), m_tableName,
+                                         m_fields.at(integerKeyColumn()).fieldName, m_filter, m_filterInterrupter);
+        m_keysFuture.then(this, [this, generation, editSerial](const KeySelection &selection) {
+            if (generation != m_fetchGeneration)
+                return;
+            m_filterInterrupter.reset();
+            // rows edited while the keys were read might match differently now, they are picked again from the flushed file
+            if (editSerial != m_editSerial) {
+                if (!filterInMemory())
+                    invalidate();
+                return;
+            }
+            if (selection.valid && canFilterInMemory())
+                selectKeys(selection.keys);
+            else
+                invalidate();
+        });
+        return;
+    }
+    m_filterInterrupter = std::make_shared<QueryInterrupter>();
+    m_filterFuture = QtConcurrent::run(&OfflineSqliteTable::readTableSnapshot, dbFilePath(), m_tableName, m_filter, m_sortColumn, m_sortOrder,
+                                       m_filterInterrupter);
+    m_filterFuture.then(this, [this, generation, editSerial](const TableSnapshot &snapshot) {
+        swapFilteredSnapshot(snapshot, generation, editSerial);
+    });
+}
+
+void OfflineSqliteTable::swapFilteredSnapshot(const TableSnapshot &snapshot, quint64 generation, quint64 editSerial)
+{
+    if (generation != m_fetchGeneration)
+        return;
+    m_filterInterrupter.reset();
+    // the snapshot comes from another connection and misses edits made while it was read, those rows are read again once flushed
+    if (!snapshot.valid || snapshot.fields.size() != m_colCount || editSerial != m_editSerial) {
+        select();
+        return;
+    }
+    beginResetModel();
+    clearRowMap();
+    m_data = snapshot.data;
+    m_rowCount = snapshot.rowCount;
+    m_fetchComplete = true;
+    m_cacheUnfiltered = m_filter.isEmpty();
+    endResetModel();
 }
 
 void OfflineSqliteTable::sort(int column, Qt::SortOrder order)
 {
     m_sortColumn = column;
     m_sortOrder = order;
-    setQuery(createQuery());
+    releaseQuery();
+    if (!sortInMemory(column, order))
+        invalidate();
+}
+
+bool OfflineSqliteTable::sortInMemory(int column, Qt::SortOrder order)
+{
+    if (m_needSelect || !m_fetchComplete || column < 0 || column >= m_colCount || !flushEdits())
+        return false;
+    const int colCount = m_colCount;
+    const QVariantList &cachedData = m_data;
+    if (m_rowOrder.isEmpty()) {
+        m_rowOrder.resize(cachedData.size() / colCount);
+        std::iota(m_rowOrder.begin(), m_rowOrder.end(), 0);
+    }
+    // stable so the previous order acts as the secondary key
+    std::stable_sort(m_rowOrder.begin(), m_rowOrder.end(), [&cachedData, colCount, column, order](int left, int right) {
+        const int comparison = compareValues(cachedData.at((left * colCount) + column), cachedData.at((right * colCount) + column));
+        return order == Qt::AscendingOrder ? comparison < 0 : comparison > 0;
+    });
+    updateRowMap();
+    return true;
+}
+
+int OfflineSqliteTable::compareValues(const QVariant &left, const QVariant &right)
+{
+    // same ordering as sqlite: null, numbers, text, blobs
+    const auto storageClass = [](const QVariant &value) -> int {
+        if (value.isNull())
+            return 0;
+        switch (value.typeId()) {
+        case QMetaType::Int:
+        case QMetaType::LongLong:
+        case QMetaType::UInt:
+        case QMetaType::ULongLong:
+        case QMetaType::Double:
+        case QMetaType::Bool:
+            return 1;
+        case QMetaType::QByteArray:
+            return 3;
+        default:
+            return 2;
+        }
+    };
+    const int leftClass = storageClass(left);
+    const int rightClass = storageClass(right);
+    if (leftClass != rightClass)
+        return leftClass < rightClass ? -1 : 1;
+    switch (leftClass) {
+    case 0:
+        return 0;
+    case 1: {
+        if (left.typeId() != QMetaType::Double && right.typeId() != QMetaType::Double) {
+            const qlonglong leftNumber = left.toLongLong();
+            const qlonglong rightNumber = right.toLongLong();
+            return leftNumber < rightNumber ? -1 : (rightNumber < leftNumber ? 1 : 0);
+        }
+        const double leftNumber = left.toDouble();
+        const double rightNumber = right.toDouble();
+        return leftNumber < rightNumber ? -1 : (rightNumber < leftNumber ? 1 : 0);
+    }
+    case 3:
+        return left.toByteArray().compare(right.toByteArray());
+    default:
+        return left.toString().compare(right.toString());
+    }
+}
+
+int OfflineSqliteTable::integerKeyColumn() const
+{
+    int keyColumn = -1;
+    for (int i = 0; i < m_colCount; ++i) {
+        if (!m_fields.at(i).isPrimaryKey)
+            continue;
+        if (keyColumn >= 0 || m_fields.at(i).fieldType != QMetaType::Int)
+            return -1;
+        keyColumn = i;
+    }
+    return keyColumn;
+}
+
+bool OfflineSqliteTable::canFilterInMemory() const
+{
+    // a filter can only pick among the cached rows if none were left out by the previous one
+    return !m_needSelect && m_fetchComplete && m_cacheUnfiltered && !m_tableName.isEmpty() && integerKeyColumn() >= 0;
+}
+
+bool OfflineSqliteTable::filterInMemory()
+{
+    if (!canFilterInMemory())
+        return false;
+    const quint64 generation = ++m_fetchGeneration;
+    if (m_filter.isEmpty()) {
+        m_visibleRows = QBitArray();
+        updateRowMap();
+        return true;
+    }
+    // the keys are read after the buffered edits are written, the current rows stay visible until they are back
+    startFlush();
+    const bool editsQueued = m_pendingEdits.isEmpty();
+    const quint64 editSerial = m_editSerial;
+    DatabaseActor::run([tableName = m_tableName, keyField = m_fields.at(integerKeyColumn()).fieldName, filter = m_filter]() -> KeySelection {
+        return readMatchingKeys(openDb(), tableName, keyField, filter, nullptr);
+    }).then(this, [this, generation, editsQueued, editSerial](const KeySelection &selection) {
+        if (generation != m_fetchGeneration)
+            return;
+        if (!selection.valid || !canFilterInMemory()) {
+            invalidate();
+            return;
+        }
+        // edits the keys could not see yet are written first and the keys read again
+        if (!editsQueued || editSerial != m_editSerial) {
+            if (!filterInMemory())
+                invalidate();
+            return;
+        }
+        selectKeys(selection.keys);
+    });
+    return true;
+}
+
+OfflineSqliteTable::KeySelection OfflineSqliteTable::readMatchingKeys(const QSqlDatabase &db, const QString &tableName, const QString &keyField,
+                                                                      const QString &filter, const QueryInterrupter *interrupter)
+{
+    KeySelection selection;
+    selection.valid = false;
+    if (!db.isValid() || !db.isOpen())
+        return selection;
+    if (interrupter && interrupter->isInterrupted())
+        return selection;
+    QSqlQuery keyQuery(db);
+    keyQuery.setForwardOnly(true);
+    if (!keyQuery.exec(QLatin1String("SELECT ") + db.driver()->escapeIdentifier(keyField, QSqlDriver::FieldName) + QLatin1String(" FROM ")
+                       + db.driver()->escapeIdentifier(tableName, QSqlDriver::TableName) + QLatin1String(" WHERE ") + filter)) {
+#ifdef QT_DEBUG
+        qDebug() << keyQuery.executedQuery() << keyQuery.lastError().text();
+#endif
+        return selection;
+    }
+    for (int row = 1; keyQuery.next(); ++row) {
+        if (interrupter && row % INTERRUPT_CHECK_ROWS == 0 && interrupter->isInterrupted())
+            return selection;
+        selection.keys.append(keyQuery.value(0).toInt());
+    }
+    // an interrupted or failed scan also just stops returning keys
+    if (keyQuery.lastError().isValid() || (interrupter && interrupter->isInterrupted()))
+        return selection;
+    selection.valid = true;
+    return selection;
+}
+
+OfflineSqliteTable::KeySelection OfflineSqliteTable::readKeySnapshot(const QString &path, const QString &tableName, const QString &keyField,
+                                                                     const QString &filter, const std::shared_ptr<QueryInterrupter> &interrupter)
+{
+    KeySelection selection;
+    selection.valid = false;
+    {
+        // a slow filter runs on its own connection so it never holds up the database thread and can be aborted mid statement
+        QSqlDatabase db = openThreadDb(path);
+        if (!interrupter || interrupter->attach(db)) {
+            const ReadTransaction readTransaction(db);
+            if (readTransaction.isActive())
+                selection = readMatchingKeys(db, tableName, keyField, filter, interrupter.get());
+            if (interrupter)
+                interrupter->detach();
+        }
+    }
+    closeThreadDb();
+    return selection;
+}
+
+void OfflineSqliteTable::selectKeys(const QList<int> &keys)
+{
+    const int keyColumn = integerKeyColumn();
+    const int cachedRows = m_data.size() / m_colCount;
+    const QSet<int> keySet(keys.cbegin(), keys.cend());
+    m_visibleRows = QBitArray(cachedRows);
+    for (int row = 0; row < cachedRows; ++row) {
+        if (keySet.contains(m_data.at((row * m_colCount) + keyColumn).toInt()))
+            m_visibleRows.setBit(row);
+    }
+    updateRowMap();
+}
+
+int OfflineSqliteTable::dataRow(int row) const
+{
+    return m_rowMap.isEmpty() ? row : m_rowMap.at(row);
+}
+
+void OfflineSqliteTable::updateRowMap()
+{
+    const int cachedRows = m_colCount > 0 ? m_data.size() / m_colCount : 0;
+    QList<int> rowMap;
+    if (!m_rowOrder.isEmpty() || !m_visibleRows.isEmpty()) {
+        rowMap.reserve(cachedRows);
+        for (int i = 0; i < cachedRows; ++i) {
+            const int row = m_rowOrder.isEmpty() ? i : m_rowOrder.at(i);
+            if (m_visibleRows.isEmpty() || m_visibleRows.testBit(row))
+                rowMap.append(row);
+        }
+    }
+    // the rows are only rearranged, views keep selection and current item through the persistent indexes
+    Q_EMIT layoutAboutToBeChanged();
+    const QModelIndexList oldPersistent = persistentIndexList();
+    QList<int> persistentRows;
+    persistentRows.reserve(oldPersistent.size());
+    for (const QModelIndex &persistent : oldPersistent)
+        persistentRows.append(dataRow(persistent.row()));
+    const bool identity = rowMap.isEmpty() && m_visibleRows.isEmpty();
+    m_rowMap = std::move(rowMap);
+    m_rowCount = identity ? cachedRows : m_rowMap.size();
+    QList<int> newPositions(cachedRows, -1);
+    for (int i = 0; i < m_rowCount; ++i)
+        newPositions[dataRow(i)] = i;
+    QModelIndexList newPersistent;
+    newPersistent.reserve(oldPersistent.size());
+    for (qsizetype i = 0, maxI = oldPersistent.size(); i < maxI; ++i) {
+        const int newRow = newPositions.at(persistentRows.at(i));
+        newPersistent.append(newRow < 0 ? QModelIndex() : index(newRow, oldPersistent.at(i).column()));
+    }
+    changePersistentIndexList(oldPersistent, newPersistent);
+    Q_EMIT layoutChanged();
+}
+
+void OfflineSqliteTable::clearRowMap()
+{
+    m_rowOrder.clear();
+    m_visibleRows.clear();
+    m_rowMap.clear();
+}
+
+void OfflineSqliteTable::materializeRows()
+{
+    if (m_rowMap.isEmpty() && m_visibleRows.isEmpty())
+        return;
+    // structural changes work on plain positions so the visible rows become the cache in their current order
+    QVariantList visibleData;
+    visibleData.reserve(m_rowMap.size() * m_colCount);
+    QList<int> newRows(m_data.size() / m_colCount, -1);
+    for (qsizetype i = 0, maxI = m_rowMap.size(); i < maxI; ++i) {
+        visibleData.append(m_data.mid(m_rowMap.at(i) * m_colCount, m_colCount));
+        newRows[m_rowMap.at(i)] = i;
+    }
+    moveCachedEdits(newRows);
+    if (!m_visibleRows.isEmpty())
+        m_cacheUnfiltered = false;
+    m_data = std::move(visibleData);
+    clearRowMap();
+}
+
+void OfflineSqliteTable::invalidate()
+{
+    flushEdits();
+    // rows are read the first time anything asks for them, until then the model is logically up to date
+    beginResetModel();
+    ++m_fetchGeneration;
+    m_needSelect = true;
+    m_fetchComplete = false;
+    clearRowMap();
+    m_data.clear();
+    m_rowCount = 0;
+    if (m_needTableInfo) {
+        m_headers.clear();
+        m_fields.clear();
+        m_colCount = 0;
+    }
+    endResetModel();
+}
+
+void OfflineSqliteTable::fetchIfNeeded() const
+{
+    if (!m_needSelect)
+        return;
+    // nobody observed the rows since the last reset so they can be filled in without notifying
+    OfflineSqliteTable *self = const_cast<OfflineSqliteTable *>(this);
+    self->m_needSelect = false;
+    ++self->m_fetchGeneration;
+    if (m_needTableInfo && !self->fetchTableStructure())
+        return;
+    self->fetchRows();
+}
+
+bool OfflineSqliteTable::isLoaded() const
+{
+    return !m_needSelect;
+}
+
+void OfflineSqliteTable::prefetch()
+{
+    if (!m_needSelect || m_tableName.isEmpty() || isMemoryDb() || m_prefetchFuture.isRunning())
+        return;
+    const quint64 generation = m_fetchGeneration;
+    m_prefetchFuture = QtConcurrent::run(&OfflineSqliteTable::readTableSnapshot, dbFilePath(), m_tableName, m_filter, m_sortColumn, m_sortOrder,
+                                         std::shared_ptr<QueryInterrupter>());
+    m_prefetchFuture.then(this, [this, generation](const TableSnapshot &snapshot) { applySnapshot(snapshot, generation); });
+}
+
+void OfflineSqliteTable::cancelPrefetch()
+{
+    ++m_fetchGeneration;
+    if (m_filterInterrupter)
+        m_filterInterrupter->interrupt();
+    m_prefetchFuture.waitForFinished();
+    m_filterFuture.waitForFinished();
+    m_keysFuture.waitForFinished();
+    releaseQuery();
+}
+
+void OfflineSqliteTable::applySnapshot(const TableSnapshot &snapshot, quint64 generation)
+{
+    if (generation != m_fetchGeneration || !m_needSelect || !snapshot.valid)
+        return;
+    if (m_needTableInfo) {
+        m_fields = snapshot.fields;
+        m_headers.clear();
+        m_headers.reserve(m_fields.size());
+        for (const FiledInfo &field : std::as_const(m_fields))
+            m_headers.append(field.fieldName);
+        m_colCount = m_fields.size();
+        m_needTableInfo = false;
+    } else if (snapshot.fields.size() != m_colCount) {
+        return;
+    }
+    clearRowMap();
+    m_data = snapshot.data;
+    m_rowCount = snapshot.rowCount;
+    m_needSelect = false;
+    m_fetchComplete = true;
+    m_cacheUnfiltered = m_filter.isEmpty();
+}
+
+OfflineSqliteTable::TableSnapshot OfflineSqliteTable::readTableSnapshot(const QString &path, const QString &tableName, const QString &filter,
+                                                                        int sortColumn, Qt::SortOrder sortOrder,
+                                                                        const std::shared_ptr<QueryInterrupter> &interrupter)
+{
+    TableSnapshot snapshot;
+    snapshot.rowCount = 0;
+    snapshot.valid = false;
+    {
+        // structure and rows come from the same snapshot even if the database thread commits in between
+        QSqlDatabase db = openThreadDb(path);
+        if (interrupter && !interrupter->attach(db))
+            return snapshot;
+        const ReadTransaction readTransaction(db);
+        if (readTransaction.isActive() && readTableStructure(db, tableName, &snapshot.fields)) {
+            QSqlQuery selectQuery(db);
+            snapshot.valid = selectQuery.prepare(selectStatement(db, tableName, filter, snapshot.fields, sortColumn, sortOrder))
+                    && readRows(selectQuery, snapshot.fields.size(), &snapshot.data, &snapshot.rowCount, interrupter.get());
+        }
+        if (interrupter)
+            interrupter->detach();
+    }
+    // pool threads are shared with unrelated work, the connection is not kept around
+    closeThreadDb();
+    return snapshot;
 }
 
 bool OfflineSqliteTable::moveColumns(const QModelIndex &sourceParent, int sourceColumn, int count, const QModelIndex &destinationParent,
@@ -239,6 +979,7 @@ QVariant OfflineSqliteTable::headerData(int section, Qt::Orientation orientation
         return QVariant();
     if (orientation == Qt::Vertical)
         return section + 1;
+    fetchIfNeeded();
     if (section < 0 || section >= m_headers.size())
         return QVariant();
     return m_headers.at(section);
@@ -248,6 +989,7 @@ bool OfflineSqliteTable::setHeaderData(int section, Qt::Orientation orientation,
 {
     if (role != Qt::DisplayRole || orientation == Qt::Vertical)
         return false;
+    fetchIfNeeded();
     if (section < 0 || section >= m_headers.size())
         return false;
     m_headers[section] = value;
@@ -259,13 +1001,13 @@ bool OfflineSqliteTable::setInternalData(const QModelIndex &index, const QVarian
 {
     if (!index.isValid())
         return false;
-    const int dataIndex = (index.row() * m_colCount) + index.column();
+    const int dataIndex = (dataRow(index.row()) * m_colCount) + index.column();
     m_data[dataIndex] = value;
     emit dataChanged(index, index, {Qt::DisplayRole, Qt::EditRole});
     return true;
 }
 
-QMetaType::Type OfflineSqliteTable::convertSqliteType(const QString &typ) const
+QMetaType::Type OfflineSqliteTable::convertSqliteType(const QString &typ)
 {
     if (typ.compare(QStringLiteral("INTEGER"), Qt::CaseInsensitive) == 0 || typ.compare(QStringLiteral("INT"), Qt::CaseInsensitive) == 0)
         return QMetaType::Int; // TODO maybe 64 bits?
@@ -290,41 +1032,57 @@ QString OfflineSqliteTable::fieldName(int index) const
 
 bool OfflineSqliteTable::getTableStructure()
 {
+    flushEdits();
     beginResetModel();
-    m_headers.clear();
+    ++m_fetchGeneration;
+    m_needSelect = true;
+    clearRowMap();
     m_data.clear();
+    m_rowCount = 0;
+    const bool result = fetchTableStructure();
+    endResetModel();
+    return result;
+}
+
+bool OfflineSqliteTable::fetchTableStructure()
+{
+    m_headers.clear();
     m_fields.clear();
     m_colCount = 0;
-    m_rowCount = 0;
     if (m_tableName.isEmpty())
         return true;
-    QSqlDatabase db = openDb();
-    if (!db.isValid() || !db.isOpen())
+    const QString tableName = m_tableName;
+    QList<FiledInfo> *fields = &m_fields;
+    const bool read = DatabaseActor::runBlocking([tableName, fields]() -> bool {
+        QSqlDatabase db = openDb();
+        return db.isValid() && db.isOpen() && readTableStructure(db, tableName, fields);
+    });
+    if (!read)
         return false;
+    m_colCount = m_fields.size();
+    m_headers.reserve(m_colCount);
+    for (const FiledInfo &field : std::as_const(m_fields))
+        m_headers.append(field.fieldName);
+    m_needTableInfo = false;
+    return true;
+}
+
+bool OfflineSqliteTable::readTableStructure(const QSqlDatabase &db, const QString &tableName, QList<FiledInfo> *fields)
+{
     QSqlQuery structureQuery(db);
-    structureQuery.prepare(QLatin1String("PRAGMA table_info(") + db.driver()->escapeIdentifier(m_tableName, QSqlDriver::TableName)
+    structureQuery.prepare(QLatin1String("PRAGMA table_info(") + db.driver()->escapeIdentifier(tableName, QSqlDriver::TableName)
                            + QLatin1Char(')'));
     if (!structureQuery.exec()) {
 #ifdef QT_DEBUG
-        qDebug() << m_query.lastQuery() << m_query.lastError().text();
+        qDebug() << structureQuery.lastQuery() << structureQuery.lastError().text();
 #endif
         return false;
     }
-    m_colCount = std::max(0, structureQuery.size());
-    m_headers.reserve(m_colCount);
-    m_fields.reserve(m_colCount);
-    int newColCount;
-    for (newColCount = 0; structureQuery.next(); ++newColCount) {
-        const QString currFieldName = structureQuery.value(1).toString();
-        m_headers.append(currFieldName);
-        m_fields.append(FiledInfo(currFieldName, convertSqliteType(structureQuery.value(2).toString()), structureQuery.value(3).toInt() == 0,
-                                  structureQuery.value(5).toInt() > 0));
-    }
-    if (m_colCount == 0)
-        m_colCount = newColCount;
-    Q_ASSERT(newColCount == m_colCount);
-    endResetModel();
-    m_needTableInfo = false;
+    fields->clear();
+    while (structureQuery.next()) {
+        fields->append(FiledInfo(structureQuery.value(1).toString(), convertSqliteType(structureQuery.value(2).toString()),
+                                 structureQuery.value(3).toInt() == 0, structureQuery.value(5).toInt() > 0));
+    }
     return true;
 }
 
@@ -333,7 +1091,7 @@ QVariant OfflineSqliteTable::data(const QModelIndex &index, int role) const
     if (!index.isValid())
         return QVariant();
     if (role == Qt::DisplayRole || role == Qt::EditRole) {
-        const int dataIndex = (index.row() * m_colCount) + index.column();
+        const int dataIndex = (dataRow(index.row()) * m_colCount) + index.column();
         return m_data.at(dataIndex);
     }
     return QVariant();
@@ -341,52 +1099,186 @@ QVariant OfflineSqliteTable::data(const QModelIndex &index, int role) const
 
 bool OfflineSqliteTable::select()
 {
+    // a fresh read must already see the buffered edits
+    flushEdits();
+    if (m_needSelect) {
+        // the rows were never read, the next access reads them fresh
+        ++m_fetchGeneration;
+        return true;
+    }
     beginResetModel();
+    const bool result = fetchRows();
+    endResetModel();
+    return result;
+}
+
+int OfflineSqliteTable::fetchChunkSize() const
+{
+    return m_fetchChunkSize;
+}
+
+void OfflineSqliteTable::setFetchChunkSize(int rows)
+{
+    if (m_fetchChunkSize == rows)
+        return;
+    m_fetchChunkSize = rows;
+    releaseQuery();
+}
+
+bool OfflineSqliteTable::fetchRows()
+{
+    ++m_fetchGeneration;
     m_rowCount = 0;
+    clearRowMap();
     m_data.clear();
-    if (!m_query.exec()) {
+    m_fetchComplete = false;
+    m_cacheUnfiltered = m_filter.isEmpty();
+    RowChunk chunk = readFirstChunk();
+    m_query = chunk.query;
+    if (!chunk.valid)
+        return false;
+    m_data = std::move(chunk.data);
+    m_rowCount = chunk.rowCount;
+    m_fetchComplete = chunk.complete;
+    if (m_fetchChunkSize <= 0)
+        return true;
+    // the first chunk is available straight away, the rest is read by the database thread while the event loop keeps running
+    if (!chunk.complete)
+        fetchNextChunk(m_fetchGeneration);
+    Q_EMIT fetchProgress(m_rowCount, chunk.complete);
+    return true;
+}
+
+bool OfflineSqliteTable::readChunk(QSqlQuery &query, int colCount, int chunkSize, QVariantList *data, int *rowCount, bool *complete)
+{
+    *complete = false;
+    data->reserve(data->size() + (chunkSize * colCount));
+    for (int h = 0; h < chunkSize; ++h) {
+        if (!query.next()) {
+            // a failed step also stops returning rows, only a clean end means the result is complete
+            const bool failed = query.lastError().isValid();
 #ifdef QT_DEBUG
-        qDebug() << m_query.executedQuery() << m_query.lastError().text();
+            if (failed)
+                qDebug() << query.executedQuery() << query.lastError().text();
+#endif
+            query.finish();
+            *complete = !failed;
+            return !failed;
+        }
+        for (int i = 0; i < colCount; ++i) {
+            const QVariant tempValue = query.value(i); // needs to call value before isNull
+            if (query.isNull(i))
+                data->append(QVariant());
+            else
+                data->append(tempValue);
+        }
+        ++*rowCount;
+    }
+    return true;
+}
+
+void OfflineSqliteTable::fetchNextChunk(quint64 generation)
+{
+    const std::shared_ptr<QSqlQuery> query = m_query;
+    if (!query)
+        return;
+    const int colCount = m_colCount;
+    const int chunkSize = m_fetchChunkSize;
+    DatabaseActor::run([query, colCount, chunkSize]() -> RowChunk {
+        RowChunk chunk;
+        chunk.rowCount = 0;
+        chunk.valid = readChunk(*query, colCount, chunkSize, &chunk.data, &chunk.rowCount, &chunk.complete);
+        return chunk;
+    }).then(this, [this, generation](const RowChunk &chunk) { appendChunk(chunk, generation); });
+}
+
+void OfflineSqliteTable::appendChunk(const RowChunk &chunk, quint64 generation)
+{
+    // a new select or reset superseded this read
+    if (generation != m_fetchGeneration)
+        return;
+    if (!chunk.valid) {
+        // the rows read so far are not the whole result, they are read again from scratch
+        releaseQuery();
+        invalidate();
+        return;
+    }
+    if (chunk.rowCount > 0) {
+        beginInsertRows(QModelIndex(), m_rowCount, m_rowCount + chunk.rowCount - 1);
+        m_data.append(chunk.data);
+        m_rowCount += chunk.rowCount;
+        endInsertRows();
+    }
+    m_fetchComplete = chunk.complete;
+    if (!chunk.complete)
+        fetchNextChunk(generation);
+    Q_EMIT fetchProgress(m_rowCount, chunk.complete);
+}
+
+bool OfflineSqliteTable::readRows(QSqlQuery &query, int colCount, QVariantList *data, int *rowCount, const QueryInterrupter *interrupter)
+{
+    if (!query.exec()) {
+#ifdef QT_DEBUG
+        qDebug() << query.executedQuery() << query.lastError().text();
 #endif
-        endResetModel();
         return false;
     }
     int newRowCount = 0;
-    for (; m_query.next(); ++newRowCount) {
+    for (; query.next(); ++newRowCount) {
+        if (interrupter && newRowCount % INTERRUPT_CHECK_ROWS == 0 && interrupter->isInterrupted())
+            break;
         if (newRowCount == 0) {
-            m_rowCount = std::max(0, m_query.size());
-            m_data.reserve(std::max(m_colCount, m_colCount * m_rowCount));
+            *rowCount = std::max(0, query.size());
+            data->reserve(std::max(colCount, colCount * *rowCount));
         }
-        for (int i = 0; i < m_colCount; ++i) {
-            const QVariant tempValue = m_query.value(i); // needs to call value before isNull
-            if (m_query.isNull(i))
-                m_data.append(QVariant());
+        for (int i = 0; i < colCount; ++i) {
+            const QVariant tempValue = query.value(i); // needs to call value before isNull
+            if (query.isNull(i))
+                data->append(QVariant());
             else
-                m_data.append(tempValue);
+                data->append(tempValue);
         }
     }
-    if (m_rowCount == 0)
-        m_rowCount = newRowCount;
-    m_query.finish();
-    Q_ASSERT(m_rowCount == newRowCount);
-    Q_ASSERT(m_rowCount * m_colCount == m_data.size());
-    endResetModel();
+    const bool failed = query.lastError().isValid();
+#ifdef QT_DEBUG
+    if (failed)
+        qDebug() << query.executedQuery() << query.lastError().text();
+#endif
+    query.finish();
+    if (failed)
+        return false;
+    // an interrupted statement just stops returning rows, the partial result must not be mistaken for the whole table
+    if (interrupter && interrupter->isInterrupted())
+        return false;
+    if (*rowCount == 0)
+        *rowCount = newRowCount;
+    Q_ASSERT(*rowCount == newRowCount);
+    Q_ASSERT(*rowCount * colCount == data->size());
     return true;
 }
 
 void OfflineSqliteTable::setQuery(const QString &query)
 {
-    QSqlDatabase db = openDb();
-    if (!db.isValid() || !db.isOpen())
+    const std::shared_ptr<QSqlQuery> newQuery = DatabaseActor::runBlocking([query]() -> std::shared_ptr<QSqlQuery> {
+        QSqlDatabase db = openDb();
+        if (!db.isValid() || !db.isOpen())
+            return nullptr;
+        std::shared_ptr<QSqlQuery> preparedQuery = std::make_shared<QSqlQuery>(db);
+        preparedQuery->prepare(query);
+        return preparedQuery;
+    });
+    if (!newQuery)
         return;
-    QSqlQuery newQuery(db);
-    newQuery.prepare(query);
-    setQuery(std::move(newQuery));
+    releaseQuery();
+    m_query = newQuery;
+    select();
 }
 
 void OfflineSqliteTable::setQuery(QSqlQuery &&query)
 {
-    m_query = std::move(query);
+    // the query must belong to the connection of the database thread
+    releaseQuery();
+    m_query = std::make_shared<QSqlQuery>(std::move(query));
     select();
 }
 
@@ -394,6 +1286,7 @@ int OfflineSqliteTable::columnCount(const QModelIndex &parent) const
 {
     if (parent.isValid())
         return 0;
+    fetchIfNeeded();
     return m_colCount;
 }
 
@@ -401,5 +1294,6 @@ int OfflineSqliteTable::rowCount(const QModelIndex &parent) const
 {
     if (parent.isValid())
         return 0;
+    fetchIfNeeded();
     return m_rowCount;
 }
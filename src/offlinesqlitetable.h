@@ -14,9 +14,15 @@
 #ifndef OFFLINESQLITETABLE_H
 #define OFFLINESQLITETABLE_H
 #include <QAbstractTableModel>
+#include <QBitArray>
 #include <QVector>
 #include <QVariant>
 #include <QSqlQuery>
+#include <QFuture>
+#include <QElapsedTimer>
+#include <memory>
+class QTimer;
+class QueryInterrupter;
 
 struct FiledInfo
 {
@@ -49,6 +55,7 @@ public:
     explicit OfflineSqliteTable(QObject *parent = nullptr);
     virtual void setTable(const QString &tableName);
     virtual void setFilter(const QString &filter);
+    void setFilterInBackground(const QString &filter);
     bool setData(const QModelIndex &index, const QVariant &value, int role = Qt::EditRole) override;
     Qt::ItemFlags flags(const QModelIndex &index) const override;
     QString tableName() const;
@@ -60,6 +67,16 @@ public:
     bool setHeaderData(int section, Qt::Orientation orientation, const QVariant &value, int role = Qt::EditRole) override;
     virtual QString fieldName(int index) const;
     virtual bool select();
+    bool isLoaded() const;
+    void prefetch();
+    void cancelPrefetch();
+    int fetchChunkSize() const;
+    void setFetchChunkSize(int rows);
+    bool writeBehind() const;
+    void setWriteBehind(bool enabled);
+    bool hasPendingEdits() const;
+    bool flushEdits();
+    bool removeCachedRows(int keyColumn, const QList<int> &keys);
     void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
     bool moveColumns(const QModelIndex &sourceParent, int sourceColumn, int count, const QModelIndex &destinationParent,
                      int destinationChild) override;
@@ -68,6 +85,9 @@ public:
     bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count, const QModelIndex &destinationParent, int destinationChild) override;
     bool insertRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
     bool removeRows(int row, int count, const QModelIndex &parent = QModelIndex()) override;
+signals:
+    void fetchProgress(int fetchedRows, bool complete);
+    void editsRejected(int editCount);
 
 protected:
     virtual bool getTableStructure();
@@ -76,18 +96,108 @@ protected:
     virtual bool setInternalData(const QModelIndex &index, const QVariant &value);
 
 private:
-    QMetaType::Type convertSqliteType(const QString &typ) const;
+    struct TableSnapshot
+    {
+        QList<FiledInfo> fields;
+        QVariantList data;
+        int rowCount;
+        bool valid;
+    };
+    struct RowChunk
+    {
+        std::shared_ptr<QSqlQuery> query;
+        QVariantList data;
+        int rowCount;
+        bool complete;
+        bool valid;
+    };
+    struct KeySelection
+    {
+        QList<int> keys;
+        bool valid;
+    };
+    struct PendingEdit
+    {
+        int cachedRow;
+        int column;
+        QString fieldName;
+        QStringList keyFields;
+        QVariantList keyValues;
+        QVariant value;
+        QVariant previousValue;
+    };
+    static QMetaType::Type convertSqliteType(const QString &typ);
+    static bool readTableStructure(const QSqlDatabase &db, const QString &tableName, QList<FiledInfo> *fields);
+    static QString selectStatement(const QSqlDatabase &db, const QString &tableName, const QString &filter, const QList<FiledInfo> &fields,
+                                   int sortColumn, Qt::SortOrder sortOrder);
+    static bool readRows(QSqlQuery &query, int colCount, QVariantList *data, int *rowCount, const QueryInterrupter *interrupter = nullptr);
+    static bool readChunk(QSqlQuery &query, int colCount, int chunkSize, QVariantList *data, int *rowCount, bool *complete);
+    static bool updateRow(const QSqlDatabase &db, const QString &tableName, const QString &fieldName, const QVariant &value,
+                          const QStringList &keyFields, const QVariantList &keyValues);
+    static bool writeEdits(const QString &tableName, const QList<PendingEdit> &edits);
+    static bool deleteRows(const QString &tableName, const QStringList &keyFields, const QList<QVariantList> &keyValues, bool integerKey);
+    static KeySelection readMatchingKeys(const QSqlDatabase &db, const QString &tableName, const QString &keyField, const QString &filter,
+                                         const QueryInterrupter *interrupter);
+    static KeySelection readKeySnapshot(const QString &path, const QString &tableName, const QString &keyField, const QString &filter,
+                                        const std::shared_ptr<QueryInterrupter> &interrupter);
+    static int compareValues(const QVariant &left, const QVariant &right);
+    static TableSnapshot readTableSnapshot(const QString &path, const QString &tableName, const QString &filter, int sortColumn,
+                                           Qt::SortOrder sortOrder, const std::shared_ptr<QueryInterrupter> &interrupter);
+    void invalidate();
+    void fetchIfNeeded() const;
+    bool fetchTableStructure();
+    bool fetchRows();
+    void fetchNextChunk(quint64 generation);
+    void appendChunk(const RowChunk &chunk, quint64 generation);
+    void applySnapshot(const TableSnapshot &snapshot, quint64 generation);
+    void swapFilteredSnapshot(const TableSnapshot &snapshot, quint64 generation, quint64 editSerial);
     bool hasPrimaryKey() const;
-    QSqlQuery createQuery() const;
+    int integerKeyColumn() const;
+    int dataRow(int row) const;
+    bool canFilterInMemory() const;
+    bool filterInMemory();
+    void selectKeys(const QList<int> &keys);
+    bool sortInMemory(int column, Qt::SortOrder order);
+    void updateRowMap();
+    void clearRowMap();
+    void materializeRows();
+    RowChunk readFirstChunk() const;
+    void releaseQuery();
+    void scheduleFlush();
+    void startFlush();
+    void finishFlush(quint64 serial, bool flushed);
+    void finishRemoveRows(int count, bool removed);
+    void moveCachedEdits(const QList<int> &newRows);
+    void restoreCachedValue(int cachedRow, int column, const QVariant &value);
     QString m_tableName;
     QString m_filter;
-    QSqlQuery m_query;
+    std::shared_ptr<QSqlQuery> m_query;
     QVariantList m_data;
+    QList<int> m_rowOrder;
+    QBitArray m_visibleRows;
+    QList<int> m_rowMap;
     QVariantList m_headers;
     QList<FiledInfo> m_fields;
     int m_colCount;
     int m_rowCount;
     bool m_needTableInfo;
+    bool m_needSelect;
+    bool m_fetchComplete;
+    bool m_cacheUnfiltered;
+    quint64 m_fetchGeneration;
+    int m_fetchChunkSize;
+    QFuture<TableSnapshot> m_prefetchFuture;
+    QFuture<TableSnapshot> m_filterFuture;
+    QFuture<KeySelection> m_keysFuture;
+    std::shared_ptr<QueryInterrupter> m_filterInterrupter;
+    bool m_writeBehind;
+    QTimer *m_flushTimer;
+    QElapsedTimer m_pendingSince;
+    QList<PendingEdit> m_pendingEdits;
+    QList<PendingEdit> m_flushingEdits;
+    QFuture<bool> m_flushFuture;
+    quint64 m_flushSerial;
+    quint64 m_editSerial;
     int m_sortColumn;
     Qt::SortOrder m_sortOrder;
 };
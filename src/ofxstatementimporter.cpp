@@ -0,0 +1,201 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "ofxstatementimporter.h"
+#include <QIODevice>
+#include <QLocale>
+
+namespace {
+bool isTag(QByteArrayView tag, const char *name)
+{
+    return tag.compare(QByteArrayView(name), Qt::CaseInsensitive) == 0;
+}
+
+QString decodeValue(QByteArrayView value)
+{
+    QString result = StatementSource::decode(value);
+    if (!result.contains(QLatin1Char('&')))
+        return result;
+    result.replace(QLatin1String("&lt;"), QLatin1String("<"));
+    result.replace(QLatin1String("&gt;"), QLatin1String(">"));
+    result.replace(QLatin1String("&quot;"), QLatin1String("\""));
+    result.replace(QLatin1String("&apos;"), QLatin1String("'"));
+    result.replace(QLatin1String("&nbsp;"), QLatin1String(" "));
+    result.replace(QLatin1String("&amp;"), QLatin1String("&"));
+    return result;
+}
+
+QDate parseOfxDate(QByteArrayView value)
+{
+    // YYYYMMDD optionally followed by the time and timezone which are not needed
+    if (value.size() < 8)
+        return QDate();
+    int dateParts[3] = {0, 0, 0};
+    const int partLengths[3] = {4, 2, 2};
+    qsizetype pos = 0;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < partLengths[i]; ++j, ++pos) {
+            const char digit = value.at(pos);
+            if (digit < '0' || digit > '9')
+                return QDate();
+            dateParts[i] = (dateParts[i] * 10) + (digit - '0');
+        }
+    }
+    return QDate(dateParts[0], dateParts[1], dateParts[2]);
+}
+
+bool parseOfxAmount(QByteArrayView value, double *amount)
+{
+    QString amountString = QString::fromLatin1(value);
+    if (!amountString.contains(QLatin1Char('.')))
+        amountString.replace(QLatin1Char(','), QLatin1Char('.'));
+    bool amountCheck = false;
+    *amount = QLocale::c().toDouble(amountString, &amountCheck);
+    return amountCheck;
+}
+
+void appendStatement(QList<ImportedStatement> *result, const ImportedStatement &statement)
+{
+    for (ImportedStatement &existing : *result) {
+        if (existing.accountId == statement.accountId) {
+            existing.append(statement);
+            return;
+        }
+    }
+    result->append(statement);
+}
+}
+
+QString OfxStatementImporter::name() const
+{
+    return QStringLiteral("OFX");
+}
+
+QStringList OfxStatementImporter::fileExtensions() const
+{
+    return QStringList{QStringLiteral("ofx"), QStringLiteral("qfx")};
+}
+
+int OfxStatementImporter::sniff(const QByteArray &head) const
+{
+    const QByteArrayView headView = QByteArrayView(head).trimmed();
+    if (headView.startsWith("OFXHEADER:"))
+        return 100;
+    if (headView.startsWith("<?xml") && head.contains("<?OFX"))
+        return 100;
+    if (head.contains("<OFX>") || head.contains("<ofx>"))
+        return 90;
+    return 0;
+}
+
+bool OfxStatementImporter::import(QIODevice *source, QList<ImportedStatement> *result) const
+{
+    Q_ASSERT(source);
+    Q_ASSERT(result);
+    const StatementSource input(source);
+    const QByteArrayView data = input.data();
+    ImportedStatement statement;
+    bool inStatement = false;
+    bool inAccountFrom = false;
+    bool inTransaction = false;
+    bool statementFound = false;
+    QDate opDate;
+    double amount = 0.0;
+    bool hasAmount = false;
+    QString payType;
+    QString payee;
+    QString memo;
+    qsizetype pos = 0;
+    while ((pos = data.indexOf('<', pos)) >= 0) {
+        const qsizetype tagEnd = data.indexOf('>', pos);
+        if (tagEnd < 0)
+            break;
+        QByteArrayView tag = data.sliced(pos + 1, tagEnd - pos - 1).trimmed();
+        pos = tagEnd + 1;
+        if (tag.isEmpty() || tag.startsWith('?') || tag.startsWith('!'))
+            continue;
+        const bool closing = tag.startsWith('/');
+        if (closing)
+            tag = tag.sliced(1);
+        for (qsizetype i = 0; i < tag.size(); ++i) {
+            if (tag.at(i) == ' ' || tag.at(i) == '\t' || tag.at(i) == '\r' || tag.at(i) == '\n') {
+                tag.truncate(i);
+                break;
+            }
+        }
+        if (isTag(tag, "STMTRS") || isTag(tag, "CCSTMTRS")) {
+            if (closing) {
+                if (inStatement && !statement.opDates.isEmpty())
+                    appendStatement(result, statement);
+                statementFound = true;
+            }
+            statement = ImportedStatement();
+            inStatement = !closing;
+            continue;
+        }
+        if (!inStatement)
+            continue;
+        if (isTag(tag, "BANKACCTFROM") || isTag(tag, "CCACCTFROM")) {
+            inAccountFrom = !closing;
+            continue;
+        }
+        if (isTag(tag, "STMTTRN")) {
+            if (closing && inTransaction) {
+                if (!opDate.isValid() || !hasAmount)
+                    return false;
+                if (!qFuzzyIsNull(amount)) {
+                    statement.opDates.append(opDate);
+                    statement.amounts.append(amount);
+                    statement.payTypes.append(payType);
+                    statement.descriptions.append(memo.isEmpty() || memo == payee ? payee
+                                                                                  : (payee.isEmpty() ? memo : payee + QLatin1String(" - ") + memo));
+                }
+            }
+            inTransaction = !closing;
+            opDate = QDate();
+            amount = 0.0;
+            hasAmount = false;
+            payType.clear();
+            payee.clear();
+            memo.clear();
+            continue;
+        }
+        if (closing)
+            continue;
+        // SGML OFX does not close leaf elements so the value runs until the next tag
+        qsizetype valueEnd = data.indexOf('<', pos);
+        if (valueEnd < 0)
+            valueEnd = data.size();
+        const QByteArrayView value = data.sliced(pos, valueEnd - pos).trimmed();
+        if (value.isEmpty())
+            continue;
+        if (inAccountFrom) {
+            if (isTag(tag, "ACCTID"))
+                statement.accountId = decodeValue(value);
+        } else if (inTransaction) {
+            if (isTag(tag, "DTPOSTED"))
+                opDate = parseOfxDate(value);
+            else if (isTag(tag, "TRNAMT"))
+                hasAmount = parseOfxAmount(value, &amount);
+            else if (isTag(tag, "TRNTYPE"))
+                payType = decodeValue(value);
+            else if (isTag(tag, "NAME") || isTag(tag, "PAYEE"))
+                payee = decodeValue(value);
+            else if (isTag(tag, "MEMO"))
+                memo = decodeValue(value);
+        } else if (isTag(tag, "CURDEF")) {
+            statement.currency = decodeValue(value);
+        }
+        pos = valueEnd;
+    }
+    return statementFound;
+}
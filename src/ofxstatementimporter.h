@@ -0,0 +1,28 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef OFXSTATEMENTIMPORTER_H
+#define OFXSTATEMENTIMPORTER_H
+#include "statementimporter.h"
+
+class OfxStatementImporter : public StatementImporter
+{
+    Q_DISABLE_COPY_MOVE(OfxStatementImporter)
+public:
+    OfxStatementImporter() = default;
+    QString name() const override;
+    QStringList fileExtensions() const override;
+    int sniff(const QByteArray &head) const override;
+    bool import(QIODevice *source, QList<ImportedStatement> *result) const override;
+};
+
+#endif // OFXSTATEMENTIMPORTER_H
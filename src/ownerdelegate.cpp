@@ -13,28 +13,77 @@
 #include "ownerdelegate.h"
 #include <mainobject.h>
 #include <QStringList>
+#include <QStringView>
 #include "multichoicecombo.h"
 OwnerDelegate::OwnerDelegate(QObject *parent)
     : QStyledItemDelegate(parent)
     , m_object(nullptr)
+    , m_familyRowsValid(false)
 { }
 
 void OwnerDelegate::setMainObject(MainObject *mainObj)
 {
+    for (const auto &conn : std::as_const(m_familyConnections))
+        QObject::disconnect(conn);
+    m_familyConnections.clear();
     m_object = mainObj;
+    clearFamilyCache();
+    if (m_object) {
+        const QAbstractItemModel *family = m_object->familyModel();
+        m_familyConnections << connect(family, &QAbstractItemModel::dataChanged, this, &OwnerDelegate::clearFamilyCache)
+                            << connect(family, &QAbstractItemModel::modelReset, this, &OwnerDelegate::clearFamilyCache)
+                            << connect(family, &QAbstractItemModel::layoutChanged, this, &OwnerDelegate::clearFamilyCache)
+                            << connect(family, &QAbstractItemModel::rowsInserted, this, &OwnerDelegate::clearFamilyCache)
+                            << connect(family, &QAbstractItemModel::rowsRemoved, this, &OwnerDelegate::clearFamilyCache)
+                            << connect(family, &QAbstractItemModel::rowsMoved, this, &OwnerDelegate::clearFamilyCache);
+    }
+}
+
+void OwnerDelegate::clearFamilyCache()
+{
+    m_familyRows.clear();
+    m_ownerTexts.clear();
+    m_familyRowsValid = false;
+}
+
+int OwnerDelegate::familyRow(QStringView id) const
+{
+    if (!m_familyRowsValid) {
+        const QAbstractItemModel *family = m_object->familyModel();
+        const int familyRows = family->rowCount();
+        m_familyRows.reserve(familyRows);
+        for (int i = 0; i < familyRows; ++i)
+            m_familyRows.insert(family->index(i, MainObject::fcId).data().toInt(), i);
+        m_familyRowsValid = true;
+    }
+    bool isInt = false;
+    const int familyId = id.toInt(&isInt);
+    return isInt ? m_familyRows.value(familyId, -1) : -1;
 }
 
 QString OwnerDelegate::displayText(const QVariant &value, const QLocale &locale) const
 {
     if (!m_object)
         return QStyledItemDelegate::displayText(value, locale);
-    QStringList resultList = value.toString().split(QLatin1Char(','));
-    for (int i = 0, maxI = m_object->familyModel()->rowCount(); i < maxI; ++i) {
-        const int idxToReplace = resultList.indexOf(QString::number(m_object->familyModel()->index(i, MainObject::fcId).data().toInt()));
-        if (idxToReplace >= 0)
-            resultList[idxToReplace] = m_object->familyModel()->index(i, MainObject::fcName).data().toString();
+    // accounts share few distinct owner lists, each is resolved once until the family, the locale or the language changes
+    const QString separator = tr(", ");
+    if (locale != m_displayLocale || separator != m_displaySeparator) {
+        m_ownerTexts.clear();
+        m_displayLocale = locale;
+        m_displaySeparator = separator;
     }
-    return resultList.join(tr(", "));
+    const QString owners = value.toString();
+    auto cachedText = m_ownerTexts.constFind(owners);
+    if (cachedText != m_ownerTexts.cend())
+        return *cachedText;
+    QString result;
+    for (QStringView owner : QStringView(owners).split(QLatin1Char(','))) {
+        const int row = familyRow(owner);
+        result += (row < 0 ? owner.toString() : m_object->familyModel()->index(row, MainObject::fcName).data().toString()) + separator;
+    }
+    result.chop(separator.size());
+    m_ownerTexts.insert(owners, result);
+    return result;
 }
 
 QWidget *OwnerDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const
@@ -53,10 +102,11 @@ void OwnerDelegate::setEditorData(QWidget *editor, const QModelIndex &index) con
     if (!comboEditor || !m_object)
         return QStyledItemDelegate::setEditorData(editor, index);
     QList<int> indexesToCheck;
-    QStringList resultList = index.data().toString().split(QLatin1Char(','));
-    for (int i = 0, maxI = m_object->familyModel()->rowCount(); i < maxI; ++i) {
-        if (resultList.contains(QString::number(m_object->familyModel()->index(i, MainObject::fcId).data().toInt())))
-            indexesToCheck.append(i);
+    const QString owners = index.data().toString();
+    for (QStringView owner : QStringView(owners).split(QLatin1Char(','))) {
+        const int row = familyRow(owner);
+        if (row >= 0)
+            indexesToCheck.append(row);
     }
     comboEditor->setCheckedIndexes(indexesToCheck);
 }
@@ -14,6 +14,8 @@
 #define OWNERDELEGATE_H
 
 #include <QStyledItemDelegate>
+#include <QHash>
+#include <QLocale>
 class MainObject;
 class OwnerDelegate : public QStyledItemDelegate
 {
@@ -28,7 +30,15 @@ public:
     void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const override;
 
 private:
+    int familyRow(QStringView id) const;
+    void clearFamilyCache();
     MainObject *m_object;
+    QList<QMetaObject::Connection> m_familyConnections;
+    mutable QHash<int, int> m_familyRows;
+    mutable QHash<QString, QString> m_ownerTexts;
+    mutable QLocale m_displayLocale;
+    mutable QString m_displaySeparator;
+    mutable bool m_familyRowsValid;
 };
 
 #endif // OWNERDELEGATE_H
@@ -0,0 +1,316 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "partitionproxy.h"
+#include <algorithm>
+PartitionProxy::PartitionProxy(QObject *parent)
+    : QAbstractProxyModel(parent)
+    , m_partitionColumn(0)
+    , m_partitionRole(Qt::DisplayRole)
+    , m_hasPartition(false)
+{ }
+
+int PartitionProxy::partitionColumn() const
+{
+    return m_partitionColumn;
+}
+
+void PartitionProxy::setPartitionColumn(int col)
+{
+    if (m_partitionColumn == col)
+        return;
+    beginResetModel();
+    m_partitionColumn = col;
+    rebuildPartitions();
+    endResetModel();
+}
+
+int PartitionProxy::partitionRole() const
+{
+    return m_partitionRole;
+}
+
+void PartitionProxy::setPartitionRole(int role)
+{
+    if (m_partitionRole == role)
+        return;
+    beginResetModel();
+    m_partitionRole = role;
+    rebuildPartitions();
+    endResetModel();
+}
+
+QVariant PartitionProxy::partition() const
+{
+    return m_hasPartition ? QVariant(m_partition) : QVariant();
+}
+
+void PartitionProxy::setPartition(const QVariant &key)
+{
+    const QString partition = key.toString();
+    if (m_hasPartition && m_partition == partition)
+        return;
+    // the rows are already grouped, switching is a single lookup
+    beginResetModel();
+    m_partition = partition;
+    m_hasPartition = true;
+    endResetModel();
+}
+
+void PartitionProxy::clearPartition()
+{
+    if (!m_hasPartition)
+        return;
+    beginResetModel();
+    m_partition.clear();
+    m_hasPartition = false;
+    endResetModel();
+}
+
+bool PartitionProxy::hasChildren(const QModelIndex &parent) const
+{
+    return !parent.isValid() && rowCount() > 0;
+}
+
+int PartitionProxy::rowCount(const QModelIndex &parent) const
+{
+    if (!sourceModel() || parent.isValid())
+        return 0;
+    if (!m_hasPartition)
+        return sourceModel()->rowCount();
+    return partitionRows().size();
+}
+
+int PartitionProxy::columnCount(const QModelIndex &parent) const
+{
+    if (!sourceModel() || parent.isValid())
+        return 0;
+    return sourceModel()->columnCount();
+}
+
+QModelIndex PartitionProxy::index(int row, int column, const QModelIndex &parent) const
+{
+    if (!hasIndex(row, column, parent))
+        return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex PartitionProxy::parent(const QModelIndex &index) const
+{
+    Q_UNUSED(index)
+    return QModelIndex();
+}
+
+QModelIndex PartitionProxy::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceModel() || !sourceIndex.isValid() || sourceIndex.parent().isValid())
+        return QModelIndex();
+    if (!m_hasPartition)
+        return index(sourceIndex.row(), sourceIndex.column());
+    const QList<int> &rows = partitionRows();
+    const auto position = std::lower_bound(rows.cbegin(), rows.cend(), sourceIndex.row());
+    if (position == rows.cend() || *position != sourceIndex.row())
+        return QModelIndex();
+    return index(position - rows.cbegin(), sourceIndex.column());
+}
+
+QModelIndex PartitionProxy::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!sourceModel() || !proxyIndex.isValid())
+        return QModelIndex();
+    const int sourceRow = m_hasPartition ? partitionRows().value(proxyIndex.row(), -1) : proxyIndex.row();
+    return sourceModel()->index(sourceRow, proxyIndex.column());
+}
+
+void PartitionProxy::setSourceModel(QAbstractItemModel *model)
+{
+    if (model == sourceModel())
+        return;
+    beginResetModel();
+    for (const auto &conn : std::as_const(m_sourceConnections))
+        QObject::disconnect(conn);
+    m_sourceConnections.clear();
+    QAbstractProxyModel::setSourceModel(model);
+    if (model) {
+        m_sourceConnections << connect(model, &QAbstractItemModel::modelAboutToBeReset, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::modelReset, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::layoutAboutToBeChanged, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::layoutChanged, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::rowsAboutToBeMoved, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::rowsMoved, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::columnsAboutToBeInserted, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::columnsInserted, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::columnsAboutToBeRemoved, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::columnsRemoved, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::columnsAboutToBeMoved, this, &PartitionProxy::onAboutToBeRearranged)
+                            << connect(model, &QAbstractItemModel::columnsMoved, this, &PartitionProxy::onRearranged)
+                            << connect(model, &QAbstractItemModel::dataChanged, this, &PartitionProxy::onDataChanged)
+                            << connect(model, &QAbstractItemModel::headerDataChanged, this, &PartitionProxy::onHeaderDataChanged)
+                            << connect(model, &QAbstractItemModel::rowsInserted, this, &PartitionProxy::onRowsInserted)
+                            << connect(model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &PartitionProxy::onRowsAboutToBeRemoved)
+                            << connect(model, &QAbstractItemModel::rowsRemoved, this, &PartitionProxy::onRowsRemoved);
+    }
+    rebuildPartitions();
+    endResetModel();
+}
+
+QString PartitionProxy::partitionKey(int sourceRow) const
+{
+    return sourceModel()->index(sourceRow, m_partitionColumn).data(m_partitionRole).toString();
+}
+
+const QList<int> &PartitionProxy::partitionRows() const
+{
+    static const QList<int> noRows;
+    const auto rows = m_partitions.constFind(m_partition);
+    return rows == m_partitions.cend() ? noRows : *rows;
+}
+
+void PartitionProxy::rebuildPartitions()
+{
+    m_partitions.clear();
+    m_rowKeys.clear();
+    if (!sourceModel())
+        return;
+    // source rows are visited in order so every partition comes out sorted
+    const int sourceRows = sourceModel()->rowCount();
+    m_rowKeys.reserve(sourceRows);
+    for (int i = 0; i < sourceRows; ++i) {
+        const QString key = partitionKey(i);
+        m_rowKeys.append(key);
+        m_partitions[key].append(i);
+    }
+}
+
+void PartitionProxy::insertIntoPartition(const QString &key, int sourceRow)
+{
+    QList<int> &rows = m_partitions[key];
+    const int position = std::lower_bound(rows.cbegin(), rows.cend(), sourceRow) - rows.cbegin();
+    const bool visible = m_hasPartition && key == m_partition;
+    if (visible)
+        beginInsertRows(QModelIndex(), position, position);
+    rows.insert(position, sourceRow);
+    if (visible)
+        endInsertRows();
+}
+
+void PartitionProxy::removeFromPartition(const QString &key, int sourceRow)
+{
+    const auto rows = m_partitions.find(key);
+    if (rows == m_partitions.end())
+        return;
+    const auto position = std::lower_bound(rows->cbegin(), rows->cend(), sourceRow);
+    if (position == rows->cend() || *position != sourceRow)
+        return;
+    const int row = position - rows->cbegin();
+    const bool visible = m_hasPartition && key == m_partition;
+    if (visible)
+        beginRemoveRows(QModelIndex(), row, row);
+    rows->remove(row);
+    if (rows->isEmpty())
+        m_partitions.erase(rows);
+    if (visible)
+        endRemoveRows();
+}
+
+void PartitionProxy::onAboutToBeRearranged()
+{
+    beginResetModel();
+}
+
+void PartitionProxy::onRearranged()
+{
+    rebuildPartitions();
+    endResetModel();
+}
+
+void PartitionProxy::onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles)
+{
+    if (topLeft.parent().isValid())
+        return;
+    if (m_partitionColumn >= topLeft.column() && m_partitionColumn <= bottomRight.column()
+        && (roles.isEmpty() || roles.contains(m_partitionRole))) {
+        // only the rows whose key changed move to another partition
+        for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+            const QString key = partitionKey(i);
+            if (key == m_rowKeys.at(i))
+                continue;
+            removeFromPartition(m_rowKeys.at(i), i);
+            m_rowKeys[i] = key;
+            insertIntoPartition(key, i);
+        }
+    }
+    if (!m_hasPartition) {
+        Q_EMIT dataChanged(index(topLeft.row(), topLeft.column()), index(bottomRight.row(), bottomRight.column()), roles);
+        return;
+    }
+    for (int i = topLeft.row(); i <= bottomRight.row(); ++i) {
+        const QModelIndex proxyLeft = mapFromSource(topLeft.sibling(i, topLeft.column()));
+        if (proxyLeft.isValid())
+            Q_EMIT dataChanged(proxyLeft, proxyLeft.sibling(proxyLeft.row(), bottomRight.column()), roles);
+    }
+}
+
+void PartitionProxy::onHeaderDataChanged(Qt::Orientation orientation, int first, int last)
+{
+    if (orientation == Qt::Horizontal)
+        Q_EMIT headerDataChanged(orientation, first, last);
+}
+
+void PartitionProxy::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    const int count = last - first + 1;
+    for (QList<int> &rows : m_partitions) {
+        for (int &row : rows) {
+            if (row >= first)
+                row += count;
+        }
+    }
+    m_rowKeys.insert(first, count, QString());
+    if (!m_hasPartition)
+        beginInsertRows(QModelIndex(), first, last);
+    for (int i = first; i <= last; ++i) {
+        m_rowKeys[i] = partitionKey(i);
+        insertIntoPartition(m_rowKeys.at(i), i);
+    }
+    if (!m_hasPartition)
+        endInsertRows();
+}
+
+void PartitionProxy::onRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    // the rows leave their partition while the source can still be read, the others shift once the source removed them
+    if (!m_hasPartition)
+        beginRemoveRows(QModelIndex(), first, last);
+    for (int i = last; i >= first; --i)
+        removeFromPartition(m_rowKeys.at(i), i);
+}
+
+void PartitionProxy::onRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    if (parent.isValid())
+        return;
+    const int count = last - first + 1;
+    for (QList<int> &rows : m_partitions) {
+        for (int &row : rows) {
+            if (row > last)
+                row -= count;
+        }
+    }
+    m_rowKeys.remove(first, count);
+    if (!m_hasPartition)
+        endRemoveRows();
+}
@@ -0,0 +1,63 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef PARTITIONPROXY_H
+#define PARTITIONPROXY_H
+
+#include <QAbstractProxyModel>
+#include <QHash>
+
+class PartitionProxy : public QAbstractProxyModel
+{
+    Q_OBJECT
+    Q_DISABLE_COPY_MOVE(PartitionProxy)
+public:
+    explicit PartitionProxy(QObject *parent = nullptr);
+    int partitionColumn() const;
+    void setPartitionColumn(int col);
+    int partitionRole() const;
+    void setPartitionRole(int role);
+    QVariant partition() const;
+    void setPartition(const QVariant &key);
+    void clearPartition();
+    bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &index) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    void setSourceModel(QAbstractItemModel *sourceModel) override;
+
+private:
+    void onDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles);
+    void onHeaderDataChanged(Qt::Orientation orientation, int first, int last);
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void onRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+    void onRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onAboutToBeRearranged();
+    void onRearranged();
+    QString partitionKey(int sourceRow) const;
+    const QList<int> &partitionRows() const;
+    void insertIntoPartition(const QString &key, int sourceRow);
+    void removeFromPartition(const QString &key, int sourceRow);
+    void rebuildPartitions();
+    QList<QMetaObject::Connection> m_sourceConnections;
+    QHash<QString, QList<int>> m_partitions;
+    QStringList m_rowKeys;
+    QString m_partition;
+    int m_partitionColumn;
+    int m_partitionRole;
+    bool m_hasPartition;
+};
+
+#endif // PARTITIONPROXY_H
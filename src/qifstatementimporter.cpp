@@ -0,0 +1,213 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "qifstatementimporter.h"
+#include <QIODevice>
+#include <QLocale>
+
+namespace {
+QDate parseQifDate(QByteArrayView value)
+{
+    int dateParts[3] = {0, 0, 0};
+    int partLengths[3] = {0, 0, 0};
+    int partIndex = 0;
+    bool apostropheYear = false;
+    char separator = 0;
+    for (const char currChar : value) {
+        if (currChar >= '0' && currChar <= '9') {
+            if (partIndex > 2)
+                return QDate();
+            dateParts[partIndex] = (dateParts[partIndex] * 10) + (currChar - '0');
+            ++partLengths[partIndex];
+            continue;
+        }
+        if (partIndex > 2)
+            return QDate();
+        if (currChar == ' ' || partLengths[partIndex] == 0)
+            continue;
+        if (currChar == '\'')
+            apostropheYear = true;
+        else if (separator == 0)
+            separator = currChar;
+        ++partIndex;
+    }
+    if (partIndex < 2 || partLengths[2] == 0)
+        return QDate();
+    int year, month, day;
+    if (partLengths[0] == 4) {
+        year = dateParts[0];
+        month = dateParts[1];
+        day = dateParts[2];
+    } else {
+        year = dateParts[2];
+        // Quicken writes US dates unless the locale uses dots
+        if (separator == '.') {
+            day = dateParts[0];
+            month = dateParts[1];
+        } else {
+            month = dateParts[0];
+            day = dateParts[1];
+        }
+        if (month > 12 && day <= 12)
+            std::swap(month, day);
+        if (partLengths[2] <= 2)
+            year += (apostropheYear || year < 70) ? 2000 : 1900;
+    }
+    return QDate(year, month, day);
+}
+
+bool parseQifAmount(QByteArrayView value, double *amount)
+{
+    QString amountString = QString::fromLatin1(value);
+    const qsizetype lastComma = amountString.lastIndexOf(QLatin1Char(','));
+    const qsizetype lastDot = amountString.lastIndexOf(QLatin1Char('.'));
+    // with both separators the last one is the decimal point, a lone comma only is if two decimals follow it
+    if (lastComma < 0 || lastDot > lastComma || (lastDot < 0 && lastComma != amountString.size() - 3)) {
+        amountString.remove(QLatin1Char(','));
+    } else {
+        amountString.remove(QLatin1Char('.'));
+        amountString[amountString.lastIndexOf(QLatin1Char(','))] = QLatin1Char('.');
+        amountString.remove(QLatin1Char(','));
+    }
+    bool amountCheck = false;
+    *amount = QLocale::c().toDouble(amountString, &amountCheck);
+    return amountCheck;
+}
+
+ImportedStatement *statementForAccount(QList<ImportedStatement> *result, const QString &accountId)
+{
+    for (ImportedStatement &existing : *result) {
+        if (existing.accountId == accountId)
+            return &existing;
+    }
+    result->append(ImportedStatement());
+    result->last().accountId = accountId;
+    return &result->last();
+}
+}
+
+QString QifStatementImporter::name() const
+{
+    return QStringLiteral("QIF");
+}
+
+QStringList QifStatementImporter::fileExtensions() const
+{
+    return QStringList{QStringLiteral("qif")};
+}
+
+int QifStatementImporter::sniff(const QByteArray &head) const
+{
+    QByteArrayView headView = QByteArrayView(head).trimmed();
+    if (headView.startsWith("\xEF\xBB\xBF"))
+        headView = headView.sliced(3);
+    if (headView.startsWith("!Type:") || headView.startsWith("!Account") || headView.startsWith("!Option:"))
+        return 100;
+    return 0;
+}
+
+bool QifStatementImporter::import(QIODevice *source, QList<ImportedStatement> *result) const
+{
+    Q_ASSERT(source);
+    Q_ASSERT(result);
+    const StatementSource input(source);
+    const QByteArrayView data = input.data();
+    enum { qsNone, qsAccount, qsTransactions } section = qsNone;
+    QString accountId;
+    QString pendingAccountId;
+    ImportedStatement *statement = nullptr;
+    QDate opDate;
+    double amount = 0.0;
+    bool hasAmount = false;
+    QString payType;
+    QString payee;
+    QString memo;
+    bool headerFound = false;
+    qsizetype pos = 0;
+    while (pos < data.size()) {
+        qsizetype lineEnd = data.indexOf('\n', pos);
+        if (lineEnd < 0)
+            lineEnd = data.size();
+        const QByteArrayView line = data.sliced(pos, lineEnd - pos).trimmed();
+        pos = lineEnd + 1;
+        if (line.isEmpty())
+            continue;
+        const char code = line.at(0);
+        const QByteArrayView value = line.sliced(1).trimmed();
+        if (code == '!') {
+            headerFound = true;
+            if (value.startsWith("Account")) {
+                section = qsAccount;
+                pendingAccountId.clear();
+            } else if (value.startsWith("Type:Bank") || value.startsWith("Type:CCard") || value.startsWith("Type:Cash")
+                       || value.startsWith("Type:Oth")) {
+                section = qsTransactions;
+                statement = nullptr;
+            } else if (!value.startsWith("Option") && !value.startsWith("Clear")) {
+                section = qsNone;
+            }
+            continue;
+        }
+        if (section == qsAccount) {
+            if (code == 'N')
+                pendingAccountId = StatementSource::decode(value);
+            else if (code == '^')
+                accountId = pendingAccountId;
+            continue;
+        }
+        if (section != qsTransactions)
+            continue;
+        switch (code) {
+        case 'D':
+            opDate = parseQifDate(value);
+            break;
+        case 'T':
+            hasAmount = parseQifAmount(value, &amount);
+            break;
+        case 'U':
+            if (!hasAmount)
+                hasAmount = parseQifAmount(value, &amount);
+            break;
+        case 'N':
+            payType = StatementSource::decode(value);
+            break;
+        case 'P':
+            payee = StatementSource::decode(value);
+            break;
+        case 'M':
+            memo = StatementSource::decode(value);
+            break;
+        case '^':
+            if (!opDate.isValid() || !hasAmount)
+                return false;
+            if (!qFuzzyIsNull(amount)) {
+                if (!statement)
+                    statement = statementForAccount(result, accountId);
+                statement->opDates.append(opDate);
+                statement->amounts.append(amount);
+                statement->payTypes.append(payType);
+                statement->descriptions.append(memo.isEmpty() || memo == payee ? payee
+                                                                               : (payee.isEmpty() ? memo : payee + QLatin1String(" - ") + memo));
+            }
+            opDate = QDate();
+            amount = 0.0;
+            hasAmount = false;
+            payType.clear();
+            payee.clear();
+            memo.clear();
+            break;
+        default:
+            break;
+        }
+    }
+    return headerFound;
+}
@@ -13,7 +13,7 @@
 #include "relationaldelegate.h"
 #include <QAbstractItemModel>
 #include <QComboBox>
-#include <QSortFilterProxyModel>
+#include "partitionproxy.h"
 RelationalDelegate::RelationalDelegate(QObject *parent)
     : QStyledItemDelegate(parent)
     , m_relationModel(nullptr)
@@ -21,26 +21,77 @@ RelationalDelegate::RelationalDelegate(QObject *parent)
     , m_keyRole(Qt::DisplayRole)
     , m_relationCol(0)
     , m_relationRole(Qt::DisplayRole)
+    , m_keyRowsValid(false)
 { }
 
 void RelationalDelegate::setRelationModel(QAbstractItemModel *model, int keyCol, int relationCol, int keyRole, int relationRole)
 {
+    for (const auto &conn : std::as_const(m_relationConnections))
+        QObject::disconnect(conn);
+    m_relationConnections.clear();
     m_relationModel = model;
     m_keyCol = keyCol;
     m_keyRole = keyRole;
     m_relationCol = relationCol;
     m_relationRole = relationRole;
+    clearRelationCache();
+    if (model) {
+        m_relationConnections << connect(model, &QAbstractItemModel::dataChanged, this, &RelationalDelegate::onRelationDataChanged)
+                              << connect(model, &QAbstractItemModel::modelReset, this, &RelationalDelegate::clearRelationCache)
+                              << connect(model, &QAbstractItemModel::layoutChanged, this, &RelationalDelegate::clearRelationCache)
+                              << connect(model, &QAbstractItemModel::rowsInserted, this, &RelationalDelegate::clearRelationCache)
+                              << connect(model, &QAbstractItemModel::rowsRemoved, this, &RelationalDelegate::clearRelationCache)
+                              << connect(model, &QAbstractItemModel::rowsMoved, this, &RelationalDelegate::clearRelationCache);
+    }
+}
+
+void RelationalDelegate::clearRelationCache()
+{
+    m_keyRows.clear();
+    m_displayTexts.clear();
+    m_keyRowsValid = false;
+}
+
+void RelationalDelegate::onRelationDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    if ((m_keyCol >= topLeft.column() && m_keyCol <= bottomRight.column())
+        || (m_relationCol >= topLeft.column() && m_relationCol <= bottomRight.column()))
+        clearRelationCache();
+}
+
+int RelationalDelegate::relationRow(const QVariant &key) const
+{
+    if (!m_keyRowsValid) {
+        // one pass over the relation, every later lookup is a hash hit
+        const int relationRows = m_relationModel->rowCount();
+        m_keyRows.reserve(relationRows);
+        for (int i = 0; i < relationRows; ++i) {
+            const QString rowKey = m_relationModel->index(i, m_keyCol).data(m_keyRole).toString();
+            if (!m_keyRows.contains(rowKey))
+                m_keyRows.insert(rowKey, i);
+        }
+        m_keyRowsValid = true;
+    }
+    return m_keyRows.value(key.toString(), -1);
 }
 
 QString RelationalDelegate::displayText(const QVariant &value, const QLocale &locale) const
 {
     if (!m_relationModel || m_keyCol == m_relationCol)
         return QStyledItemDelegate::displayText(value, locale);
-    for (int i = 0, maxI = m_relationModel->rowCount(); i < maxI; ++i) {
-        if (m_relationModel->index(i, m_keyCol).data(m_keyRole) == value)
-            return QStyledItemDelegate::displayText(m_relationModel->index(i, m_relationCol).data(m_relationRole), locale);
+    if (locale != m_displayLocale) {
+        m_displayTexts.clear();
+        m_displayLocale = locale;
     }
-    return QStyledItemDelegate::displayText(value, locale);
+    const QString key = value.toString();
+    auto cachedText = m_displayTexts.constFind(key);
+    if (cachedText != m_displayTexts.cend())
+        return *cachedText;
+    const int row = relationRow(value);
+    const QString text = row < 0 ? QStyledItemDelegate::displayText(value, locale)
+                                 : QStyledItemDelegate::displayText(m_relationModel->index(row, m_relationCol).data(m_relationRole), locale);
+    m_displayTexts.insert(key, text);
+    return text;
 }
 
 QWidget *RelationalDelegate::createEditor(QWidget *parent, const QStyleOptionViewItem &option, const QModelIndex &index) const
@@ -62,10 +113,9 @@ void RelationalDelegate::setEditorData(QWidget *editor, const QModelIndex &index
         return QStyledItemDelegate::setEditorData(editor, index);
     QComboBox *result = qobject_cast<QComboBox *>(editor);
     Q_ASSERT(result);
-    for (int i = 0, maxI = m_relationModel->rowCount(); i < maxI; ++i) {
-        if (m_relationModel->index(i, m_keyCol).data(m_keyRole) == index.data())
-            return result->setCurrentIndex(i);
-    }
+    const int row = relationRow(index.data());
+    if (row >= 0)
+        result->setCurrentIndex(row);
 }
 
 void RelationalDelegate::setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const
@@ -83,7 +133,7 @@ FilteredRelationalDelegate::FilteredRelationalDelegate(QObject *parent)
     , m_filterKeyRole(Qt::DisplayRole)
     , m_relationFilterColumn(-1)
     , m_relationFilterRole(Qt::DisplayRole)
-    , m_relationFilterProxy(new QSortFilterProxyModel(this))
+    , m_relationFilterProxy(new PartitionProxy(this))
 { }
 void FilteredRelationalDelegate::setRelationModel(QAbstractItemModel *model, int keyCol, int relationCol, int keyRole, int relationRole)
 {
@@ -107,13 +157,15 @@ QWidget *FilteredRelationalDelegate::createEditor(QWidget *parent, const QStyleO
 
 void FilteredRelationalDelegate::setEditorData(QWidget *editor, const QModelIndex &index) const
 {
-    if (m_filterKeyColumn >= 0 || m_relationFilterColumn >= 0) {
-        m_relationFilterProxy->setFilterKeyColumn(m_relationFilterColumn);
-        m_relationFilterProxy->setFilterRole(m_relationFilterRole);
-        m_relationFilterProxy->setFilterRegularExpression(
-                QLatin1Char('^') + index.sibling(index.row(), m_filterKeyColumn).data(m_filterKeyRole).toString() + QLatin1Char('$'));
-    }
-    RelationalDelegate::setEditorData(editor, index);
+    if (!m_relationModel || m_keyCol == m_relationCol || m_filterKeyColumn < 0 || m_relationFilterColumn < 0)
+        return RelationalDelegate::setEditorData(editor, index);
+    m_relationFilterProxy->setPartition(index.sibling(index.row(), m_filterKeyColumn).data(m_filterKeyRole));
+    QComboBox *result = qobject_cast<QComboBox *>(editor);
+    Q_ASSERT(result);
+    // the combo shows the partition, the row found in the whole relation has to be mapped into it
+    const int row = relationRow(index.data());
+    if (row >= 0)
+        result->setCurrentIndex(m_relationFilterProxy->mapFromSource(m_relationModel->index(row, m_relationCol)).row());
 }
 
 void FilteredRelationalDelegate::setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const
@@ -135,7 +187,7 @@ int FilteredRelationalDelegate::relationFilterColumn() const
 void FilteredRelationalDelegate::setRelationFilterColumn(int col)
 {
     m_relationFilterColumn = col;
-    m_relationFilterProxy->setFilterKeyColumn(m_relationFilterColumn);
+    m_relationFilterProxy->setPartitionColumn(m_relationFilterColumn);
 }
 
 int FilteredRelationalDelegate::filterKeyColumn() const
@@ -166,5 +218,5 @@ int FilteredRelationalDelegate::relationFilterRole() const
 void FilteredRelationalDelegate::setRelationFilterRole(int role)
 {
     m_relationFilterRole = role;
-    m_relationFilterProxy->setFilterRole(m_relationFilterRole);
+    m_relationFilterProxy->setPartitionRole(m_relationFilterRole);
 }
@@ -14,8 +14,10 @@
 #define RELATIONALDELEGATE_H
 
 #include <QStyledItemDelegate >
+#include <QHash>
+#include <QLocale>
 class QAbstractItemModel;
-class QSortFilterProxyModel;
+class PartitionProxy;
 class RelationalDelegate : public QStyledItemDelegate
 {
     Q_OBJECT
@@ -30,11 +32,21 @@ public:
     void setModelData(QWidget *editor, QAbstractItemModel *model, const QModelIndex &index) const override;
 
 protected:
+    int relationRow(const QVariant &key) const;
+    void clearRelationCache();
     QAbstractItemModel *m_relationModel;
     int m_keyCol;
     int m_keyRole;
     int m_relationCol;
     int m_relationRole;
+
+private:
+    void onRelationDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+    QList<QMetaObject::Connection> m_relationConnections;
+    mutable QHash<QString, int> m_keyRows;
+    mutable QHash<QString, QString> m_displayTexts;
+    mutable QLocale m_displayLocale;
+    mutable bool m_keyRowsValid;
 };
 
 class FilteredRelationalDelegate : public RelationalDelegate
@@ -61,7 +73,7 @@ private:
     int m_filterKeyRole;
     int m_relationFilterColumn;
     int m_relationFilterRole;
-    QSortFilterProxyModel *m_relationFilterProxy;
+    PartitionProxy *m_relationFilterProxy;
 };
 
 #endif // RELATIONALDELEGATE_H
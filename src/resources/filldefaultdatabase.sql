@@ -1,3 +1,5 @@
+PRAGMA application_id = 1114989671;
+PRAGMA user_version = 2;
 BEGIN TRANSACTION;
 CREATE TABLE Currencies (Id INTEGER PRIMARY KEY, Currency TEXT NOT NULL);
 CREATE TABLE ExchangeRates (
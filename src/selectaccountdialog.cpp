@@ -39,3 +39,8 @@ int SelectAccountDialog::selectedAccountId() const
         return -1;
     return m_object->filteredAccountsModel()->index(ui->accountCombo->currentIndex(), MainObject::acId).data().toInt();
 }
+
+void SelectAccountDialog::setPrompt(const QString &prompt)
+{
+    ui->label->setText(prompt);
+}
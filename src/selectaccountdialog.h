@@ -28,6 +28,7 @@ public:
     ~SelectAccountDialog();
     void setMainObject(MainObject *mainObj);
     int selectedAccountId() const;
+    void setPrompt(const QString &prompt);
 
 private:
     MainObject *m_object;
@@ -0,0 +1,583 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#include "statementimporter.h"
+#include "globals.h"
+#include "ofxstatementimporter.h"
+#include "qifstatementimporter.h"
+#include <QDir>
+#include <QFile>
+#include <QIODevice>
+#include <QLocale>
+#include <QSettings>
+#include <QStringDecoder>
+#include <QTextStream>
+#include <algorithm>
+
+#define SNIFF_SIZE 4096
+
+namespace {
+int parseDigits(QStringView str, int pos, int count)
+{
+    int result = 0;
+    for (int i = pos; i < pos + count; ++i) {
+        const char16_t digit = str.at(i).unicode();
+        if (digit < u'0' || digit > u'9')
+            return -1;
+        result = (result * 10) + (digit - u'0');
+    }
+    return result;
+}
+
+QString importersSettingsPath()
+{
+    return appSettingsPath() + QDir::separator() + QLatin1String("importers.ini");
+}
+
+CsvColumnMapping barclaysMapping()
+{
+    CsvColumnMapping result;
+    result.name = QStringLiteral("Barclays");
+    result.headers = QStringList{QStringLiteral("Number"), QStringLiteral("Date"),        QStringLiteral("Account"),
+                                 QStringLiteral("Amount"), QStringLiteral("Subcategory"), QStringLiteral("Memo")};
+    result.dateFormat = QStringLiteral("dd/MM/yyyy");
+    result.currency = QStringLiteral("GBP");
+    result.dateColumn = 1;
+    result.amountColumn = 3;
+    result.payTypeColumn = 4;
+    result.descriptionColumn = 5;
+    result.mergeExtraFields = true;
+    return result;
+}
+
+CsvColumnMapping natwestMapping()
+{
+    CsvColumnMapping result;
+    result.name = QStringLiteral("Natwest");
+    result.headers = QStringList{QStringLiteral("Date"),    QStringLiteral("Type"),         QStringLiteral("Description"),
+                                 QStringLiteral("Value"),   QStringLiteral("Balance"),      QStringLiteral("Account Name"),
+                                 QStringLiteral("Account Number")};
+    result.dateFormat = QStringLiteral("dd MMM yyyy");
+    result.currency = QStringLiteral("GBP");
+    result.dateColumn = 0;
+    result.amountColumn = 3;
+    result.payTypeColumn = 1;
+    result.descriptionColumn = 2;
+    return result;
+}
+
+CsvColumnMapping revolutMapping()
+{
+    CsvColumnMapping result;
+    result.name = QStringLiteral("Revolut");
+    result.headers = QStringList{QStringLiteral("Type"),        QStringLiteral("Product"), QStringLiteral("Started Date"),
+                                 QStringLiteral("Completed Date"), QStringLiteral("Description"), QStringLiteral("Amount"),
+                                 QStringLiteral("Fee"),         QStringLiteral("Currency"), QStringLiteral("State"),
+                                 QStringLiteral("Balance")};
+    result.dateFormat = QStringLiteral("yyyy-MM-dd HH:mm:ss");
+    result.dateColumn = 2;
+    result.amountColumn = 5;
+    result.payTypeColumn = 0;
+    result.descriptionColumn = 4;
+    result.currencyColumn = 7;
+    return result;
+}
+}
+
+void ImportedStatement::append(const ImportedStatement &other)
+{
+    if (opDates.isEmpty()) {
+        *this = other;
+        return;
+    }
+    if (currency != other.currency || !currencies.isEmpty() || !other.currencies.isEmpty()) {
+        if (currencies.isEmpty())
+            currencies.fill(currency, opDates.size());
+        if (other.currencies.isEmpty())
+            currencies.append(QList<QString>(other.opDates.size(), other.currency));
+        else
+            currencies.append(other.currencies);
+        currency.clear();
+    }
+    if (payTypes.isEmpty() && !other.payTypes.isEmpty())
+        payTypes.fill(QString(), opDates.size());
+    if (descriptions.isEmpty() && !other.descriptions.isEmpty())
+        descriptions.fill(QString(), opDates.size());
+    opDates.append(other.opDates);
+    amounts.append(other.amounts);
+    if (!payTypes.isEmpty())
+        payTypes.append(other.payTypes.isEmpty() ? QList<QString>(other.opDates.size()) : other.payTypes);
+    if (!descriptions.isEmpty())
+        descriptions.append(other.descriptions.isEmpty() ? QList<QString>(other.opDates.size()) : other.descriptions);
+}
+
+StatementSource::StatementSource(QIODevice *source)
+    : m_file(qobject_cast<QFile *>(source))
+    , m_mapped(nullptr)
+{
+    Q_ASSERT(source);
+    if (m_file && m_file->size() > 0)
+        m_mapped = m_file->map(0, m_file->size());
+    if (m_mapped) {
+        m_data = QByteArrayView(m_mapped, m_file->size());
+    } else {
+        m_buffer = source->readAll();
+        m_data = m_buffer;
+    }
+}
+
+StatementSource::~StatementSource()
+{
+    if (m_mapped)
+        m_file->unmap(m_mapped);
+}
+
+QByteArrayView StatementSource::data() const
+{
+    return m_data;
+}
+
+QString StatementSource::decode(QByteArrayView text)
+{
+    QStringDecoder decoder(QStringDecoder::Utf8, QStringDecoder::Flag::Stateless);
+    QString result = decoder(text);
+    if (decoder.hasError())
+        return QString::fromLatin1(text);
+    return result;
+}
+
+CsvColumnMapping::CsvColumnMapping()
+    : separator(QLatin1Char(','))
+    , decimalSeparator(QLatin1Char('.'))
+    , dateColumn(-1)
+    , amountColumn(-1)
+    , payTypeColumn(-1)
+    , descriptionColumn(-1)
+    , currencyColumn(-1)
+    , hasHeaderRow(true)
+    , mergeExtraFields(false)
+{ }
+
+bool CsvColumnMapping::isValid() const
+{
+    if (name.isEmpty() || separator.isNull() || dateFormat.isEmpty() || dateColumn < 0 || amountColumn < 0)
+        return false;
+    if (currency.isEmpty() && currencyColumn < 0)
+        return false;
+    if (hasHeaderRow && headers.isEmpty())
+        return false;
+    const int maxColumn = std::max({dateColumn, amountColumn, payTypeColumn, descriptionColumn, currencyColumn});
+    return headers.isEmpty() || maxColumn < headers.size();
+}
+
+CsvStatementImporter::CsvStatementImporter(const CsvColumnMapping &mapping)
+    : m_mapping(mapping)
+    , m_fieldCount(0)
+    , m_dayPos(-1)
+    , m_monthPos(-1)
+    , m_yearPos(-1)
+    , m_dateLength(-1)
+{
+    compile();
+}
+
+const CsvColumnMapping &CsvStatementImporter::mapping() const
+{
+    return m_mapping;
+}
+
+QString CsvStatementImporter::name() const
+{
+    return m_mapping.name;
+}
+
+QStringList CsvStatementImporter::fileExtensions() const
+{
+    return QStringList{QStringLiteral("csv")};
+}
+
+void CsvStatementImporter::compile()
+{
+    m_plan.clear();
+    if (!m_mapping.isValid())
+        return;
+    const std::pair<int, FieldKind> columns[] = {{m_mapping.dateColumn, fkDate},
+                                                 {m_mapping.amountColumn, fkAmount},
+                                                 {m_mapping.payTypeColumn, fkPayType},
+                                                 {m_mapping.descriptionColumn, fkDescription},
+                                                 {m_mapping.currencyColumn, fkCurrency}};
+    for (const auto &column : columns) {
+        if (column.first < 0)
+            continue;
+        if (column.first >= m_plan.size())
+            m_plan.resize(column.first + 1, fkSkip);
+        m_plan[column.first] = column.second;
+    }
+    m_fieldCount = std::max(m_plan.size(), m_mapping.headers.size());
+    // formats made only of dd, MM, yyyy and other fixed width fields are parsed by position
+    m_dateLength = m_mapping.dateFormat.size();
+    for (int i = 0; i < m_mapping.dateFormat.size();) {
+        const QChar currChar = m_mapping.dateFormat.at(i);
+        int runLength = 1;
+        while (i + runLength < m_mapping.dateFormat.size() && m_mapping.dateFormat.at(i + runLength) == currChar)
+            ++runLength;
+        if (currChar == QLatin1Char('d') && runLength == 2)
+            m_dayPos = i;
+        else if (currChar == QLatin1Char('M') && runLength == 2)
+            m_monthPos = i;
+        else if (currChar == QLatin1Char('y') && runLength == 4)
+            m_yearPos = i;
+        else if (currChar.isLetter() && !(runLength == 2 && QStringView(u"Hhms").contains(currChar)))
+            m_dateLength = -1;
+        else if (currChar == QLatin1Char('\''))
+            m_dateLength = -1;
+        i += runLength;
+    }
+    if (m_dayPos < 0 || m_monthPos < 0 || m_yearPos < 0)
+        m_dateLength = -1;
+}
+
+bool CsvStatementImporter::splitLine(QStringView line, QList<QStringView> &fields, QStringList &unescaped) const
+{
+    fields.clear();
+    unescaped.clear();
+    const QChar quote = QLatin1Char('"');
+    const qsizetype lineSize = line.size();
+    qsizetype pos = 0;
+    for (;;) {
+        qsizetype end = -1;
+        if (pos < lineSize && line.at(pos) == quote) {
+            bool hasEscapes = false;
+            for (qsizetype i = pos + 1; i < lineSize; ++i) {
+                if (line.at(i) != quote)
+                    continue;
+                if (i + 1 < lineSize && line.at(i + 1) == quote) {
+                    hasEscapes = true;
+                    ++i;
+                    continue;
+                }
+                end = i;
+                break;
+            }
+            if (end >= 0) {
+                QStringView field = line.sliced(pos + 1, end - pos - 1);
+                if (hasEscapes) {
+                    unescaped.append(field.toString().replace(QStringLiteral("\"\""), QStringLiteral("\"")));
+                    field = unescaped.last();
+                }
+                fields.append(field);
+                pos = line.indexOf(m_mapping.separator, end + 1);
+                if (pos < 0)
+                    pos = lineSize;
+            }
+        }
+        if (end < 0) { // not quoted or the quote is never closed
+            end = line.indexOf(m_mapping.separator, pos);
+            if (end < 0)
+                end = lineSize;
+            fields.append(line.sliced(pos, end - pos));
+            pos = end;
+        }
+        if (pos >= lineSize)
+            break;
+        ++pos;
+    }
+    if (fields.size() > m_fieldCount) {
+        if (!m_mapping.mergeExtraFields)
+            return true;
+        // the extra fields are unquoted separators in the last column, merged as the original Barclays importer did
+        QString merged;
+        for (qsizetype i = m_fieldCount - 1; i < fields.size(); ++i)
+            merged += fields.at(i);
+        unescaped.append(merged);
+        fields.resize(m_fieldCount);
+        fields.last() = unescaped.last();
+    }
+    return fields.size() >= m_fieldCount;
+}
+
+bool CsvStatementImporter::checkHeaders(const QList<QStringView> &fields) const
+{
+    if (fields.size() < m_mapping.headers.size())
+        return false;
+    for (qsizetype i = 0, maxI = m_mapping.headers.size(); i < maxI; ++i) {
+        if (fields.at(i).trimmed().compare(m_mapping.headers.at(i), Qt::CaseInsensitive) != 0)
+            return false;
+    }
+    return true;
+}
+
+QDate CsvStatementImporter::parseDate(QStringView field) const
+{
+    if (m_dateLength == field.size()) {
+        const int year = parseDigits(field, m_yearPos, 4);
+        const int month = parseDigits(field, m_monthPos, 2);
+        const int day = parseDigits(field, m_dayPos, 2);
+        if (year >= 0 && month >= 0 && day >= 0)
+            return QDate(year, month, day);
+    }
+    return QDate::fromString(field.toString(), m_mapping.dateFormat);
+}
+
+bool CsvStatementImporter::parseAmount(QStringView field, double *amount) const
+{
+    bool amountCheck = false;
+    if (m_mapping.decimalSeparator == QLatin1Char('.')) {
+        *amount = QLocale::c().toDouble(field, &amountCheck);
+        return amountCheck;
+    }
+    QString normalised = field.toString();
+    normalised.remove(QLatin1Char('.'));
+    normalised.replace(m_mapping.decimalSeparator, QLatin1Char('.'));
+    *amount = QLocale::c().toDouble(normalised, &amountCheck);
+    return amountCheck;
+}
+
+int CsvStatementImporter::sniff(const QByteArray &head) const
+{
+    if (m_plan.isEmpty() || !m_mapping.hasHeaderRow)
+        return 0;
+    const QString decodedHead = QString::fromUtf8(head);
+    QStringView headView(decodedHead);
+    if (headView.startsWith(QChar(0xFEFF)))
+        headView = headView.sliced(1);
+    QList<QStringView> fields;
+    QStringList unescaped;
+    for (QStringView line : headView.tokenize(QLatin1Char('\n'))) {
+        line = line.trimmed();
+        if (line.isEmpty())
+            continue;
+        if (!splitLine(line, fields, unescaped) || !checkHeaders(fields))
+            return 0;
+        return 100;
+    }
+    return 0;
+}
+
+bool CsvStatementImporter::import(QIODevice *source, QList<ImportedStatement> *statements) const
+{
+    Q_ASSERT(source);
+    Q_ASSERT(statements);
+    if (m_plan.isEmpty())
+        return false;
+    statements->append(ImportedStatement());
+    ImportedStatement *result = &statements->last();
+    result->currency = m_mapping.currency;
+    QTextStream stream(source);
+    QString line;
+    QList<QStringView> fields;
+    QStringList unescaped;
+    bool needCheckFirstLine = m_mapping.hasHeaderRow;
+    while (stream.readLineInto(&line)) {
+        const QStringView lineView = QStringView(line).trimmed();
+        if (lineView.isEmpty())
+            continue;
+        if (!splitLine(lineView, fields, unescaped))
+            return false;
+        if (needCheckFirstLine) {
+            if (!checkHeaders(fields))
+                return false;
+            needCheckFirstLine = false;
+            continue;
+        }
+        QDate opDate;
+        double amount = 0.0;
+        QStringView payType;
+        QStringView description;
+        QStringView currency;
+        for (qsizetype i = 0, maxI = m_plan.size(); i < maxI; ++i) {
+            switch (m_plan.at(i)) {
+            case fkSkip:
+                break;
+            case fkDate:
+                opDate = parseDate(fields.at(i).trimmed());
+                break;
+            case fkAmount:
+                if (!parseAmount(fields.at(i).trimmed(), &amount))
+                    return false;
+                break;
+            case fkPayType:
+                payType = fields.at(i).trimmed();
+                break;
+            case fkDescription:
+                description = fields.at(i).trimmed();
+                break;
+            case fkCurrency:
+                currency = fields.at(i).trimmed();
+                break;
+            }
+        }
+        if (qFuzzyIsNull(amount))
+            continue;
+        if (!opDate.isValid())
+            return false;
+        result->opDates.append(opDate);
+        result->amounts.append(amount);
+        if (m_mapping.payTypeColumn >= 0)
+            result->payTypes.append(payType.toString());
+        if (m_mapping.descriptionColumn >= 0)
+            result->descriptions.append(description.toString());
+        if (m_mapping.currencyColumn >= 0)
+            result->currencies.append(currency.toString());
+    }
+    return !needCheckFirstLine;
+}
+
+StatementImporterRegistry::StatementImporterRegistry()
+    : m_builtInCount(0)
+{
+    for (const CsvColumnMapping &mapping : {barclaysMapping(), natwestMapping(), revolutMapping()})
+        m_importers.append(new CsvStatementImporter(mapping));
+    m_importers.append(new OfxStatementImporter);
+    m_importers.append(new QifStatementImporter);
+    m_builtInCount = m_importers.size();
+    loadCsvMappings();
+}
+
+StatementImporterRegistry::~StatementImporterRegistry()
+{
+    qDeleteAll(m_importers);
+}
+
+QStringList StatementImporterRegistry::importerNames() const
+{
+    QStringList result;
+    result.reserve(m_importers.size());
+    for (const StatementImporter *importer : m_importers)
+        result.append(importer->name());
+    return result;
+}
+
+const StatementImporter *StatementImporterRegistry::importer(const QString &name) const
+{
+    for (const StatementImporter *importer : m_importers) {
+        if (importer->name().compare(name, Qt::CaseInsensitive) == 0)
+            return importer;
+    }
+    return nullptr;
+}
+
+const StatementImporter *StatementImporterRegistry::detect(QIODevice *source) const
+{
+    Q_ASSERT(source);
+    const QByteArray head = source->peek(SNIFF_SIZE);
+    const StatementImporter *result = nullptr;
+    int bestScore = 0;
+    for (const StatementImporter *importer : m_importers) {
+        const int score = importer->sniff(head);
+        if (score > bestScore) {
+            bestScore = score;
+            result = importer;
+        }
+    }
+    return result;
+}
+
+QStringList StatementImporterRegistry::fileExtensions() const
+{
+    QStringList result;
+    for (const StatementImporter *importer : m_importers)
+        result.append(importer->fileExtensions());
+    result.removeDuplicates();
+    return result;
+}
+
+QList<CsvColumnMapping> StatementImporterRegistry::csvMappings() const
+{
+    QList<CsvColumnMapping> result;
+    for (qsizetype i = m_builtInCount, maxI = m_importers.size(); i < maxI; ++i)
+        result.append(static_cast<const CsvStatementImporter *>(m_importers.at(i))->mapping());
+    return result;
+}
+
+bool StatementImporterRegistry::saveCsvMapping(const CsvColumnMapping &mapping)
+{
+    if (!mapping.isValid())
+        return false;
+    for (qsizetype i = 0, maxI = m_importers.size(); i < maxI; ++i) {
+        if (m_importers.at(i)->name().compare(mapping.name, Qt::CaseInsensitive) != 0)
+            continue;
+        if (i < m_builtInCount)
+            return false;
+        delete m_importers.at(i);
+        m_importers[i] = new CsvStatementImporter(mapping);
+        storeCsvMappings();
+        return true;
+    }
+    m_importers.append(new CsvStatementImporter(mapping));
+    storeCsvMappings();
+    return true;
+}
+
+bool StatementImporterRegistry::removeCsvMapping(const QString &name)
+{
+    for (qsizetype i = m_builtInCount, maxI = m_importers.size(); i < maxI; ++i) {
+        if (m_importers.at(i)->name().compare(name, Qt::CaseInsensitive) == 0) {
+            delete m_importers.takeAt(i);
+            storeCsvMappings();
+            return true;
+        }
+    }
+    return false;
+}
+
+void StatementImporterRegistry::loadCsvMappings()
+{
+    QSettings settings(importersSettingsPath(), QSettings::IniFormat);
+    const int mappingsCount = settings.beginReadArray(QStringLiteral("CsvMappings"));
+    for (int i = 0; i < mappingsCount; ++i) {
+        settings.setArrayIndex(i);
+        CsvColumnMapping mapping;
+        mapping.name = settings.value(QStringLiteral("Name")).toString();
+        mapping.separator = settings.value(QStringLiteral("Separator"), mapping.separator).toChar();
+        mapping.decimalSeparator = settings.value(QStringLiteral("DecimalSeparator"), mapping.decimalSeparator).toChar();
+        mapping.headers = settings.value(QStringLiteral("Headers")).toStringList();
+        mapping.dateFormat = settings.value(QStringLiteral("DateFormat")).toString();
+        mapping.currency = settings.value(QStringLiteral("Currency")).toString();
+        mapping.dateColumn = settings.value(QStringLiteral("DateColumn"), -1).toInt();
+        mapping.amountColumn = settings.value(QStringLiteral("AmountColumn"), -1).toInt();
+        mapping.payTypeColumn = settings.value(QStringLiteral("PaymentTypeColumn"), -1).toInt();
+        mapping.descriptionColumn = settings.value(QStringLiteral("DescriptionColumn"), -1).toInt();
+        mapping.currencyColumn = settings.value(QStringLiteral("CurrencyColumn"), -1).toInt();
+        mapping.hasHeaderRow = settings.value(QStringLiteral("HasHeaderRow"), true).toBool();
+        mapping.mergeExtraFields = settings.value(QStringLiteral("MergeExtraFields"), false).toBool();
+        if (mapping.isValid() && !importer(mapping.name))
+            m_importers.append(new CsvStatementImporter(mapping));
+    }
+    settings.endArray();
+}
+
+void StatementImporterRegistry::storeCsvMappings() const
+{
+    QSettings settings(importersSettingsPath(), QSettings::IniFormat);
+    settings.remove(QStringLiteral("CsvMappings"));
+    const QList<CsvColumnMapping> mappings = csvMappings();
+    settings.beginWriteArray(QStringLiteral("CsvMappings"), mappings.size());
+    for (int i = 0, maxI = mappings.size(); i < maxI; ++i) {
+        settings.setArrayIndex(i);
+        const CsvColumnMapping &mapping = mappings.at(i);
+        settings.setValue(QStringLiteral("Name"), mapping.name);
+        settings.setValue(QStringLiteral("Separator"), mapping.separator);
+        settings.setValue(QStringLiteral("DecimalSeparator"), mapping.decimalSeparator);
+        settings.setValue(QStringLiteral("Headers"), mapping.headers);
+        settings.setValue(QStringLiteral("DateFormat"), mapping.dateFormat);
+        settings.setValue(QStringLiteral("Currency"), mapping.currency);
+        settings.setValue(QStringLiteral("DateColumn"), mapping.dateColumn);
+        settings.setValue(QStringLiteral("AmountColumn"), mapping.amountColumn);
+        settings.setValue(QStringLiteral("PaymentTypeColumn"), mapping.payTypeColumn);
+        settings.setValue(QStringLiteral("DescriptionColumn"), mapping.descriptionColumn);
+        settings.setValue(QStringLiteral("CurrencyColumn"), mapping.currencyColumn);
+        settings.setValue(QStringLiteral("HasHeaderRow"), mapping.hasHeaderRow);
+        settings.setValue(QStringLiteral("MergeExtraFields"), mapping.mergeExtraFields);
+    }
+    settings.endArray();
+}
@@ -0,0 +1,130 @@
+/****************************************************************************\
+   Copyright 2024 Luca Beldi
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+       http://www.apache.org/licenses/LICENSE-2.0
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+\****************************************************************************/
+#ifndef STATEMENTIMPORTER_H
+#define STATEMENTIMPORTER_H
+#include <QByteArrayView>
+#include <QDate>
+#include <QList>
+#include <QString>
+#include <QStringList>
+class QFile;
+class QIODevice;
+
+struct ImportedStatement
+{
+    void append(const ImportedStatement &other);
+    QString accountId;
+    QString currency;
+    QList<QString> currencies;
+    QList<QDate> opDates;
+    QList<double> amounts;
+    QList<QString> payTypes;
+    QList<QString> descriptions;
+};
+
+struct CsvColumnMapping
+{
+    CsvColumnMapping();
+    bool isValid() const;
+    QString name;
+    QChar separator;
+    QChar decimalSeparator;
+    QStringList headers;
+    QString dateFormat;
+    QString currency;
+    int dateColumn;
+    int amountColumn;
+    int payTypeColumn;
+    int descriptionColumn;
+    int currencyColumn;
+    bool hasHeaderRow;
+    bool mergeExtraFields;
+};
+
+class StatementImporter
+{
+    Q_DISABLE_COPY_MOVE(StatementImporter)
+public:
+    StatementImporter() = default;
+    virtual ~StatementImporter() = default;
+    virtual QString name() const = 0;
+    virtual QStringList fileExtensions() const = 0;
+    virtual int sniff(const QByteArray &head) const = 0;
+    virtual bool import(QIODevice *source, QList<ImportedStatement> *result) const = 0;
+};
+
+class StatementSource
+{
+    Q_DISABLE_COPY_MOVE(StatementSource)
+public:
+    explicit StatementSource(QIODevice *source);
+    ~StatementSource();
+    QByteArrayView data() const;
+    static QString decode(QByteArrayView text);
+
+private:
+    QFile *m_file;
+    uchar *m_mapped;
+    QByteArray m_buffer;
+    QByteArrayView m_data;
+};
+
+class CsvStatementImporter : public StatementImporter
+{
+    Q_DISABLE_COPY_MOVE(CsvStatementImporter)
+public:
+    explicit CsvStatementImporter(const CsvColumnMapping &mapping);
+    const CsvColumnMapping &mapping() const;
+    QString name() const override;
+    QStringList fileExtensions() const override;
+    int sniff(const QByteArray &head) const override;
+    bool import(QIODevice *source, QList<ImportedStatement> *result) const override;
+
+private:
+    enum FieldKind : quint8 { fkSkip, fkDate, fkAmount, fkPayType, fkDescription, fkCurrency };
+    void compile();
+    bool splitLine(QStringView line, QList<QStringView> &fields, QStringList &unescaped) const;
+    bool checkHeaders(const QList<QStringView> &fields) const;
+    QDate parseDate(QStringView field) const;
+    bool parseAmount(QStringView field, double *amount) const;
+    CsvColumnMapping m_mapping;
+    QList<FieldKind> m_plan;
+    qsizetype m_fieldCount;
+    int m_dayPos;
+    int m_monthPos;
+    int m_yearPos;
+    int m_dateLength;
+};
+
+class StatementImporterRegistry
+{
+    Q_DISABLE_COPY_MOVE(StatementImporterRegistry)
+public:
+    StatementImporterRegistry();
+    ~StatementImporterRegistry();
+    QStringList importerNames() const;
+    const StatementImporter *importer(const QString &name) const;
+    const StatementImporter *detect(QIODevice *source) const;
+    QStringList fileExtensions() const;
+    QList<CsvColumnMapping> csvMappings() const;
+    bool saveCsvMapping(const CsvColumnMapping &mapping);
+    bool removeCsvMapping(const QString &name);
+
+private:
+    void loadCsvMappings();
+    void storeCsvMappings() const;
+    QList<StatementImporter *> m_importers;
+    int m_builtInCount;
+};
+
+#endif // STATEMENTIMPORTER_H
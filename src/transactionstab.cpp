@@ -12,16 +12,22 @@
 \****************************************************************************/
 #include "blankrowproxy.h"
 #include "decimaldelegate.h"
+#include "importmappingdialog.h"
 #include "isodatedelegate.h"
 #include "multiplefilterproxy.h"
+#include "partitionproxy.h"
 #include "relationaldelegate.h"
 #include "selectaccountdialog.h"
+#include "statementimporter.h"
 #include "transactionstab.h"
 #include "ui_transactionstab.h"
+#include <QItemSelectionModel>
 #include <QMenu>
 #include <QMessageBox>
 #include <QFileDialog>
 #include <QStandardPaths>
+#include <QTimer>
+#define FILTER_DEBOUNCE_INTERVAL 250
 
 TransactionsTab::TransactionsTab(QWidget *parent)
     : QWidget(parent)
@@ -38,26 +44,24 @@ TransactionsTab::TransactionsTab(QWidget *parent)
     , m_accountProxy(new BlankRowProxy(this))
     , m_categoryProxy(new BlankRowProxy(this))
     , m_subcategoryProxy(new BlankRowProxy(this))
-    , m_subcategoryFilter(new QSortFilterProxyModel(this))
+    , m_subcategoryFilter(new PartitionProxy(this))
+    , m_importStatementsMenu(new QMenu(this))
+    , m_filterTimer(new QTimer(this))
     , ui(new Ui::TransactionsTab)
 
 {
     ui->setupUi(this);
     ui->lastUpdateLabel->hide();
+    m_filterTimer->setSingleShot(true);
+    m_filterTimer->setInterval(FILTER_DEBOUNCE_INTERVAL);
+    connect(m_filterTimer, &QTimer::timeout, this, &TransactionsTab::applyFilter);
     ui->transactionView->setModel(m_filterProxy);
     ui->currencyFilterCombo->setModel(m_currencyProxy);
     ui->accountFilterCombo->setModel(m_accountProxy);
     ui->categoryFilterCombo->setModel(m_categoryProxy);
     m_subcategoryProxy->setSourceModel(m_subcategoryFilter);
     ui->subcategoryFilterCombo->setModel(m_subcategoryProxy);
-    QMenu *importStatementsMenu = new QMenu(this);
-    importStatementsMenu->addAction(ui->actionImport_Barclays);
-    importStatementsMenu->addAction(ui->actionImport_Natwest);
-    importStatementsMenu->addAction(ui->actionImport_Revolut);
-    ui->importStatementButton->setMenu(importStatementsMenu);
-    connect(ui->actionImport_Barclays, &QAction::triggered, this, std::bind(&TransactionsTab::importStatement, this, MainObject::ifBarclays));
-    connect(ui->actionImport_Natwest, &QAction::triggered, this, std::bind(&TransactionsTab::importStatement, this, MainObject::ifNatwest));
-    connect(ui->actionImport_Revolut, &QAction::triggered, this, std::bind(&TransactionsTab::importStatement, this, MainObject::ifRevolut));
+    ui->importStatementButton->setMenu(m_importStatementsMenu);
     connect(ui->removeTransactionButton, &QPushButton::clicked, this, &TransactionsTab::onRemoveTransactions);
     connect(ui->currencyFilterCombo, &QComboBox::currentIndexChanged, this, &TransactionsTab::onFilterChanged);
     connect(ui->categoryFilterCombo, &QComboBox::currentIndexChanged, this, &TransactionsTab::onFilterChanged);
@@ -74,7 +78,7 @@ TransactionsTab::TransactionsTab(QWidget *parent)
     connect(ui->showUncategorisedCheck, &QCheckBox::checkStateChanged, this, &TransactionsTab::onShowWIPChanged);
 #endif
     connect(ui->transactionView->selectionModel(), &QItemSelectionModel::selectionChanged, this,
-            [this]() { ui->removeTransactionButton->setEnabled(!ui->transactionView->selectionModel()->selectedIndexes().isEmpty()); });
+            [this]() { ui->removeTransactionButton->setEnabled(ui->transactionView->selectionModel()->hasSelection()); });
 }
 
 TransactionsTab::~TransactionsTab()
@@ -105,12 +109,13 @@ void TransactionsTab::setMainObject(MainObject *mainObj)
             ui->accountFilterCombo->setModelColumn(MainObject::acName);
             ui->categoryFilterCombo->setModelColumn(MainObject::cacName);
             ui->subcategoryFilterCombo->setModelColumn(MainObject::sccName);
-            m_subcategoryFilter->setFilterKeyColumn(MainObject::sccCategoryId);
+            m_subcategoryFilter->setPartitionColumn(MainObject::sccCategoryId);
             refreshLastUpdate();
         };
-        connect(m_object->transactionsModel(), &QAbstractItemModel::rowsInserted, this, setupView);
-        connect(m_object->transactionsModel(), &QAbstractItemModel::modelReset, this, setupView);
+        connect(m_filterProxy, &QAbstractItemModel::rowsInserted, this, setupView);
+        connect(m_filterProxy, &QAbstractItemModel::modelReset, this, setupView);
         setupView();
+        fillImportMenu();
     } else
         ui->removeTransactionButton->setEnabled(false);
     m_currencyDelegate->setRelationModel(m_object ? m_object->currenciesModel() : nullptr, MainObject::ccId, MainObject::ccCurrency);
@@ -122,6 +127,13 @@ void TransactionsTab::setMainObject(MainObject *mainObj)
     m_movementTypeDelegate->setRelationModel(m_object ? m_object->movementTypesModel() : nullptr, MainObject::mtcId, MainObject::mtcName);
 }
 
+void TransactionsTab::setActive(bool active)
+{
+    if (!m_object)
+        return;
+    m_filterProxy->setSuspended(!active);
+}
+
 void TransactionsTab::onShowWIPChanged()
 {
     if (ui->showUncategorisedCheck->checkState() == Qt::Checked) {
@@ -134,31 +146,80 @@ void TransactionsTab::onShowWIPChanged()
     }
 }
 
-void TransactionsTab::importStatement(MainObject::ImportFormats format)
+void TransactionsTab::fillImportMenu()
 {
-    Q_ASSERT(m_object);
-    SelectAccountDialog selectAccountDialog;
-    selectAccountDialog.setMainObject(m_object);
-    if (!selectAccountDialog.exec())
+    m_importStatementsMenu->clear();
+    if (!m_object)
         return;
+    connect(m_importStatementsMenu->addAction(tr("Detect Format")), &QAction::triggered, this,
+            std::bind(&TransactionsTab::importStatement, this, QString()));
+    m_importStatementsMenu->addSeparator();
+    const QStringList importerNames = m_object->importers()->importerNames();
+    for (const QString &importerName : importerNames) {
+        connect(m_importStatementsMenu->addAction(tr("Import %1 Account").arg(importerName)), &QAction::triggered, this,
+                std::bind(&TransactionsTab::importStatement, this, importerName));
+    }
+    m_importStatementsMenu->addSeparator();
+    connect(m_importStatementsMenu->addAction(tr("Column Mappings...")), &QAction::triggered, this, &TransactionsTab::onEditImportMappings);
+}
+
+void TransactionsTab::onEditImportMappings()
+{
+    Q_ASSERT(m_object);
+    ImportMappingDialog mappingDialog(this);
+    mappingDialog.setRegistry(m_object->importers());
+    mappingDialog.exec();
+    fillImportMenu();
+}
+
+void TransactionsTab::importStatement(const QString &format)
+{
+    Q_ASSERT(m_object);
+    const StatementImporterRegistry *importers = m_object->importers();
+    QStringList extensions = format.isEmpty() ? importers->fileExtensions() : importers->importer(format)->fileExtensions();
+    for (QString &extension : extensions)
+        extension.prepend(QStringLiteral("*."));
     Q_ASSERT(!QStandardPaths::standardLocations(QStandardPaths::DownloadLocation).isEmpty());
-    QString path = QFileDialog::getOpenFileName(
-            this, tr("Open Statement"), QStandardPaths::standardLocations(QStandardPaths::DownloadLocation).first(), tr("Statement Files (*.csv)"));
+    const QString path =
+            QFileDialog::getOpenFileName(this, tr("Open Statement"), QStandardPaths::standardLocations(QStandardPaths::DownloadLocation).first(),
+                                         tr("Statement Files (%1)").arg(extensions.join(QLatin1Char(' '))));
     if (path.isEmpty())
         return;
-    if (!m_object->importStatement(selectAccountDialog.selectedAccountId(), path, format)) {
+    QList<ImportedStatement> statements;
+    if (!m_object->readStatement(path, format, &statements)) {
         QMessageBox::critical(this, tr("Error"), tr("Error while importing the statement. The file might be currupted or in an unexpected format"));
         return;
     }
-    refreshLastUpdate();
+    QList<int> accounts;
+    accounts.reserve(statements.size());
+    for (const ImportedStatement &statement : std::as_const(statements)) {
+        SelectAccountDialog selectAccountDialog;
+        selectAccountDialog.setMainObject(m_object);
+        if (!statement.accountId.isEmpty())
+            selectAccountDialog.setPrompt(tr("Select the account for statement %1").arg(statement.accountId));
+        if (!selectAccountDialog.exec())
+            return;
+        accounts.append(selectAccountDialog.selectedAccountId());
+    }
+    m_object->importStatements(statements, accounts).then(this, [this](bool imported) {
+        if (!imported) {
+            QMessageBox::critical(this, tr("Error"),
+                                  tr("Error while importing the statement. The file might be currupted or in an unexpected format"));
+            return;
+        }
+        refreshLastUpdate();
+    });
 }
 
 void TransactionsTab::onRemoveTransactions()
 {
     QList<int> idsToRemove;
-    const auto seletctedIndexes = ui->transactionView->selectionModel()->selectedIndexes();
-    for (auto &&idx : seletctedIndexes)
-        idsToRemove.append(idx.sibling(idx.row(), MainObject::tcId).data().toInt());
+    // one id per selected row, walking the ranges avoids materialising an index for every selected cell
+    const QItemSelection selection = ui->transactionView->selectionModel()->selection();
+    for (const QItemSelectionRange &range : selection) {
+        for (int i = range.top(), iEnd = range.bottom(); i <= iEnd; ++i)
+            idsToRemove.append(range.model()->index(i, MainObject::tcId, range.parent()).data().toInt());
+    }
     std::sort(idsToRemove.begin(), idsToRemove.end());
     idsToRemove.erase(std::unique(idsToRemove.begin(), idsToRemove.end()), idsToRemove.end());
     if (QMessageBox::question(this, tr("Are you sure?"), tr("Are you sure you want to remove the selected transaction(s)?", "", idsToRemove.size()),
@@ -166,22 +227,34 @@ void TransactionsTab::onRemoveTransactions()
         == QMessageBox::No)
         return;
     Q_ASSERT(m_object);
-    if (!m_object->removeTransactions(idsToRemove))
-        QMessageBox::critical(this, tr("Error"), tr("Failed to remove transaction(s), try again later", "", idsToRemove.size()));
+    const int removedCount = idsToRemove.size();
+    m_object->removeTransactions(idsToRemove).then(this, [this, removedCount](bool removed) {
+        if (!removed)
+            QMessageBox::critical(this, tr("Error"), tr("Failed to remove transaction(s), try again later", "", removedCount));
+    });
 }
 
 void TransactionsTab::refreshLastUpdate()
 {
     if (!m_object)
         return ui->lastUpdateLabel->hide();
-    const QDate lastUpdDt = m_object->lastTransactionDate();
-    ui->lastUpdateLabel->setVisible(lastUpdDt.isValid());
-    if (lastUpdDt.isValid())
-        ui->lastUpdateLabel->setText(tr("Last Update: %1").arg(locale().toString(lastUpdDt)));
+    m_object->lastTransactionDate().then(this, [this](const QDate &lastUpdDt) {
+        ui->lastUpdateLabel->setVisible(lastUpdDt.isValid());
+        if (lastUpdDt.isValid())
+            ui->lastUpdateLabel->setText(tr("Last Update: %1").arg(locale().toString(lastUpdDt)));
+    });
 }
 
 void TransactionsTab::onFilterChanged()
 {
+    // typing a word or stepping through dates only requeries once the user pauses
+    m_filterTimer->start();
+}
+
+void TransactionsTab::applyFilter()
+{
+    if (!m_object)
+        return;
     QList<MainObject::TransactionModelColumn> cols;
     QStringList filters;
     if (ui->currencyFilterCombo->currentIndex() > 0) {
@@ -233,10 +306,8 @@ void TransactionsTab::onCategoryFilterChanged()
         ui->subcategoryFilterCombo->setCurrentIndex(0);
         ui->subcategoryFilterCombo->setEnabled(false);
     } else {
-        m_subcategoryFilter->setFilterRegularExpression(
-                QLatin1Char('^')
-                + QString::number(m_object->categoriesModel()->index(ui->categoryFilterCombo->currentIndex() - 1, MainObject::cacId).data().toInt())
-                + QLatin1Char('$'));
+        m_subcategoryFilter->setPartition(
+                m_object->categoriesModel()->index(ui->categoryFilterCombo->currentIndex() - 1, MainObject::cacId).data().toInt());
         ui->subcategoryFilterCombo->setEnabled(true);
     }
 }
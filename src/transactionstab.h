@@ -24,7 +24,9 @@ class OrFilterProxy;
 class BlankRowProxy;
 class DecimalDelegate;
 class IsoDateDelegate;
-class QSortFilterProxyModel;
+class PartitionProxy;
+class QMenu;
+class QTimer;
 class TransactionsTab : public QWidget
 {
     Q_OBJECT
@@ -33,12 +35,16 @@ public:
     explicit TransactionsTab(QWidget *parent = nullptr);
     ~TransactionsTab();
     void setMainObject(MainObject *mainObj);
+    void setActive(bool active);
 
 private:
     void onShowWIPChanged();
     void onFilterChanged();
+    void applyFilter();
     void onCategoryFilterChanged();
-    void importStatement(MainObject::ImportFormats format);
+    void fillImportMenu();
+    void onEditImportMappings();
+    void importStatement(const QString &format);
     void onRemoveTransactions();
     void refreshLastUpdate();
     MainObject *m_object;
@@ -54,7 +60,9 @@ private:
     BlankRowProxy *m_accountProxy;
     BlankRowProxy *m_categoryProxy;
     BlankRowProxy *m_subcategoryProxy;
-    QSortFilterProxyModel *m_subcategoryFilter;
+    PartitionProxy *m_subcategoryFilter;
+    QMenu *m_importStatementsMenu;
+    QTimer *m_filterTimer;
 
     Ui::TransactionsTab *ui;
 };